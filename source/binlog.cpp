@@ -0,0 +1,308 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <atomic>
+
+#include "binlog.hpp"
+#include "config.hpp"
+
+namespace Server {
+
+BinLogSite::BinLogSite(LogLevel::Level level, const BinLogLocation& loc, const std::string& signature)
+    : m_level{ level },
+    m_file{ loc.file },
+    m_line{ loc.line },
+    m_format{ loc.format },
+    m_signature{ signature } {
+    // ids are dense, appenders use them as index
+    static std::atomic<uint32_t> s_id{ 0 };
+    m_id = ++s_id;
+};
+
+template<typename T>
+static bool ReadArg(const char*& p, const char* end, T& v) {
+    if (end - p < (ptrdiff_t)sizeof(T)) {
+        return false;
+    }
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+// "%-08.3lld" -> flags/width/precision kept, length modifier dropped
+static std::string SpecPrefix(std::string spec) {
+    while (!spec.empty() && strchr("hlLqjzt", spec.back())) {
+        spec.pop_back();
+    }
+    return spec;
+}
+
+bool BinLog::Format(std::string& out, const char* format, const std::string& signature,
+                    const char* payload, size_t size) {
+    const char* p = payload;
+    const char* end = payload + size;
+    size_t arg = 0;
+    char buf[512];
+
+    for (const char* f = format; *f; ++f) {
+        if (*f != '%') {
+            out.push_back(*f);
+            continue;
+        }
+
+        if (f[1] == '%') {
+            out.push_back('%');
+            ++f;
+            continue;
+        }
+
+        // %[flags][width][.precision][length]conversion
+        const char* specBegin = f;
+        ++f;
+        while (*f && strchr("-+ #0123456789.*hlLqjzt", *f)) {
+            ++f;
+        }
+        if (!*f) {
+            out.append(specBegin);
+            break;
+        }
+
+        // a '*' width or precision takes the next integer argument
+        char conv = *f;
+        std::string spec;
+        bool missing = false;
+        for (const char* s = specBegin; s < f && !missing; ++s) {
+            if (*s != '*') {
+                spec.push_back(*s);
+                continue;
+            }
+            if (arg >= signature.size() || (signature[arg] != 'i' && signature[arg] != 'u')) {
+                missing = true;
+                break;
+            }
+            int64_t v;
+            if (!ReadArg(p, end, v)) {
+                return false;
+            }
+            ++arg;
+            if (spec.back() == '.' && v < 0) {
+                spec.pop_back();            // a negative precision is no precision
+            } else {
+                spec += std::to_string(v);
+            }
+        }
+        spec = SpecPrefix(std::move(spec));
+
+        if (missing || arg >= signature.size()) {
+            out.append(specBegin, f + 1);   // no argument left, keep it verbatim
+            continue;
+        }
+
+        int n = 0;
+        switch (signature[arg++]) {
+            case 'i': {
+                int64_t v;
+                if (!ReadArg(p, end, v)) {
+                    return false;
+                }
+                if (conv == 'c') {
+                    spec += "c";
+                    n = snprintf(buf, sizeof(buf), spec.c_str(), (int)v);
+                } else {
+                    spec += strchr("diouxX", conv) ? std::string("ll") + conv : std::string("lld");
+                    n = snprintf(buf, sizeof(buf), spec.c_str(), (long long)v);
+                }
+                break;
+            }
+            case 'u': {
+                uint64_t v;
+                if (!ReadArg(p, end, v)) {
+                    return false;
+                }
+                if (conv == 'c') {
+                    spec += "c";
+                    n = snprintf(buf, sizeof(buf), spec.c_str(), (int)v);
+                } else {
+                    spec += strchr("diouxX", conv) ? std::string("ll") + conv : std::string("llu");
+                    n = snprintf(buf, sizeof(buf), spec.c_str(), (unsigned long long)v);
+                }
+                break;
+            }
+            case 'd': {
+                double v;
+                if (!ReadArg(p, end, v)) {
+                    return false;
+                }
+                spec += strchr("eEfFgGaA", conv) ? conv : 'g';
+                n = snprintf(buf, sizeof(buf), spec.c_str(), v);
+                break;
+            }
+            case 'p': {
+                uint64_t v;
+                if (!ReadArg(p, end, v)) {
+                    return false;
+                }
+                spec += "p";
+                n = snprintf(buf, sizeof(buf), spec.c_str(), (void*)(uintptr_t)v);
+                break;
+            }
+            case 's': {
+                uint32_t len;
+                if (!ReadArg(p, end, len) || end - p < (ptrdiff_t)len) {
+                    return false;
+                }
+                if (spec == "%") {
+                    out.append(p, len);     // common case, no padding
+                } else {
+                    spec += "s";
+                    std::string str(p, len);
+                    n = snprintf(buf, sizeof(buf), spec.c_str(), str.c_str());
+                }
+                p += len;
+                break;
+            }
+            default:
+                return false;
+        }
+
+        if (n > 0) {
+            out.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+        }
+    }
+
+    return true;
+};
+
+BinaryFileLogAppender::BinaryFileLogAppender(const std::string& filename, size_t bufferSize)
+    : m_filename{ filename } {
+    m_buffer.reserve(bufferSize + 1024);
+    reopen();
+    setFlushPolicy(DefaultFlushPolicy(bufferSize));
+};
+
+BinaryFileLogAppender::~BinaryFileLogAppender() {
+    stopFlusher();
+    MutexType::Lock lock(m_mutex);
+    flushNoLock();
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+};
+
+LogFlushPolicy BinaryFileLogAppender::DefaultFlushPolicy(size_t bufferSize) {
+    // errors are written right away so they survive a crash, a quiet
+    // stream still reaches the file within a second
+    LogFlushPolicy policy;
+    policy.line = false;
+    policy.bytes = bufferSize;
+    policy.interval = 1000;
+    policy.level = LogLevel::Level::ERROR;
+    return policy;
+};
+
+bool BinaryFileLogAppender::reopen() {
+    MutexType::Lock lock(m_mutex);
+    flushNoLock();
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (m_fd < 0) {
+        std::cout << "BinaryFileLogAppender open " << m_filename << " failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // a new file needs the header, and every call site has to be described again
+    if (lseek(m_fd, 0, SEEK_END) == 0) {
+        m_buffer.append(BinLog::MAGIC, sizeof(BinLog::MAGIC));
+    }
+    m_writtenSites.clear();
+    return true;
+};
+
+void BinaryFileLogAppender::writeSiteNoLock(const BinLogSite& site) {
+    if (m_writtenSites.size() <= site.getId()) {
+        m_writtenSites.resize(site.getId() + 1, false);
+    }
+    m_writtenSites[site.getId()] = true;
+
+    uint16_t fileLen = strlen(site.getFile());
+    uint16_t fmtLen = strlen(site.getFormat());
+    uint8_t sigLen = site.getSignature().size();
+
+    put<uint8_t>(BinLog::SITE);
+    put<uint32_t>(site.getId());
+    put<uint8_t>((uint8_t)site.getLevel());
+    put<int32_t>(site.getLine());
+    put(fileLen);
+    m_buffer.append(site.getFile(), fileLen);
+    put(fmtLen);
+    m_buffer.append(site.getFormat(), fmtLen);
+    put(sigLen);
+    m_buffer.append(site.getSignature().data(), sigLen);
+};
+
+void BinaryFileLogAppender::logBinary(const Logger::ptr& logger, const BinLogRecord& record) {
+    if (record.level < m_level) {
+        return;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    uint32_t id = record.site->getId();
+    if (id >= m_writtenSites.size() || !m_writtenSites[id]) {
+        writeSiteNoLock(*record.site);
+    }
+
+    put<uint8_t>(BinLog::EVENT);
+    put<uint32_t>(id);
+    put<uint8_t>((uint8_t)record.level);
+    put<uint64_t>(record.timeNs);
+    put<uint32_t>(record.threadId);
+    put<uint32_t>(record.fiberId);
+    put<uint32_t>(record.size);
+    m_buffer.append(record.payload, record.size);
+    appendedNoLock(record.level, record.timeNs);
+};
+
+void BinaryFileLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        return;
+    }
+
+    std::string_view msg = event->getContentView();
+    uint16_t fileLen = strlen(event->getFile());
+
+    MutexType::Lock lock(m_mutex);
+    put<uint8_t>(BinLog::TEXT);
+    put<uint8_t>((uint8_t)level);
+    put<uint64_t>(event->getTimeNs());
+    put<uint32_t>(event->getThreadId());
+    put<uint32_t>(event->getFiberId());
+    put<int32_t>(event->getLine());
+    put(fileLen);
+    m_buffer.append(event->getFile(), fileLen);
+    put<uint32_t>(msg.size());
+    m_buffer.append(msg.data(), msg.size());
+    appendedNoLock(level, event->getTimeNs());
+};
+
+std::string BinaryFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "BinaryFileLogAppender";
+    node["file"] = m_filename;
+
+    if (m_level != LogLevel::Level::UNKNOWN) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    FlushPolicyToYaml(node, m_flushPolicy, DefaultFlushPolicy());
+
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+};
+
+}
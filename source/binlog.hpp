@@ -0,0 +1,237 @@
+#ifndef __SERVER_BINLOG_HPP__
+#define __SERVER_BINLOG_HPP__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <type_traits>
+#include <string.h>
+
+#include "log.hpp"
+#include "util.hpp"
+
+// Deferred formatting log (NanoLog style), same arguments as SERVER_LOG_FMT_*.
+// The format string and source location are registered once per call site,
+// the hot path only copies the site id and the raw argument bytes, formatting
+// happens later in the decoder (or in appenders which only understand text)
+#define SERVER_LOG_BIN_LEVEL(logger, level, fmt, ...) \
+    if (static constinit Server::LogCallSite __log_site{ __FILE__, __LINE__ }; \
+        SERVER_LOG_ENABLED(logger, level, __log_site)) \
+        Server::BinLog::Write(logger, level, SERVER_LOG_RECORD_ONLY(logger, level, __log_site), []() { \
+            return Server::BinLogLocation{ __FILE__, __LINE__, fmt }; \
+        } __VA_OPT__(,) __VA_ARGS__)
+
+#define SERVER_LOG_BIN_DEBUG(logger, fmt, ...) SERVER_LOG_BIN_LEVEL(logger, Server::LogLevel::Level::DEBUG, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SERVER_LOG_BIN_INFO(logger, fmt, ...) SERVER_LOG_BIN_LEVEL(logger, Server::LogLevel::Level::INFO, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SERVER_LOG_BIN_WARN(logger, fmt, ...) SERVER_LOG_BIN_LEVEL(logger, Server::LogLevel::Level::WARN, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SERVER_LOG_BIN_ERROR(logger, fmt, ...) SERVER_LOG_BIN_LEVEL(logger, Server::LogLevel::Level::ERROR, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SERVER_LOG_BIN_FATAL(logger, fmt, ...) SERVER_LOG_BIN_LEVEL(logger, Server::LogLevel::Level::FATAL, fmt __VA_OPT__(,) __VA_ARGS__)
+
+namespace Server {
+
+// source location of a binary log call site
+struct BinLogLocation {
+    const char* file;
+    int32_t line;
+    const char* format;
+};
+
+// A registered call site, lives in static storage of the call site
+class BinLogSite {
+public:
+    BinLogSite(LogLevel::Level level, const BinLogLocation& loc, const std::string& signature);
+
+    uint32_t getId() const { return m_id; }
+    LogLevel::Level getLevel() const { return m_level; }
+    const char* getFile() const { return m_file; }
+    int32_t getLine() const { return m_line; }
+    const char* getFormat() const { return m_format; }
+
+    // one type tag per argument, see BinLogArg
+    const std::string& getSignature() const { return m_signature; }
+
+private:
+    uint32_t m_id;
+    LogLevel::Level m_level;
+    const char* m_file;
+    int32_t m_line;
+    const char* m_format;
+    std::string m_signature;
+};
+
+// One binary log statement, payload holds the encoded arguments
+struct BinLogRecord {
+    const BinLogSite* site;
+    LogLevel::Level level;
+    uint64_t timeNs;
+    uint32_t threadId;
+    uint32_t fiberId;
+    const char* payload;
+    uint32_t size;
+    bool recordOnly;            // only for the flight recorder
+};
+
+// Encoding of one argument type, integers and pointers are widened to
+// 8 bytes, strings are stored as u32 length + bytes
+template<typename T, typename = void>
+struct BinLogArg;
+
+template<typename T>
+struct BinLogArg<T, std::enable_if_t<std::is_integral_v<T>>> {
+    static constexpr char TAG = std::is_signed_v<T> ? 'i' : 'u';
+    static size_t Size(T) { return 8; }
+    static char* Encode(char* p, T v) {
+        using W = std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>;
+        W w = v;
+        memcpy(p, &w, 8);
+        return p + 8;
+    }
+};
+
+template<typename T>
+struct BinLogArg<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static constexpr char TAG = 'd';
+    static size_t Size(T) { return 8; }
+    static char* Encode(char* p, T v) {
+        double d = v;
+        memcpy(p, &d, 8);
+        return p + 8;
+    }
+};
+
+template<typename T>
+struct BinLogArg<T, std::enable_if_t<std::is_enum_v<T>>> {
+    static constexpr char TAG = 'i';
+    static size_t Size(T) { return 8; }
+    static char* Encode(char* p, T v) {
+        int64_t w = (int64_t)v;
+        memcpy(p, &w, 8);
+        return p + 8;
+    }
+};
+
+struct BinLogStringArg {
+    static constexpr char TAG = 's';
+    static size_t Size(std::string_view v) { return 4 + v.size(); }
+    static char* Encode(char* p, std::string_view v) {
+        uint32_t len = v.size();
+        memcpy(p, &len, 4);
+        memcpy(p + 4, v.data(), len);
+        return p + 4 + len;
+    }
+};
+
+template<>
+struct BinLogArg<const char*> : public BinLogStringArg {
+    static size_t Size(const char* v) { return BinLogStringArg::Size(v ? v : "(null)"); }
+    static char* Encode(char* p, const char* v) { return BinLogStringArg::Encode(p, v ? v : "(null)"); }
+};
+
+template<>
+struct BinLogArg<char*> : public BinLogArg<const char*> {};
+
+template<>
+struct BinLogArg<std::string> : public BinLogStringArg {};
+
+template<>
+struct BinLogArg<std::string_view> : public BinLogStringArg {};
+
+template<typename T>
+struct BinLogArg<T*, std::enable_if_t<!std::is_same_v<std::remove_cv_t<T>, char>>> {
+    static constexpr char TAG = 'p';
+    static size_t Size(const T*) { return 8; }
+    static char* Encode(char* p, const T* v) {
+        uint64_t w = (uintptr_t)v;
+        memcpy(p, &w, 8);
+        return p + 8;
+    }
+};
+
+class BinLog {
+public:
+    // record type tags of the binary log file
+    enum RecordType : uint8_t {
+        SITE  = 1,      // call site definition, written before its first event
+        EVENT = 2,      // binary event, arguments encoded by BinLogArg
+        TEXT  = 3       // already formatted event from the stream-style macros
+    };
+
+    // file starts with this magic, values use host byte order
+    static constexpr char MAGIC[8] = { 'S', 'R', 'V', 'B', 'L', 'O', 'G', '1' };
+
+    template<typename... Args>
+    static std::string Signature() {
+        return std::string{ BinLogArg<std::decay_t<Args>>::TAG... };
+    }
+
+    // hot path: encode arguments and hand the record to the logger
+    template<typename Loc, typename... Args>
+    static void Write(const Logger::ptr& logger, LogLevel::Level level, bool recordOnly,
+                      Loc loc, const Args&... args) {
+        // one static per call site since every call site has its own lambda type
+        static const BinLogSite s_site(level, loc(), Signature<Args...>());
+
+        size_t size = (BinLogArg<std::decay_t<Args>>::Size(args) + ... + 0);
+
+        char stack[256];
+        std::vector<char> heap;
+        char* buf = stack;
+        if (size > sizeof(stack)) {
+            heap.resize(size);
+            buf = heap.data();
+        }
+
+        char* p = buf;
+        ((p = BinLogArg<std::decay_t<Args>>::Encode(p, args)), ...);
+        (void)p;
+
+        BinLogRecord record{ &s_site, level, GetCurrentNS(), (uint32_t)getThreadId(),
+                            getFiberId(), buf, (uint32_t)size, recordOnly };
+        logger->dispatchBinary(record);
+    }
+
+    // format the encoded arguments with printf style format, append to out,
+    // return false if payload is shorter than the signature requires
+    static bool Format(std::string& out, const char* format, const std::string& signature,
+                        const char* payload, size_t size);
+};
+
+// Output binary records to file, decode it with log_decoder. Records are
+// buffered like the lines of the text appenders, by default the buffer is
+// written when it is full, on ERROR and once a second
+class BinaryFileLogAppender : public BufferedLogAppender {
+public:
+    using ptr = std::shared_ptr<BinaryFileLogAppender>;
+
+    BinaryFileLogAppender(const std::string& filename, size_t bufferSize = 64 * 1024);
+    ~BinaryFileLogAppender();
+
+    // flush policy of an appender created without one
+    static LogFlushPolicy DefaultFlushPolicy(size_t bufferSize = 64 * 1024);
+
+    // stream-style events are stored as preformatted TEXT records
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    void logBinary(const Logger::ptr& logger, const BinLogRecord& record) override;
+    std::string toYamlString() override;
+    std::string getTypeName() const override { return "BinaryFileLogAppender"; }
+    std::string getTarget() const override { return m_filename; }
+
+    // close and open the file again, call sites are described again
+    bool reopen();
+
+private:
+    void writeSiteNoLock(const BinLogSite& site);
+
+    template<typename T>
+    void put(const T& v) {
+        m_buffer.append((const char*)&v, sizeof(T));
+    }
+
+private:
+    std::string m_filename;
+    std::vector<bool> m_writtenSites;   // site ids already described in current file
+};
+
+}
+
+#endif
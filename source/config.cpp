@@ -1,15 +1,16 @@
 #include <list>
 #include <utility>
+#include <vector>
+#include <fstream>
+#include <iterator>
 #include "config.hpp"
+#include "configcache.hpp"
+#include "configtxn.hpp"
 
 namespace Server {
 
 ConfigArgBase::ptr ConfigMgr::lookUpBase(const std::string& name) {
-    RWMutexType::ReadLock lock(getMutex());
-    
-    auto it = getData().find(name);
-
-    return it == getData().end() ? nullptr : it->second;
+    return find(Key{ name, ConfigHash(name) });
 };
 
 // "A.B", 10
@@ -35,8 +36,9 @@ static void listAllMember(const std::string& key,
     }
 };
 
-// load all configuration from ymal
-void ConfigMgr::loadFromYaml(const YAML::Node& root) {
+// set every registered arg from the tree, each key and its arg is added
+// to loaded if given
+static void LoadNodes(const YAML::Node& root, ConfigCache::Entries* loaded) {
     std::list<std::pair<std::string, const YAML::Node>> allNodes;
     listAllMember("", root, allNodes);
     
@@ -47,26 +49,158 @@ void ConfigMgr::loadFromYaml(const YAML::Node& root) {
         }
 
         std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-        ConfigArgBase::ptr arg = lookUpBase(key);
+        ConfigArgBase::ptr arg = ConfigMgr::lookUpBase(key);
         
         if (arg) {
-            if (i.second.IsScalar()) {          // int/float/string
-                arg->fromString(i.second.Scalar());
-            } else {
-                std::stringstream ss;
-                ss << i.second;
-                arg->fromString(ss.str());
+            // decoded from the parsed node, no string round trip
+            arg->fromNode(i.second);
+        }
+        if (loaded) {
+            loaded->emplace_back(std::move(key), arg);
+        }
+    }
+};
+
+// load all configuration from ymal
+void ConfigMgr::loadFromYaml(const YAML::Node& root) {
+    LoadNodes(root, nullptr);
+};
+
+bool ConfigMgr::loadFromFile(const std::string& path, const std::string& cache) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "Config open " << path << " failed";
+        return false;
+    }
+    std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    uint64_t hash = ConfigHash(text);
+    if (!cache.empty() && ConfigCache::Load(cache, hash)) {
+        return true;
+    }
+
+    ConfigCache::Entries loaded;
+    try {
+        LoadNodes(YAML::Load(text), cache.empty() ? nullptr : &loaded);
+    } catch (std::exception& e) {
+        SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "Config load " << path << " failed: " << e.what();
+        return false;
+    }
+    if (!cache.empty()) {
+        ConfigCache::Save(cache, hash, loaded);
+    }
+    return true;
+};
+
+// true if both trees hold the same values, maps compared in key order
+static bool SameNode(const YAML::Node& a, const YAML::Node& b) {
+    if (a.Type() != b.Type()) {
+        return false;
+    }
+    if (a.IsScalar()) {
+        return a.Scalar() == b.Scalar();
+    }
+    if (a.size() != b.size()) {
+        return false;
+    }
+    if (a.IsSequence()) {
+        for (auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+            if (!SameNode(*i, *j)) {
+                return false;
+            }
+        }
+    } else if (a.IsMap()) {
+        for (auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+            if (i->first.Scalar() != j->first.Scalar() || !SameNode(i->second, j->second)) {
+                return false;
             }
         }
     }
+    return true;
+};
+
+// apply node (and its children) where it differs from old, nullptr when
+// the key is new. returns true if anything below key changed
+static bool ApplyDiff(const std::string& key, const YAML::Node* old,
+                      const YAML::Node& node, ConfigTransaction* txn, size_t& applied) {
+    bool changed;
+    if (node.IsMap()) {
+        changed = !old || !old->IsMap() || old->size() != node.size();
+
+        // children usually keep their order, a hash of the old ones is
+        // only built when they do not
+        std::unordered_map<std::string, YAML::Node> olds;
+        YAML::const_iterator oldIt;
+        bool inOrder = old && old->IsMap();
+        if (inOrder) {
+            oldIt = old->begin();
+        }
+
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            const std::string& name = it->first.Scalar();
+            const YAML::Node* oldChild = nullptr;
+            YAML::Node found;
+            if (inOrder && oldIt != old->end() && oldIt->first.Scalar() == name) {
+                found = oldIt->second;
+                oldChild = &found;
+                ++oldIt;
+            } else if (old && old->IsMap()) {
+                if (inOrder) {
+                    inOrder = false;
+                    for (auto o = old->begin(); o != old->end(); ++o) {
+                        olds.emplace(o->first.Scalar(), o->second);
+                    }
+                }
+                auto o = olds.find(name);
+                oldChild = o == olds.end() ? nullptr : &o->second;
+            }
+
+            // an unchanged leaf costs one compare, no key is built
+            if (oldChild && !it->second.IsMap() && SameNode(*oldChild, it->second)) {
+                continue;
+            }
+
+            std::string childKey = key.empty() ? name : key + '.' + name;
+            if (childKey.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789") != std::string::npos) {
+                SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "Config invalid name: " << childKey;
+                continue;
+            }
+            changed |= ApplyDiff(childKey, oldChild, it->second, txn, applied);
+        }
+    } else {
+        changed = !old || !SameNode(*old, node);
+    }
+
+    if (changed && !key.empty()) {
+        if (txn) {
+            applied += txn->setNode(key, node);
+        } else if (ConfigArgBase::ptr arg = ConfigMgr::lookUpBase(key)) {
+            arg->fromNode(node);
+            ++applied;
+        }
+    }
+    return changed;
+};
+
+size_t ConfigMgr::applyYamlDiff(const YAML::Node& last, const YAML::Node& root,
+                                ConfigTransaction* txn) {
+    size_t applied = 0;
+    ApplyDiff("", last.IsDefined() && !last.IsNull() ? &last : nullptr, root, txn, applied);
+    return applied;
 };
 
 void ConfigMgr::Visit(std::function<void(ConfigArgBase::ptr)> cb) {
-    RWMutex::ReadLock lock(getMutex());
+    // cb may look up args, it runs without the shard locks
+    std::vector<ConfigArgBase::ptr> args;
+    for (size_t i = 0; i < SHARDS; ++i) {
+        Shard& shard = getShard(Key{ "", i });
+        RWMutexType::ReadLock lock(shard.mutex);
+        for (auto& it : shard.data) {
+            args.push_back(it.second);
+        }
+    }
 
-    ConfigArgMap& m = getData();
-    for (auto it = m.begin(); it != m.end(); ++it) {
-        cb(it->second);
+    for (auto& arg : args) {
+        cb(arg);
     }
 }
 
@@ -8,11 +8,15 @@
 #include <exception>
 #include <yaml-cpp/yaml.h>
 #include <list>
+#include <vector>
 #include <map>
 #include <unordered_map>
 #include <set>
 #include <unordered_set>
 #include <functional>
+#include <atomic>
+#include <type_traits>
+#include <string.h>
 
 #include "log.hpp"
 #include "thread.hpp"
@@ -25,9 +29,14 @@ using boost::lexical_cast;
 // Base class to store info of arguments,the 
 // actual value with specific types will be 
 // stored into derived class
-class ConfigArgBase {
+class ConfigArgBase : public std::enable_shared_from_this<ConfigArgBase> {
 public:
     using ptr = std::shared_ptr<ConfigArgBase>;
+    // runs the listeners of a change published by a transaction
+    using Dispatch = std::function<void()>;
+    // a value staged by a transaction, publishes it and returns its Dispatch.
+    // called by ConfigTransaction::commit with m_mutex write locked
+    using Staged = std::function<Dispatch()>;
 
     ConfigArgBase(const std::string& name, const std::string& description = "")
         : m_name{ name },
@@ -45,12 +54,92 @@ public:
     virtual std::string toString() = 0;
     virtual bool fromString(const std::string& val) = 0;
     virtual std::string getTypeName() const = 0;
+
+    // true if this is exactly Arg, a cheaper check than a dynamic_cast
+    template<typename Arg>
+    bool isA() const { return m_argType && *m_argType == typeid(Arg); }
+
+    // store arguments from a parsed yaml node, through the string form by default
+    virtual bool fromNode(const YAML::Node& node) {
+        if (node.IsScalar()) {
+            return fromString(node.Scalar());
+        }
+        std::stringstream ss;
+        ss << node;
+        return fromString(ss.str());
+    };
+
+    // decode node now, for a ConfigTransaction to publish later.
+    // nullptr if the node does not convert
+    virtual Staged stageNode(const YAML::Node& node) = 0;
+
+    // value for the snapshot cache, the string form by default.
+    // returns true if out holds the raw bytes of the value instead
+    virtual bool toBinary(std::string& out) {
+        out = toString();
+        return false;
+    };
+
+    // decode a value written by toBinary (raw tells which form it is),
+    // for a ConfigTransaction to publish. nullptr if it does not decode
+    virtual Staged stageBinary(std::string_view data, bool raw) = 0;
 protected:
     std::string m_name;        // name of argument
 
     std::string m_description; // argument description
+
+    const std::type_info* m_argType = nullptr;  // most derived class, set by ConfigArg
+
+    RWMutex m_mutex;            // guards the value and listeners of ConfigArg
+
+    // locks the args of a commit around their Staged
+    friend class ConfigTransaction;
 };
 
+class ConfigTransaction;
+
+// FNV-1a of a config name, the same at compile time and at runtime
+constexpr uint64_t ConfigHash(std::string_view name) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : name) {
+        hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+    }
+    return hash;
+};
+
+// names are made of lowercase letters, digits, '.' and '_'
+constexpr bool ConfigValidName(std::string_view name) {
+    if (name.empty()) {
+        return false;
+    }
+    for (char c : name) {
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.' || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+};
+
+// Name of a config arg validated and hashed at compile time, an invalid
+// name does not compile. Build it with CONFIG_KEY("fiber.stack_size")
+class ConfigKey {
+public:
+    consteval ConfigKey(const char* name): m_name{ name }, m_hash{ ConfigHash(name) } {
+        if (!ConfigValidName(m_name)) {
+            throw std::invalid_argument("invalid config name");
+        }
+    }
+
+    constexpr std::string_view getName() const { return m_name; }
+    constexpr uint64_t getHash() const { return m_hash; }
+
+private:
+    std::string_view m_name;
+    uint64_t m_hash;
+};
+
+#define CONFIG_KEY(name) ::Server::ConfigKey{ name }
+
 // template class for basic type convertion (F fromType, T toType )
 template<typename F, typename T>
 class LexicalCast {
@@ -60,103 +149,257 @@ public:
     };
 };
 
-// partial specialized template for conversion from string to vector
+// template class for conversion from an already parsed yaml node, so a
+// config is not printed and parsed again for every nested level. Types
+// without a specialization fall back to LexicalCast on the string form
 template<typename T>
-class LexicalCast<std::string, std::vector<T>> {
+class FromNode {
 public:
-    std::vector<T> operator()(const std::string& v){
-        // accept yaml format string and convert to yaml node / node sequence
-        YAML::Node node = YAML::Load(v);
+    T operator() (const YAML::Node& node) {
+        if (node.IsScalar()) {
+            return LexicalCast<std::string, T>()(node.Scalar());
+        }
 
-        typename std::vector<T> vec;
         std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str("");
-            ss << node[i];
-            // recursively call LexicalCast to parse any nested data types
-            vec.push_back(LexicalCast<std::string, T>() (ss.str()));
+        ss << node;
+        return LexicalCast<std::string, T>()(ss.str());
+    };
+};
+
+// template class for conversion into a yaml node, LexicalCast fallback
+template<typename T>
+class ToNode {
+public:
+    YAML::Node operator() (const T& v) {
+        if constexpr (std::is_arithmetic_v<T> || std::is_same_v<T, std::string>) {
+            // a plain scalar, a string like "a: b" must not turn into a map
+            return YAML::Node(LexicalCast<T, std::string>()(v));
+        } else {
+            return YAML::Load(LexicalCast<T, std::string>()(v));
+        }
+    };
+};
+
+// partial specialized template for conversion from node to vector
+template<typename T>
+class FromNode<std::vector<T>> {
+public:
+    std::vector<T> operator()(const YAML::Node& node){
+        typename std::vector<T> vec;
+        vec.reserve(node.size());
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            // recursively call FromNode to parse any nested data types
+            vec.push_back(FromNode<T>()(*it));
         }
 
         return vec;
     };
 };
 
-// partial specialized template for conversion from vector to string
+// partial specialized template for conversion from vector to node
 template<typename T>
-class LexicalCast<std::vector<T>, std::string> {
+class ToNode<std::vector<T>> {
 public:
-    std::string operator()(const std::vector<T>& v){
-        // accept vecotor(Yaml sequence) and convert to yaml format string
+    YAML::Node operator()(const std::vector<T>& v){
         YAML::Node node(YAML::NodeType::Sequence);
+        for (auto& i : v) {
+            node.push_back(ToNode<T>()(i));
+        }
 
-        for(auto& i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+        return node;
+    };
+};
+
+// partial specialized template for conversion from node to list
+template<typename T>
+class FromNode<std::list<T>> {
+public:
+    std::list<T> operator()(const YAML::Node& node){
+        typename std::list<T> vec;
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.push_back(FromNode<T>()(*it));
         }
 
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+        return vec;
     };
 };
 
-// partial specialized template for conversion from string to list
+// partial specialized template for conversion from list to node
 template<typename T>
-class LexicalCast<std::string, std::list<T>> {
+class ToNode<std::list<T>> {
 public:
-    std::list<T> operator()(const std::string& v){
-        // accept yaml format string and convert to yaml node / node sequence
-        YAML::Node node = YAML::Load(v);
+    YAML::Node operator()(const std::list<T>& v){
+        YAML::Node node(YAML::NodeType::Sequence);
+        for (auto& i : v) {
+            node.push_back(ToNode<T>()(i));
+        }
 
-        typename std::list<T> vec;
-        std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str("");
-            ss << node[i];
-            // recursively call LexicalCast
-            vec.push_back(LexicalCast<std::string, T>() (ss.str()));
+        return node;
+    };
+};
+
+// partial specialized template for conversion from node to set
+template<typename T>
+class FromNode<std::set<T>> {
+public:
+    std::set<T> operator()(const YAML::Node& node){
+        typename std::set<T> vec;
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(FromNode<T>()(*it));
         }
 
         return vec;
     };
 };
 
-// partial specialized template for conversion from list to string
+// partial specialized template for conversion from set to node
 template<typename T>
-class LexicalCast<std::list<T>, std::string> {
+class ToNode<std::set<T>> {
 public:
-    std::string operator()(const std::list<T>& v){
-        // accept vecotor(Yaml sequence) and convert to yaml format string
+    YAML::Node operator()(const std::set<T>& v){
+        YAML::Node node(YAML::NodeType::Sequence);
+        for (auto& i : v) {
+            node.push_back(ToNode<T>()(i));
+        }
+
+        return node;
+    };
+};
+
+// partial specialized template for conversion from node to unordered_set
+template<typename T>
+class FromNode<std::unordered_set<T>> {
+public:
+    std::unordered_set<T> operator()(const YAML::Node& node){
+        typename std::unordered_set<T> vec;
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(FromNode<T>()(*it));
+        }
+
+        return vec;
+    };
+};
+
+// partial specialized template for conversion from unordered_set to node
+template<typename T>
+class ToNode<std::unordered_set<T>> {
+public:
+    YAML::Node operator()(const std::unordered_set<T>& v){
         YAML::Node node(YAML::NodeType::Sequence);
+        for (auto& i : v) {
+            node.push_back(ToNode<T>()(i));
+        }
+
+        return node;
+    };
+};
 
-        for(auto& i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+// partial specialized template for conversion from node to map
+template<typename T>
+class FromNode<std::map<std::string, T>> {
+public:
+    std::map<std::string, T> operator()(const YAML::Node& node){
+        typename std::map<std::string, T> vec;
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(std::make_pair(it->first.Scalar(), FromNode<T>()(it->second)));
         }
 
+        return vec;
+    };
+};
+
+// partial specialized template for conversion from map to node
+template<typename T>
+class ToNode<std::map<std::string, T>> {
+public:
+    YAML::Node operator()(const std::map<std::string, T>& v){
+        YAML::Node node(YAML::NodeType::Map);
+        for (auto& i : v) {
+            node[i.first] = ToNode<T>()(i.second);
+        }
+
+        return node;
+    };
+};
+
+// partial specialized template for conversion from node to unordered_map
+template<typename T>
+class FromNode<std::unordered_map<std::string, T>> {
+public:
+    std::unordered_map<std::string, T> operator()(const YAML::Node& node){
+        typename std::unordered_map<std::string, T> vec;
+        vec.reserve(node.size());
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(std::make_pair(it->first.Scalar(), FromNode<T>()(it->second)));
+        }
+
+        return vec;
+    };
+};
+
+// partial specialized template for conversion from unordered_map to node
+template<typename T>
+class ToNode<std::unordered_map<std::string, T>> {
+public:
+    YAML::Node operator()(const std::unordered_map<std::string, T>& v){
+        YAML::Node node(YAML::NodeType::Map);
+        for (auto& i : v) {
+            node[i.first] = ToNode<T>()(i.second);
+        }
+
+        return node;
+    };
+};
+
+// partial specialized template for conversion from string to vector
+template<typename T>
+class LexicalCast<std::string, std::vector<T>> {
+public:
+    std::vector<T> operator()(const std::string& v){
+        // parse once, the elements are decoded from the node
+        return FromNode<std::vector<T>>()(YAML::Load(v));
+    };
+};
+
+// partial specialized template for conversion from vector to string
+template<typename T>
+class LexicalCast<std::vector<T>, std::string> {
+public:
+    std::string operator()(const std::vector<T>& v){
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::vector<T>>()(v);
         return ss.str();
     };
 };
 
+// partial specialized template for conversion from string to list
+template<typename T>
+class LexicalCast<std::string, std::list<T>> {
+public:
+    std::list<T> operator()(const std::string& v){
+        // parse once, the elements are decoded from the node
+        return FromNode<std::list<T>>()(YAML::Load(v));
+    };
+};
+
+// partial specialized template for conversion from list to string
+template<typename T>
+class LexicalCast<std::list<T>, std::string> {
+public:
+    std::string operator()(const std::list<T>& v){
+        std::stringstream ss;
+        ss << ToNode<std::list<T>>()(v);
+        return ss.str();
+    };
+};
 
 // partial specialized template for conversion from string to set
 template<typename T>
 class LexicalCast<std::string, std::set<T>> {
 public:
     std::set<T> operator()(const std::string& v){
-        // accept yaml format string and convert to yaml node / node sequence
-        YAML::Node node = YAML::Load(v);
-
-        typename std::set<T> vec;
-        std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str("");
-            ss << node[i];
-            // recursively call LexicalCast
-            vec.insert(LexicalCast<std::string, T>() (ss.str()));
-        }
-
-        return vec;
+        // parse once, the elements are decoded from the node
+        return FromNode<std::set<T>>()(YAML::Load(v));
     };
 };
 
@@ -165,15 +408,8 @@ template<typename T>
 class LexicalCast<std::set<T>, std::string> {
 public:
     std::string operator()(const std::set<T>& v){
-        // accept vecotor(Yaml sequence) and convert to yaml format string
-        YAML::Node node(YAML::NodeType::Sequence);
-
-        for(auto& i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
-        }
-
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::set<T>>()(v);
         return ss.str();
     };
 };
@@ -183,19 +419,8 @@ template<typename T>
 class LexicalCast<std::string, std::unordered_set<T>> {
 public:
     std::unordered_set<T> operator()(const std::string& v){
-        // accept yaml format string and convert to yaml node / node sequence
-        YAML::Node node = YAML::Load(v);
-
-        typename std::unordered_set<T> vec;
-        std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str("");
-            ss << node[i];
-            // recursively call LexicalCast
-            vec.insert(LexicalCast<std::string, T>() (ss.str()));
-        }
-
-        return vec;
+        // parse once, the elements are decoded from the node
+        return FromNode<std::unordered_set<T>>()(YAML::Load(v));
     };
 };
 
@@ -204,15 +429,8 @@ template<typename T>
 class LexicalCast<std::unordered_set<T>, std::string> {
 public:
     std::string operator()(const std::unordered_set<T>& v){
-        // accept vecotor(Yaml sequence) and convert to yaml format string
-        YAML::Node node(YAML::NodeType::Sequence);
-
-        for(auto& i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
-        }
-
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::unordered_set<T>>()(v);
         return ss.str();
     };
 };
@@ -222,19 +440,8 @@ template<typename T>
 class LexicalCast<std::string, std::map<std::string, T>> {
 public:
     std::map<std::string, T> operator()(const std::string& v){
-        // accept yaml format string and convert to yaml node / node sequence
-        YAML::Node node = YAML::Load(v);
-
-        typename std::map<std::string, T> vec;
-        std::stringstream ss;
-        for (auto it = node.begin(); it != node.end(); ++it) {
-            ss.str("");
-            ss << it->second;
-            // recursively call LexicalCast
-            vec.insert(std::make_pair(it->first.Scalar(), LexicalCast<std::string, T>() (ss.str())));
-        }
-
-        return vec;
+        // parse once, the elements are decoded from the node
+        return FromNode<std::map<std::string, T>>()(YAML::Load(v));
     };
 };
 
@@ -243,38 +450,19 @@ template<typename T>
 class LexicalCast<std::map<std::string, T>, std::string> {
 public:
     std::string operator()(const std::map<std::string, T>& v){
-        // accept vecotor(Yaml sequence) and convert to yaml format string
-        YAML::Node node(YAML::NodeType::Sequence);
-
-        for(auto& i : v) {
-            node[i.first] = YAML::Load(LexicalCast<T, std::string>()(i.second));
-        }
-
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::map<std::string, T>>()(v);
         return ss.str();
     };
 };
 
-
 // partial specialized template for conversion from string to unordered_map
 template<typename T>
 class LexicalCast<std::string, std::unordered_map<std::string, T>> {
 public:
     std::unordered_map<std::string, T> operator()(const std::string& v){
-        // accept yaml format string and convert to yaml node / node sequence
-        YAML::Node node = YAML::Load(v);
-
-        typename std::unordered_map<std::string, T> vec;
-        std::stringstream ss;
-        for (auto it = node.begin(); it != node.end(); ++it) {
-            ss.str("");
-            ss << it->second;
-            // recursively call LexicalCast
-            vec.insert(std::make_pair(it->first.Scalar(), LexicalCast<std::string, T>() (ss.str())));
-        }
-
-        return vec;
+        // parse once, the elements are decoded from the node
+        return FromNode<std::unordered_map<std::string, T>>()(YAML::Load(v));
     };
 };
 
@@ -283,19 +471,146 @@ template<typename T>
 class LexicalCast<std::unordered_map<std::string, T>, std::string> {
 public:
     std::string operator()(const std::unordered_map<std::string, T>& v){
-        // accept vecotor(Yaml sequence) and convert to yaml format string
-        YAML::Node node(YAML::NodeType::Sequence);
+        std::stringstream ss;
+        ss << ToNode<std::unordered_map<std::string, T>>()(v);
+        return ss.str();
+    };
+};
+
+// Binary form of a value for the snapshot cache (ConfigCache): numbers
+// as their bytes, strings and containers with a 32 bits length first.
+// Decode reads from the front of in and drops what it read.
+// Types without one (Supported false) are cached in their string form
+template<typename T, typename = void>
+class BinaryCodec {
+public:
+    static constexpr bool Supported = false;
+};
+
+template<typename T>
+class BinaryCodec<T, std::enable_if_t<std::is_arithmetic_v<T>>> {
+public:
+    static constexpr bool Supported = true;
 
-        for(auto& i : v) {
-            node[i.first] = YAML::Load(LexicalCast<T, std::string>()(i.second));
+    static void Encode(const T& v, std::string& out) {
+        out.append((const char*)&v, sizeof(T));
+    };
+
+    static bool Decode(std::string_view& in, T& v) {
+        if (in.size() < sizeof(T)) {
+            return false;
         }
+        memcpy((void*)&v, in.data(), sizeof(T));
+        in.remove_prefix(sizeof(T));
+        return true;
+    };
+};
 
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+template<>
+class BinaryCodec<std::string> {
+public:
+    static constexpr bool Supported = true;
+
+    static void Encode(const std::string& v, std::string& out) {
+        BinaryCodec<uint32_t>::Encode(v.size(), out);
+        out.append(v);
+    };
+
+    static bool Decode(std::string_view& in, std::string& v) {
+        uint32_t len;
+        if (!BinaryCodec<uint32_t>::Decode(in, len) || in.size() < len) {
+            return false;
+        }
+        v.assign(in.data(), len);
+        in.remove_prefix(len);
+        return true;
+    };
+};
+
+// vector, list, set and unordered_set: a count then the elements
+template<typename Seq>
+class BinarySeqCodec {
+public:
+    using value_type = typename Seq::value_type;
+    static constexpr bool Supported = BinaryCodec<value_type>::Supported;
+
+    static void Encode(const Seq& v, std::string& out) {
+        BinaryCodec<uint32_t>::Encode(v.size(), out);
+        for (auto& i : v) {
+            BinaryCodec<value_type>::Encode(i, out);
+        }
+    };
+
+    static bool Decode(std::string_view& in, Seq& v) {
+        uint32_t count;
+        if (!BinaryCodec<uint32_t>::Decode(in, count)) {
+            return false;
+        }
+        v.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            value_type item;
+            if (!BinaryCodec<value_type>::Decode(in, item)) {
+                return false;
+            }
+            v.insert(v.end(), std::move(item));
+        }
+        return true;
+    };
+};
+
+template<typename T>
+class BinaryCodec<std::vector<T>> : public BinarySeqCodec<std::vector<T>> {};
+
+template<typename T>
+class BinaryCodec<std::list<T>> : public BinarySeqCodec<std::list<T>> {};
+
+template<typename T>
+class BinaryCodec<std::set<T>> : public BinarySeqCodec<std::set<T>> {};
+
+template<typename T>
+class BinaryCodec<std::unordered_set<T>> : public BinarySeqCodec<std::unordered_set<T>> {};
+
+// map and unordered_map: a count then the keys and values
+template<typename Map>
+class BinaryMapCodec {
+public:
+    using mapped_type = typename Map::mapped_type;
+    static constexpr bool Supported = BinaryCodec<mapped_type>::Supported;
+
+    static void Encode(const Map& v, std::string& out) {
+        BinaryCodec<uint32_t>::Encode(v.size(), out);
+        for (auto& i : v) {
+            BinaryCodec<std::string>::Encode(i.first, out);
+            BinaryCodec<mapped_type>::Encode(i.second, out);
+        }
+    };
+
+    static bool Decode(std::string_view& in, Map& v) {
+        uint32_t count;
+        if (!BinaryCodec<uint32_t>::Decode(in, count)) {
+            return false;
+        }
+        v.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            std::string key;
+            mapped_type item;
+            if (!BinaryCodec<std::string>::Decode(in, key)
+                || !BinaryCodec<mapped_type>::Decode(in, item)) {
+                return false;
+            }
+            v.emplace(std::move(key), std::move(item));
+        }
+        return true;
     };
 };
 
+template<typename T>
+class BinaryCodec<std::map<std::string, T>> : public BinaryMapCodec<std::map<std::string, T>> {};
+
+template<typename T>
+class BinaryCodec<std::unordered_map<std::string, T>> 
+    : public BinaryMapCodec<std::unordered_map<std::string, T>> {};
+
 // FromStr T operator() (const std::string&)
 // ToStr std::string operator() (const T&)
 template<typename T, typename FromStr = LexicalCast<std::string, T>, typename ToStr = LexicalCast<T, std::string>>
@@ -305,22 +620,44 @@ public:
     using onChangeCallBack = std::function<void (const T& oldValue, const T& newValue)>;
     using RWMutexType = RWMutex;
 
+    // Thread local view of the value for hot paths, declare it
+    // `static thread_local`. get() only reads the version while the value
+    // is unchanged: no lock, no copy, no shared cache line written
+    class Handle {
+    public:
+        Handle(const ptr& arg): m_arg{ arg } {}
+
+        const T& get() {
+            uint64_t version = m_arg->getVersion();
+            if (version != m_version) [[unlikely]] {
+                m_value = m_arg->getSnapshot();
+                m_version = version;
+            }
+            return *m_value;
+        }
+
+    private:
+        ptr m_arg;
+        uint64_t m_version = 0;
+        std::shared_ptr<const T> m_value;
+    };
+
     ConfigArg(const std::string& name,
             const T& defaultValue,
             const std::string& description = "") 
             : ConfigArgBase(name, description),
-            m_val{ defaultValue } {
+            m_val{ std::make_shared<const T>(defaultValue) } {
+        m_argType = &typeid(ConfigArg);
     };
 
     // convert to argument into yaml string format 
     std::string toString() override {
         try {
-            RWMutex::ReadLock lock(m_mutex);
-            return ToStr()(m_val);
+            return ToStr()(*getSnapshot());
         } catch (std::exception& e) {
             SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "ConfigArg::toString() exception " 
                                                 << e.what() << " convert: " 
-                                                << typeid(m_val).name() << " to string";
+                                                << typeid(T).name() << " to string";
         }
         return "";
     };
@@ -332,47 +669,142 @@ public:
         } catch (std::exception& e) {
             SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "ConfigArg::fromString() exception " 
                                                 << e.what() << " convert string to " 
-                                                << typeid(m_val).name();
+                                                << typeid(T).name();
+            return false;
+        }
+
+        return true;
+    };
+
+    // decode straight from the node, unless a custom FromStr has to see the string
+    bool fromNode(const YAML::Node& node) override {
+        if constexpr (!std::is_same_v<FromStr, LexicalCast<std::string, T>>) {
+            return ConfigArgBase::fromNode(node);
+        }
+
+        try {
+            setValue(FromNode<T>()(node));
+        } catch (std::exception& e) {
+            SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "ConfigArg::fromNode() exception " 
+                                                << e.what() << " convert node to " 
+                                                << typeid(T).name();
             return false;
         }
 
         return true;
     };
 
+    Staged stageNode(const YAML::Node& node) override {
+        try {
+            if constexpr (std::is_same_v<FromStr, LexicalCast<std::string, T>>) {
+                return stage(FromNode<T>()(node));
+            } else if (node.IsScalar()) {
+                return stage(FromStr()(node.Scalar()));
+            } else {
+                std::stringstream ss;
+                ss << node;
+                return stage(FromStr()(ss.str()));
+            }
+        } catch (std::exception& e) {
+            SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "ConfigArg::stageNode() exception " 
+                                                << e.what() << " convert node to " 
+                                                << typeid(T).name();
+            return nullptr;
+        }
+    };
+
+    // val for a ConfigTransaction to publish, copied now so that the
+    // commit only swaps a pointer
+    Staged stage(const T& val) {
+        auto self = std::static_pointer_cast<ConfigArg>(shared_from_this());
+        auto next = std::make_shared<const T>(val);
+        return [self, next]() { return self->publishLocked(next); };
+    };
+
+    // cached in the BinaryCodec form when T has one, no conversion on load
+    bool toBinary(std::string& out) override {
+        if constexpr (RawBinary) {
+            out.clear();
+            BinaryCodec<T>::Encode(*getSnapshot(), out);
+            return true;
+        }
+        return ConfigArgBase::toBinary(out);
+    };
+
+    Staged stageBinary(std::string_view data, bool raw) override {
+        if constexpr (RawBinary) {
+            T val;
+            if (!raw || !BinaryCodec<T>::Decode(data, val) || !data.empty()) {
+                return nullptr;
+            }
+            return stage(val);
+        }
+        if (raw) {
+            return nullptr;
+        }
+        try {
+            return stage(FromStr()(std::string(data)));
+        } catch (std::exception& e) {
+            SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "ConfigArg::stageBinary() exception " 
+                                                << e.what() << " convert string to " 
+                                                << typeid(T).name();
+            return nullptr;
+        }
+    };
+
+    // a copy of the current snapshot, never waits on m_mutex. The atomic
+    // shared_ptr load still takes libstdc++'s internal spin bit and bumps
+    // the shared refcount, so every call writes a shared cache line: hot
+    // paths read through a Handle instead
     const T getValue() { 
-        RWMutexType::ReadLock lock(m_mutex);
-        return m_val; 
+        return *getSnapshot(); 
+    };
+
+    // immutable current value, no copy of T. same cost as getValue
+    std::shared_ptr<const T> getSnapshot() const {
+        return m_val.load(std::memory_order_acquire);
     };
 
-    void setValue(const T& val) { ;
+    // changed by every setValue, after the new snapshot is published
+    uint64_t getVersion() const {
+        return m_version.load(std::memory_order_acquire);
+    };
+
+    // A change of its own, not part of a ConfigTransaction commit:
+    // ConfigTransaction::Read does not see it together with other args.
+    // Listeners have run when it returns, unless another thread (or a
+    // listener up the stack) is notifying the arg, which then reports it
+    void setValue(const T& val) {
         {
-            RWMutex::ReadLock lock(m_mutex);    
-            if (m_val == val) {
+            // compare and store as one step, readers never wait on it
+            RWMutex::WriteLock lock(m_mutex);
+            auto old = getSnapshot();
+            if (*old == val) {
                 return;
             }
-            
-            // process each callback when reading config from yaml
-            for (auto& i : m_cbs) {
-                i.second(m_val, val);
+            m_val.store(std::make_shared<const T>(val), std::memory_order_release);
+            m_version.fetch_add(1, std::memory_order_release);
+            // a pending Dispatch of a commit is reported here, with this change
+            if (!m_notifyFrom) {
+                m_notifyFrom = old;
             }
         }
 
-        RWMutex::WriteLock lock(m_mutex);
-        m_val = val;
+        // process each callback when reading config from yaml
+        notify();
     };
 
     std::string getTypeName() const override { return typeid(T).name(); };
 
     uint64_t addListener(onChangeCallBack cb) { 
-        RWMutex::ReadLock lock(m_mutex);
-        static uint64_t funcId = 0;
-        funcId++;
+        RWMutex::WriteLock lock(m_mutex);
+        uint64_t funcId = ++m_lastListenerId;
         m_cbs[funcId] = cb; 
         return funcId;
     }
 
     void delListener(uint64_t key) { 
-        RWMutex::ReadLock lock(m_mutex);
+        RWMutex::WriteLock lock(m_mutex);
         m_cbs.erase(key); 
     }
 
@@ -383,89 +815,249 @@ public:
     }
 
     void clearListener() { 
-        RWMutex::ReadLock lock(m_mutex);
+        RWMutex::WriteLock lock(m_mutex);
         m_cbs.clear(); 
     }
 
 private:
-    T m_val;    // argument could be differnt types
+    // m_mutex write locked by ConfigTransaction::commit. stores next
+    // without calling the listeners, returns the Dispatch which calls
+    // them. nullptr if unchanged or a change is already waiting to be
+    // reported: that report covers this one
+    Dispatch publishLocked(const std::shared_ptr<const T>& next) {
+        auto old = getSnapshot();
+        if (*old == *next) {
+            return nullptr;
+        }
+
+        m_val.store(next, std::memory_order_release);
+        m_version.fetch_add(1, std::memory_order_release);
+        if (m_notifyFrom) {
+            return nullptr;
+        }
+        m_notifyFrom = old;
+        auto self = std::static_pointer_cast<ConfigArg>(shared_from_this());
+        return [self]() { self->notify(); };
+    };
+
+    // tell the listeners about the changes since they last heard
+    // (m_notifyFrom -> current value), without holding m_mutex. One thread
+    // at a time: changes made meanwhile, by a listener too, are reported
+    // by the thread already notifying in its next round, so listeners
+    // never get a change twice or out of order
+    void notify() {
+        RWMutex::WriteLock lock(m_mutex);
+        if (m_notifying) {
+            return;
+        }
+        m_notifying = true;
+        while (m_notifyFrom) {
+            std::shared_ptr<const T> from, to = getSnapshot();
+            from.swap(m_notifyFrom);
+            std::vector<onChangeCallBack> cbs;
+            for (auto& i : m_cbs) {
+                cbs.push_back(i.second);
+            }
+            lock.unlock();
+
+            try {
+                if (!(*from == *to)) {
+                    for (auto& cb : cbs) {
+                        cb(*from, *to);
+                    }
+                }
+            } catch (...) {
+                lock.lock();
+                m_notifying = false;
+                throw;
+            }
+            lock.lock();
+        }
+        m_notifying = false;
+    };
+
+private:
+    // custom converters always see the string form
+    static constexpr bool RawBinary = std::is_same_v<FromStr, LexicalCast<std::string, T>>
+                                   && std::is_same_v<ToStr, LexicalCast<T, std::string>>
+                                   && BinaryCodec<T>::Supported;
+
+    // argument could be differnt types, replaced as a whole by setValue.
+    // not lock-free in libstdc++, see getValue
+    std::atomic<std::shared_ptr<const T>> m_val;
 
-    std::map<uint64_t, onChangeCallBack> m_cbs;
+    // own cache line, handles read it on every get()
+    alignas(64) std::atomic<uint64_t> m_version{ 1 };
 
-    RWMutexType m_mutex;
+    std::map<uint64_t, onChangeCallBack> m_cbs;     // guarded by m_mutex
+    uint64_t m_lastListenerId = 0;
+
+    // guarded by m_mutex: the value listeners last heard about while a
+    // change is not reported yet, and whether a thread is reporting
+    std::shared_ptr<const T> m_notifyFrom;
+    bool m_notifying = false;
 };
 
-// Manager to store all configuration parameters
+// Manager to store all configuration parameters. Args live in SHARDS
+// tables picked by the hash of their name, each with its own lock, and
+// are never removed. A table keys an arg by a view of its own name
+// (interned, the name is stored once) and the precomputed hash
 class ConfigMgr {
 public:
-    using ConfigArgMap = std::unordered_map<std::string, ConfigArgBase::ptr>;
     using RWMutexType = RWMutex;
+    static constexpr size_t SHARDS = 16;
+
     // check if config para exists, if not, store into Mgr
     template<typename T>
     static typename ConfigArg<T>::ptr lookUp(const std::string& name, 
                                             const T& default_value, 
                                             const std::string& description = "") 
     {             
-        RWMutex::ReadLock lock(getMutex());
-        if (name.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789") != std::string::npos) {
+        Key key{ name, ConfigHash(name) };
+        Shard& shard = getShard(key);
+        {
+            RWMutexType::ReadLock lock(shard.mutex);
+            auto it = shard.data.find(key);
+            if (it != shard.data.end()) {
+                return existing<T>(it->second);
+            }
+        }
+
+        if (!ConfigValidName(name)) {
             SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "requestted name is invalid " << name;
             throw std::invalid_argument(name) ;
         }
 
-        auto it = getData().find(name);
-        if (it != getData().end()) {
-            auto tmp = std::dynamic_pointer_cast<ConfigArg<T>>(it->second);
-            if (tmp) {
-                SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "Lookup name = " << name << " exists ";
-                return tmp;                
-            } else {
-                // different types of vlaue, cannot be converted to corresponding shared_ptr
-                SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "Lookup name = " 
-                            << name << " exists but type conflict: current type: <" <<  typeid(T).name()
-                            <<  ">, real type: <" << it->second->getTypeName() << ">, " << it->second->toString();
-                return nullptr;
-            }
+        RWMutexType::WriteLock lock(shard.mutex);
+        // somebody may have stored it meanwhile
+        auto it = shard.data.find(key);
+        if (it != shard.data.end()) {
+            return existing<T>(it->second);
         }
 
-
         // store argument into mgr
         typename ConfigArg<T>::ptr nArg = std::make_shared<ConfigArg<T>>(name, default_value, description);
-        getData()[name] = nArg;
+        shard.data.emplace(Key{ nArg->getName(), key.hash }, nArg);
         
         return nArg;
     };  
 
     template<typename T> 
     static typename ConfigArg<T>::ptr lookUp(const std::string& name){
-        RWMutex::ReadLock lock(getMutex());
-        auto it = getData().find(name);
-        if (it == getData().end()) {
-            return nullptr;
-        }
-        
-        // convert shared_ptr to base class to a shared_ptr to derived class
-        // Note: this would return nullptr when trying to return configurations with same key but different value types
-        return std::dynamic_pointer_cast<ConfigArg<T>>(it->second);
+        return typed<T>(find(Key{ name, ConfigHash(name) }));
+    };
+
+    // name checked and hashed at compile time
+    template<typename T> 
+    static typename ConfigArg<T>::ptr lookUp(const ConfigKey& key){
+        return typed<T>(find(Key{ key.getName(), key.getHash() }));
     };
     
     // recursively load configuration parameters from yaml
     static void loadFromYaml(const YAML::Node& root);
 
+    // load a yaml file. With a cache path, the resolved values are kept in
+    // a binary snapshot keyed by the hash of the file, a later start with
+    // the same file sets them from the snapshot without parsing the yaml
+    // (see ConfigCache). returns false if the file cannot be loaded
+    static bool loadFromFile(const std::string& path, const std::string& cache = "");
+
+    // load only the keys whose value differs between last and root, the
+    // other args are not looked up, listeners of unchanged args never fire.
+    // returns the number of args set
+    // with a transaction the changes are only staged into it
+    static size_t applyYamlDiff(const YAML::Node& last, const YAML::Node& root,
+                                ConfigTransaction* txn = nullptr);
+
     // look up the pointer to base arg
     static ConfigArgBase::ptr lookUpBase(const std::string& name);
 
     // callback all configuration 
     static void Visit(std::function<void(ConfigArgBase::ptr)> cb);
 private:
-    static ConfigArgMap& getData() {
-        static ConfigArgMap m_data;
-        return m_data;
+    struct Key {
+        std::string_view name;      // points into the name of the stored arg
+        uint64_t hash;
+
+        bool operator==(const Key& oth) const { return name == oth.name; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return key.hash; }
+    };
+
+    struct alignas(64) Shard {
+        RWMutexType mutex;
+        std::unordered_map<Key, ConfigArgBase::ptr, KeyHash> data;
+    };
+
+    static Shard& getShard(const Key& key) {
+        static Shard s_shards[SHARDS];
+        return s_shards[key.hash % SHARDS];
     };
 
-    static RWMutexType& getMutex() {
-        static RWMutexType s_mutex;
-        return s_mutex;
+    static ConfigArgBase::ptr find(const Key& key) {
+        Shard& shard = getShard(key);
+        RWMutexType::ReadLock lock(shard.mutex);
+        auto it = shard.data.find(key);
+        return it == shard.data.end() ? nullptr : it->second;
     };
+
+    // Note: this would return nullptr when trying to return configurations with same key but different value types
+    template<typename T>
+    static typename ConfigArg<T>::ptr typed(const ConfigArgBase::ptr& arg) {
+        if (!arg || !arg->isA<ConfigArg<T>>()) {
+            return nullptr;
+        }
+        return std::static_pointer_cast<ConfigArg<T>>(arg);
+    };
+
+    template<typename T>
+    static typename ConfigArg<T>::ptr existing(const ConfigArgBase::ptr& arg) {
+        auto tmp = typed<T>(arg);
+        if (tmp) {
+            SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "Lookup name = " << arg->getName() << " exists ";
+            return tmp;                
+        }
+
+        // different types of vlaue, cannot be converted to corresponding shared_ptr
+        SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "Lookup name = " 
+                    << arg->getName() << " exists but type conflict: current type: <" <<  typeid(T).name()
+                    <<  ">, real type: <" << arg->getTypeName() << ">, " << arg->toString();
+        return nullptr;
+    };
+
+};
+
+// Typed arg resolved from a compile time key on first use, then a single
+// load: args are never removed, so the pointer stays valid.
+//   static constinit ConfigHandle<uint32_t> s_stackSize{ CONFIG_KEY("fiber.stack_size") };
+//   s_stackSize->getValue();
+template<typename T>
+class ConfigHandle {
+public:
+    constexpr ConfigHandle(const ConfigKey& key): m_key{ key } {}
+
+    // nullptr while no ConfigArg<T> is stored under the key
+    ConfigArg<T>* get() const {
+        ConfigArg<T>* arg = m_arg.load(std::memory_order_acquire);
+        return arg ? arg : resolve();
+    };
+
+    ConfigArg<T>* operator->() const { return get(); };
+
+    const ConfigKey& getKey() const { return m_key; };
+
+private:
+    ConfigArg<T>* resolve() const {
+        auto arg = ConfigMgr::lookUp<T>(m_key);
+        m_arg.store(arg.get(), std::memory_order_release);
+        return arg.get();
+    };
+
+private:
+    ConfigKey m_key;
+    mutable std::atomic<ConfigArg<T>*> m_arg{ nullptr };
 };
 
 };
@@ -0,0 +1,185 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+
+#include "configcache.hpp"
+#include "configtxn.hpp"
+
+namespace Server {
+
+static_assert(sizeof(ConfigCacheRecord) == 16, "ConfigCacheRecord is stored as is");
+static_assert(sizeof(ConfigCache::Header) == 24, "ConfigCache::Header is stored as is");
+
+static Logger::ptr g_logger = SERVER_LOG_NAME("system");
+
+namespace {
+
+// a record of the mapped snapshot, views into the mapping
+struct Record {
+    std::string_view name;
+    std::string_view type;
+    std::string_view value;
+    uint8_t kind;
+};
+
+}
+
+// split the mapped snapshot into records, false if it is truncated or corrupt
+static bool ParseRecords(const char* data, size_t size, uint64_t hash, std::vector<Record>& records) {
+    ConfigCache::Header header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, ConfigCache::MAGIC, sizeof(header.magic)) != 0
+        || header.version != ConfigCache::VERSION || header.hash != hash) {
+        return false;
+    }
+
+    records.reserve(header.count);
+    size_t pos = sizeof(header);
+    for (uint32_t i = 0; i < header.count; ++i) {
+        ConfigCacheRecord rec;
+        if (size - pos < sizeof(rec)) {
+            return false;
+        }
+        memcpy(&rec, data + pos, sizeof(rec));
+        pos += sizeof(rec);
+
+        uint64_t len = (uint64_t)rec.nameLen + rec.typeLen + rec.valueLen;
+        if (size - pos < len || rec.kind > ConfigCacheRecord::MISSING) {
+            return false;
+        }
+        const char* p = data + pos;
+        records.push_back({ { p, rec.nameLen },
+                            { p + rec.nameLen, rec.typeLen },
+                            { p + rec.nameLen + rec.typeLen, rec.valueLen },
+                            rec.kind });
+        pos += len;
+    }
+    return pos == size;
+};
+
+bool ConfigCache::Load(const std::string& path, uint64_t hash) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    const char* data = (const char*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        std::cout << "ConfigCache mmap " << path << " failed, errno = " << errno
+                  << " " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::vector<Record> records;
+    bool ok = ParseRecords(data, st.st_size, hash, records);
+
+    // check everything first, a refused snapshot sets nothing
+    std::vector<ConfigArgBase::ptr> args(records.size());
+    for (size_t i = 0; ok && i < records.size(); ++i) {
+        auto& r = records[i];
+        args[i] = ConfigMgr::lookUpBase(std::string(r.name));
+        if (r.kind == ConfigCacheRecord::MISSING) {
+            ok = !args[i];
+        } else {
+            ok = args[i] && args[i]->getTypeName() == r.type;
+        }
+    }
+
+    // every value decoded before the first one is set
+    ConfigTransaction txn;
+    for (size_t i = 0; ok && i < records.size(); ++i) {
+        if (!args[i]) {
+            continue;
+        }
+        ConfigArgBase::Staged staged = args[i]->stageBinary(records[i].value,
+                                                    records[i].kind == ConfigCacheRecord::RAW);
+        if (!staged) {
+            SERVER_LOG_ERROR(g_logger) << "ConfigCache " << path << " bad value of " << records[i].name;
+            ok = false;
+            break;
+        }
+        txn.add(args[i], std::move(staged));
+    }
+    munmap((void*)data, st.st_size);
+
+    // listeners run before Load returns, as they do for loadFromYaml
+    if (ok) {
+        txn.commit();
+    }
+    return ok;
+};
+
+bool ConfigCache::Save(const std::string& path, uint64_t hash, const Entries& entries) {
+    std::string buf;
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.hash = hash;
+    header.count = entries.size();
+    buf.append((const char*)&header, sizeof(header));
+
+    std::string value, type;
+    for (auto& e : entries) {
+        ConfigCacheRecord rec;
+        value.clear();
+        type.clear();
+        if (e.second) {
+            rec.kind = e.second->toBinary(value) ? ConfigCacheRecord::RAW : ConfigCacheRecord::STRING;
+            type = e.second->getTypeName();
+        } else {
+            rec.kind = ConfigCacheRecord::MISSING;
+        }
+        rec.nameLen = e.first.size();
+        rec.typeLen = type.size();
+        rec.valueLen = value.size();
+        buf.append((const char*)&rec, sizeof(rec));
+        buf.append(e.first);
+        buf.append(type);
+        buf.append(value);
+    }
+
+    // readers never see a half written snapshot
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "ConfigCache open " << tmp << " failed, errno = " << errno
+                  << " " << strerror(errno) << std::endl;
+        return false;
+    }
+    const char* p = buf.data();
+    size_t len = buf.size();
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+    close(fd);
+    if (len || rename(tmp.c_str(), path.c_str())) {
+        std::cout << "ConfigCache write " << path << " failed, errno = " << errno
+                  << " " << strerror(errno) << std::endl;
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+};
+
+}
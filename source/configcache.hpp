@@ -0,0 +1,60 @@
+#ifndef __SERVER_CONFIGCACHE_HPP__
+#define __SERVER_CONFIGCACHE_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "config.hpp"
+
+namespace Server {
+
+// One yaml key in the snapshot, followed by its name, type name and value
+struct ConfigCacheRecord {
+    enum Kind : uint8_t {
+        STRING = 0,             // value in the string form of the arg
+        RAW = 1,                // bytes of the value (ConfigArgBase::toBinary)
+        MISSING = 2,            // no arg was registered for the key, no value
+    };
+
+    uint32_t nameLen = 0;
+    uint32_t typeLen = 0;
+    uint32_t valueLen = 0;
+    uint8_t kind = STRING;
+    uint8_t reserved[3] = {};
+};
+
+// Binary snapshot of the values a yaml file resolved to: a 24 bytes header
+// with the hash of the file, then one record per key of the file in load
+// order. Loading it mmaps the file and sets each arg straight from its
+// bytes, no yaml is parsed. A snapshot is refused as a whole, before any
+// arg is set, if the hash differs, an arg changed type, a key which had
+// no arg when it was written has one now, or a value does not decode.
+// The values are set together, as one ConfigTransaction commit.
+class ConfigCache {
+public:
+    static constexpr char MAGIC[4] = { 'S', 'L', 'C', 'C' };
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t hash;          // ConfigHash of the yaml file
+        uint32_t count;         // records
+        uint32_t reserved;
+    };
+
+    // key of the yaml file and its arg, nullptr if none is registered
+    using Entries = std::vector<std::pair<std::string, ConfigArgBase::ptr>>;
+
+    // set the args from the snapshot at path if it was written for hash
+    static bool Load(const std::string& path, uint64_t hash);
+
+    // write the snapshot to a temporary file renamed over path
+    static bool Save(const std::string& path, uint64_t hash, const Entries& entries);
+};
+
+}
+
+#endif
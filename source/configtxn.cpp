@@ -0,0 +1,83 @@
+#include "configtxn.hpp"
+
+namespace Server {
+
+std::atomic<uint64_t> ConfigTransaction::s_sequence{ 0 };
+
+// commits are published one at a time
+static Mutex& GetCommitMutex() {
+    static Mutex s_mutex;
+    return s_mutex;
+};
+
+bool ConfigTransaction::setNode(const std::string& name, const YAML::Node& node) {
+    ConfigArgBase::ptr arg = ConfigMgr::lookUpBase(name);
+    if (!arg) {
+        return false;
+    }
+    ConfigArgBase::Staged staged = arg->stageNode(node);
+    if (!staged) {
+        return false;
+    }
+    add(arg, std::move(staged));
+    return true;
+};
+
+void ConfigTransaction::add(const ConfigArgBase::ptr& arg, ConfigArgBase::Staged staged) {
+    auto it = m_index.find(arg.get());
+    if (it != m_index.end()) {
+        m_changes[it->second].second = std::move(staged);
+        return;
+    }
+    m_index.emplace(arg.get(), m_changes.size());
+    m_changes.emplace_back(arg, std::move(staged));
+};
+
+void ConfigTransaction::clear() {
+    m_changes.clear();
+    m_index.clear();
+};
+
+uint64_t ConfigTransaction::commit(Scheduler* scheduler) {
+    std::vector<ConfigArgBase::Dispatch> dispatches;
+    uint64_t commit;
+    {
+        // every arg is locked before the sequence turns odd, readers only
+        // wait for the pointer swaps. the commit mutex keeps two commits
+        // from locking args in opposite orders, setValue locks one arg
+        Mutex::Lock lock(GetCommitMutex());
+        for (auto& i : m_changes) {
+            i.first->m_mutex.wrlock();
+        }
+
+        uint64_t seq = s_sequence.load(std::memory_order_relaxed);
+        s_sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (auto& i : m_changes) {
+            ConfigArgBase::Dispatch dispatch = i.second();
+            if (dispatch) {
+                dispatches.push_back(std::move(dispatch));
+            }
+        }
+
+        s_sequence.store(seq + 2, std::memory_order_release);
+        commit = seq / 2 + 1;
+
+        for (auto& i : m_changes) {
+            i.first->m_mutex.unlock();
+        }
+    }
+    clear();
+
+    for (auto& dispatch : dispatches) {
+        if (scheduler) {
+            scheduler->schedule(dispatch);
+        } else {
+            dispatch();
+        }
+    }
+    return commit;
+};
+
+}
@@ -0,0 +1,99 @@
+#ifndef __SERVER_CONFIGTXN_HPP__
+#define __SERVER_CONFIGTXN_HPP__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <type_traits>
+#include <sched.h>
+#include <yaml-cpp/yaml.h>
+
+#include "config.hpp"
+#include "scheduler.hpp"
+
+namespace Server {
+
+// Stages changes of several args and publishes them together.
+// Values are decoded when they are staged, so a commit cannot fail half
+// way. A commit stores every value without calling a listener, then
+// queues one Dispatch per changed arg on a Scheduler: listeners run off
+// the committing thread, at most once per arg and commit. Readers which
+// need related args from the same commit read them inside Read(), a
+// plain ConfigArg::setValue is not part of any commit.
+//   ConfigTransaction txn;
+//   txn.set(g_poolSize, 64);
+//   txn.set(g_queueLimit, 6400);
+//   txn.commit(iom);
+// Not thread safe, one transaction per thread.
+class ConfigTransaction {
+public:
+    using ptr = std::shared_ptr<ConfigTransaction>;
+
+    template<typename T, typename FromStr, typename ToStr>
+    void set(const std::shared_ptr<ConfigArg<T, FromStr, ToStr>>& arg, const std::type_identity_t<T>& val) {
+        add(arg, arg->stage(val));
+    };
+
+    // false if no ConfigArg<T> is stored under name
+    template<typename T>
+    bool set(const std::string& name, const std::type_identity_t<T>& val) {
+        auto arg = ConfigMgr::lookUp<T>(name);
+        if (!arg) {
+            return false;
+        }
+        add(arg, arg->stage(val));
+        return true;
+    };
+
+    // false if no arg is stored under name or node does not convert
+    bool setNode(const std::string& name, const YAML::Node& node);
+
+    // a value staged by arg (stageNode, stageBinary, ...), replaces an
+    // earlier change of the same arg
+    void add(const ConfigArgBase::ptr& arg, ConfigArgBase::Staged staged);
+
+    // args staged
+    size_t size() const { return m_changes.size(); }
+
+    void clear();
+
+    // publish the staged values as one commit and clear them. listeners
+    // run on scheduler, or before commit returns without one.
+    // returns the number of the commit
+    uint64_t commit(Scheduler* scheduler = nullptr);
+
+    // commits done
+    static uint64_t GetCommits() { return s_sequence.load(std::memory_order_acquire) / 2; }
+
+    // run fn until no commit overlapped it: the values fn read come from
+    // a single commit. fn may run more than once
+    template<typename Func>
+    static void Read(Func fn) {
+        for (;;) {
+            uint64_t seq = s_sequence.load(std::memory_order_acquire);
+            if (seq & 1) {
+                // a commit is swapping pointers, let it finish
+                sched_yield();
+                continue;
+            }
+            fn();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s_sequence.load(std::memory_order_relaxed) == seq) {
+                return;
+            }
+        }
+    };
+
+private:
+    std::vector<std::pair<ConfigArgBase::ptr, ConfigArgBase::Staged>> m_changes;
+    std::unordered_map<ConfigArgBase*, size_t> m_index;         // arg -> m_changes
+
+    // odd while a commit is publishing
+    static std::atomic<uint64_t> s_sequence;
+};
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <iostream>
+
+#include "configwatcher.hpp"
+
+namespace Server {
+
+static Logger::ptr g_logger = SERVER_LOG_NAME("system");
+
+ConfigWatcher::ConfigWatcher(const std::string& path, IOManager* iom)
+    :m_path{ path }
+    ,m_iom{ iom } {
+    size_t pos = m_path.rfind('/');
+    m_dir = pos == std::string::npos ? "." : (pos == 0 ? "/" : m_path.substr(0, pos));
+    m_name = pos == std::string::npos ? m_path : m_path.substr(pos + 1);
+};
+
+ConfigWatcher::~ConfigWatcher() {
+    stop();
+};
+
+bool ConfigWatcher::start() {
+    if (m_fd >= 0) {
+        return true;
+    }
+
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        std::cout << "ConfigWatcher inotify_init1 failed, errno = " << errno
+                  << " " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (inotify_add_watch(m_fd, m_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cout << "ConfigWatcher inotify_add_watch " << m_dir << " failed, errno = " << errno
+                  << " " << strerror(errno) << std::endl;
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    {
+        MutexType::Lock lock(m_mutex);
+        try {
+            m_last = YAML::LoadFile(m_path);
+            ConfigMgr::loadFromYaml(m_last);
+        } catch (std::exception& e) {
+            SERVER_LOG_ERROR(g_logger) << "ConfigWatcher load " << m_path << " failed: " << e.what();
+        }
+    }
+
+    // events are registered from inside the IOManager
+    m_stopping = false;
+    m_busy = true;
+    m_iom->schedule(std::bind(&ConfigWatcher::watch, this));
+    return true;
+};
+
+void ConfigWatcher::stop() {
+    if (m_fd < 0) {
+        return;
+    }
+
+    // the cancelled event still runs onEvent once, which does not re-arm.
+    // an event armed after the cancel is cancelled by watch() itself
+    m_stopping = true;
+    m_iom->cancelEvent(m_fd, IOManager::READ);
+    if (Scheduler::getThis() == m_iom) {
+        // on the IOManager itself, blocking could keep onEvent from running
+        while (m_busy) {
+            Fiber::yieldToReady();
+        }
+    } else {
+        while (m_busy) {
+            m_idle.wait();
+        }
+    }
+    close(m_fd);
+    m_fd = -1;
+};
+
+void ConfigWatcher::watch() {
+    if (!m_stopping && m_iom->addEvent(m_fd, IOManager::READ,
+                                       std::bind(&ConfigWatcher::onEvent, this)) == 0) {
+        // stop() may have cancelled before the event was armed
+        if (m_stopping) {
+            m_iom->cancelEvent(m_fd, IOManager::READ);
+        }
+        return;
+    }
+    m_busy = false;
+    m_idle.notify();
+};
+
+void ConfigWatcher::onEvent() {
+    // edge triggered, read everything queued
+    bool changed = false;
+    char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+    ssize_t n;
+    while ((n = read(m_fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + n; ) {
+            inotify_event* event = (inotify_event*)p;
+            if (event->len && m_name == event->name) {
+                changed = true;
+            }
+            p += sizeof(inotify_event) + event->len;
+        }
+    }
+
+    if (changed && !m_stopping) {
+        reload();
+    }
+    watch();
+};
+
+size_t ConfigWatcher::reload() {
+    YAML::Node root;
+    try {
+        root = YAML::LoadFile(m_path);
+    } catch (std::exception& e) {
+        SERVER_LOG_ERROR(g_logger) << "ConfigWatcher reload " << m_path << " failed: " << e.what();
+        return 0;
+    }
+
+    // the changes of a file are published together, their listeners
+    // (rebuilding appenders, ...) run as tasks of the IOManager
+    MutexType::Lock lock(m_mutex);
+    ConfigTransaction txn;
+    size_t applied = ConfigMgr::applyYamlDiff(m_last, root, &txn);
+    txn.commit(m_iom);
+    m_last = root;
+    ++m_reloads;
+    m_lastApplied = applied;
+    SERVER_LOG_INFO(g_logger) << "ConfigWatcher reloaded " << m_path << ", " << applied << " args changed";
+    return applied;
+};
+
+}
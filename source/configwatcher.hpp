@@ -0,0 +1,71 @@
+#ifndef __SERVER_CONFIGWATCHER_HPP__
+#define __SERVER_CONFIGWATCHER_HPP__
+
+#include <memory>
+#include <string>
+#include <atomic>
+#include <yaml-cpp/yaml.h>
+
+#include "config.hpp"
+#include "configtxn.hpp"
+#include "iomanager.hpp"
+
+namespace Server {
+
+// Reload a yaml config file whenever it is written or replaced. An
+// inotify fd on the directory of the file (editors and deploy tools
+// rename a new file into place) waits for READ on an IOManager, no thread
+// polls. A reload parses the file, diffs it against the last applied tree
+// and only sets the keys which changed (ConfigMgr::applyYamlDiff), in one
+// ConfigTransaction whose listeners run on the IOManager.
+// A file which does not parse is reported and ignored.
+class ConfigWatcher {
+public:
+    using ptr = std::shared_ptr<ConfigWatcher>;
+    using MutexType = Mutex;
+
+    ConfigWatcher(const std::string& path, IOManager* iom);
+    ~ConfigWatcher();
+
+    // load the whole file once and watch it
+    bool start();
+
+    // stop watching, waits for a running reload. may be called from a
+    // fiber of the IOManager, which then yields instead of blocking
+    void stop();
+
+    // diff and apply the file now, returns the number of args set
+    size_t reload();
+
+    const std::string& getPath() const { return m_path; }
+
+    uint64_t getReloads() const { return m_reloads; }
+
+    // args set by the last reload
+    uint64_t getLastApplied() const { return m_lastApplied; }
+
+private:
+    // run on the IOManager
+    void watch();
+    void onEvent();
+
+private:
+    std::string m_path;
+    std::string m_dir;
+    std::string m_name;             // file name inside m_dir
+    IOManager* m_iom;
+    int m_fd = -1;                  // inotify
+
+    MutexType m_mutex;              // one reload at a time
+    YAML::Node m_last;              // tree applied last, guarded by m_mutex
+
+    std::atomic<bool> m_stopping{ false };
+    std::atomic<bool> m_busy{ false };  // the READ event is armed or being handled
+    Semaphore m_idle;                   // posted when m_busy turns false
+    std::atomic<uint64_t> m_reloads{ 0 };
+    std::atomic<uint64_t> m_lastApplied{ 0 };
+};
+
+}
+
+#endif
@@ -59,7 +59,8 @@ Fiber::Fiber(std::function<void()> cb, size_t stackSize, bool useCaller)
     : m_id(++s_fiber_id), m_cb(cb) {
 
     ++s_fiber_count;
-    m_stackSize = stackSize ? stackSize : gFiberStackSize->getValue();
+    static thread_local ConfigArg<uint32_t>::Handle t_stackSize(gFiberStackSize);
+    m_stackSize = stackSize ? stackSize : t_stackSize.get();
 
     m_stack = StackAllocator::Alloc(m_stackSize);
     // get current state of thread
@@ -3,6 +3,13 @@
 
 #include "config.hpp"
 #include "log.hpp"
+#include "logfmt.hpp"
+#include "binlog.hpp"
+#include "logfile.hpp"
+#include "logsocket.hpp"
+#include "logstats.hpp"
+#include "logindex.hpp"
+#include "recorder.hpp"
 #include "singleton.hpp"
 #include "thread.hpp"
 #include "util.hpp"
@@ -10,5 +17,9 @@
 #include "mutex"
 #include "fiber.hpp"
 #include "scheduler.hpp"
+#include "iomanager.hpp"
+#include "configwatcher.hpp"
+#include "configcache.hpp"
+#include "configtxn.hpp"
 
 #endif
\ No newline at end of file
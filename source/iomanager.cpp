@@ -3,6 +3,7 @@
 #include <sys/epoll.h>
 #include <errno.h>
 #include <string.h>
+#include <stdexcept>
 #include "iomanager.hpp"
 #include "macro.hpp"
 #include "log.hpp"
@@ -11,7 +12,7 @@ namespace Server {
 
 static Server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
-EventContext& IOManager::FdContext::getContext(Event event){
+IOManager::FdContext::EventContext& IOManager::FdContext::getContext(Event event){
     switch(event) {
         case IOManager::READ:
             return read;
@@ -20,6 +21,7 @@ EventContext& IOManager::FdContext::getContext(Event event){
         default:
             SERVER_ASSERT_INFO(false, "getContext");
     }
+    throw std::invalid_argument("getContext invalid event");
 };
 
 void IOManager::FdContext::resetContext(EventContext& ctx){
@@ -50,18 +52,19 @@ IOManager::IOManager(size_t threads, bool useCaller, const std::string& name)
     SERVER_ASSERT(m_epfd > 0);
 
     int ret = pipe(m_notifyFds);
-    SERVER_ASSERT(ret);
+    SERVER_ASSERT(!ret);
 
+    // the notify pipe is told apart from fd contexts by a null data.ptr
     epoll_event event;
     memset(&event, 0, sizeof(epoll_event));
     event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_notifyFds[0];
+    event.data.ptr = nullptr;
 
     ret = fcntl(m_notifyFds[0], F_SETFL, O_NONBLOCK);
-    SERVER_ASSERT(ret);
+    SERVER_ASSERT(!ret);
 
     ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_notifyFds[0], &event);
-    SERVER_ASSERT(ret);
+    SERVER_ASSERT(!ret);
 
     // initialize fd context 
     contextResize(32);
@@ -97,14 +100,16 @@ void IOManager::contextResize(size_t size) {
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
     FdContext* fdCtx = nullptr;
     RWMutexType::ReadLock lock(m_mtx);
-    if (m_fdContexts.size() > fd) {
+    if ((int)m_fdContexts.size() > fd) {
         fdCtx = m_fdContexts[fd];
         lock.unlock();
     } else {
         lock.unlock();
         // update m_fdContexts using write lock
         RWMutexType::WriteLock lock2(m_mtx);
-        contextResize(m_fdContexts.size() * 1.5);   // TODO: resize according to fd 
+        if ((int)m_fdContexts.size() <= fd) {
+            contextResize(std::max<size_t>(fd * 1.5, m_fdContexts.size() * 1.5));
+        }
         fdCtx = m_fdContexts[fd];
     }
 
@@ -119,6 +124,7 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
 
     int op = fdCtx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
     epoll_event ep_event;
+    memset(&ep_event, 0, sizeof(epoll_event));
     ep_event.events = EPOLLET | fdCtx->events | event;
     ep_event.data.ptr = fdCtx;
 
@@ -142,15 +148,15 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
         eventCtx.cb.swap(cb);
     } else {
         eventCtx.fiber = Fiber::getThis();
-        SERVER_ASSERT(context.fiber->getState() == Fiber::State::EXEC);
+        SERVER_ASSERT(eventCtx.fiber->getState() == Fiber::State::EXEC);
     }
 
     return 0;
 };
 
 bool IOManager::delEvent(int fd, Event event){
-    RWMutexType::ReadLock lock(m_mutex);
-    if (m_fdContexts.size() < fd) {
+    RWMutexType::ReadLock lock(m_mtx);
+    if ((int)m_fdContexts.size() <= fd) {
         return false;
     }
 
@@ -158,7 +164,7 @@ bool IOManager::delEvent(int fd, Event event){
     lock.unlock();
     
     FdContext::MutexType::Lock lock2(fd_ctx->mtx);
-    if(!(fd_ctx->events | event)) {
+    if(!(fd_ctx->events & event)) {
         return false;
     }
 
@@ -166,6 +172,7 @@ bool IOManager::delEvent(int fd, Event event){
     
     int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
     epoll_event ep_event;
+    memset(&ep_event, 0, sizeof(epoll_event));
     ep_event.events = EPOLLET | new_event;
     ep_event.data.ptr = fd_ctx;
 
@@ -186,8 +193,8 @@ bool IOManager::delEvent(int fd, Event event){
 };
 
 bool IOManager::cancelEvent(int fd, Event event){
-    RWMutexType::ReadLock lock(m_mutex);
-    if (m_fdContexts.size() < fd) {
+    RWMutexType::ReadLock lock(m_mtx);
+    if ((int)m_fdContexts.size() <= fd) {
         return false;
     }
 
@@ -195,7 +202,7 @@ bool IOManager::cancelEvent(int fd, Event event){
     lock.unlock();
     
     FdContext::MutexType::Lock lock2(fd_ctx->mtx);
-    if(!(fd_ctx->events | event)) {
+    if(!(fd_ctx->events & event)) {
         return false;
     }
 
@@ -203,6 +210,7 @@ bool IOManager::cancelEvent(int fd, Event event){
     
     int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
     epoll_event ep_event;
+    memset(&ep_event, 0, sizeof(epoll_event));
     ep_event.events = EPOLLET | new_event;
     ep_event.data.ptr = fd_ctx;
 
@@ -217,14 +225,12 @@ bool IOManager::cancelEvent(int fd, Event event){
 
     fd_ctx->triggerEvent(event);
     --m_pendingEventCount;
-
-    SERVER_ASSERT(fd_ctx->events == NONE);
     return true;
 };
 
 bool IOManager::cancelAll(int fd){
-    RWMutexType::ReadLock lock(m_mutex);
-    if (m_fdContexts.size() < fd) {
+    RWMutexType::ReadLock lock(m_mtx);
+    if ((int)m_fdContexts.size() <= fd) {
         return false;
     }
 
@@ -238,7 +244,7 @@ bool IOManager::cancelAll(int fd){
     
     int op = EPOLL_CTL_DEL;
     epoll_event ep_event;
-    ep_event.events = 0;
+    memset(&ep_event, 0, sizeof(epoll_event));
     ep_event.data.ptr = fd_ctx;
 
     int ret = epoll_ctl(m_epfd, op, fd, &ep_event);
@@ -270,4 +276,89 @@ IOManager* IOManager::getThis(){
     return dynamic_cast<IOManager*>(Scheduler::getThis());
 };
 
-}
\ No newline at end of file
+void IOManager::notify(){
+    // threads busy with tasks pick up new ones by themselves
+    if (!hasIdleThreads()) {
+        return;
+    }
+
+    int ret = write(m_notifyFds[1], "T", 1);
+    SERVER_ASSERT(ret == 1);
+};
+
+bool IOManager::stopped(){
+    return m_pendingEventCount == 0 && Scheduler::stopped();
+};
+
+void IOManager::idle(){
+    static const int MAX_EVENTS = 64;
+    static const int MAX_TIMEOUT = 3000;        // ms, stop() is noticed at least this often
+    epoll_event events[MAX_EVENTS];
+
+    while (!stopped()) {
+        int ret = 0;
+        do {
+            ret = epoll_wait(m_epfd, events, MAX_EVENTS, MAX_TIMEOUT);
+        } while (ret < 0 && errno == EINTR);
+
+        for (int i = 0; i < ret; ++i) {
+            epoll_event& event = events[i];
+            if (!event.data.ptr) {
+                // drain the notify pipe
+                uint8_t dummy[256];
+                while (read(m_notifyFds[0], dummy, sizeof(dummy)) > 0);
+                continue;
+            }
+
+            FdContext* fd_ctx = static_cast<FdContext*>(event.data.ptr);
+            FdContext::MutexType::Lock lock(fd_ctx->mtx);
+
+            // an error or hang up wakes every waiter of the fd
+            if (event.events & (EPOLLERR | EPOLLHUP)) {
+                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+            }
+
+            int real_events = NONE;
+            if (event.events & EPOLLIN) {
+                real_events |= READ;
+            }
+            if (event.events & EPOLLOUT) {
+                real_events |= WRITE;
+            }
+            if ((fd_ctx->events & real_events) == NONE) {
+                continue;
+            }
+
+            // keep waiting for the events which did not fire
+            int left_events = fd_ctx->events & ~real_events;
+            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            event.events = EPOLLET | left_events;
+
+            int ret2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            if (ret2) {
+                SERVER_LOG_ERROR(g_logger) << "epoll_ctl (" << m_epfd << ", "
+                                        << op << "," << fd_ctx->fd << "," << event.events << "):"
+                                        << ret2 << " (" << errno << ") (" << strerror(errno) << ")";
+                continue;
+            }
+
+            if (real_events & READ) {
+                fd_ctx->triggerEvent(READ);
+                --m_pendingEventCount;
+            }
+            if (real_events & WRITE) {
+                fd_ctx->triggerEvent(WRITE);
+                --m_pendingEventCount;
+            }
+        }
+
+        // back to Scheduler::run to execute the scheduled tasks, the raw
+        // pointer keeps this fiber from owning itself while it is swapped out
+        Fiber::ptr cur = Fiber::getThis();
+        Fiber* raw = cur.get();
+        cur.reset();
+        raw->swapOut();
+    }
+};
+
+}
@@ -12,8 +12,8 @@ public:
 
     enum Event {
         NONE = 0x0,
-        READ = 0x1,
-        WRITE = 0x2
+        READ = 0x1,     // EPOLLIN
+        WRITE = 0x4     // EPOLLOUT
     };
 
 private:
@@ -76,6 +76,9 @@ protected:
     // used for a idle coroutine when no events in thread pool
     void idle() override;
 
+    // true if some thread waits in epoll_wait
+    bool hasIdleThreads() const { return m_idleThreadCount > 0; }
+
     void contextResize(size_t size);
 
 private:
@@ -83,10 +86,10 @@ private:
     int m_notifyFds[2];
 
     std::atomic<size_t> m_pendingEventCount{ 0 };
-    MutexType m_mtx;
+    RWMutexType m_mtx;
     std::vector<FdContext*> m_fdContexts;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,10 +1,19 @@
 #include "log.hpp"
+#include "binlog.hpp"
+#include "logfile.hpp"
+#include "logsocket.hpp"
+#include "recorder.hpp"
 #include "config.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <map>
 #include <functional>
 #include <iostream>
 #include <time.h>
 #include <string.h>
+#include <algorithm>
 
 namespace Server {
 
@@ -50,156 +59,85 @@ namespace Server {
         return LogLevel::Level::UNKNOWN;
     };
 
-    LogEventWrap::LogEventWrap(LogEvent::ptr e): m_event{ e } {};
+    LogEventWrap::LogEventWrap(LogEvent::ptr e): m_event{ std::move(e) } {};
     
-    std::stringstream& LogEventWrap::getSS() {
+    std::ostream& LogEventWrap::getSS() {
         return m_event->getSS();
     }
 
     LogEventWrap::~LogEventWrap() {
         // output log when deconstuct the wrapper
-        m_event->getLogger()->log(m_event->getLevel(), m_event);    
+        m_event->getLogger()->dispatch(m_event->getLevel(), m_event);    
     };
 
     LogFormatter::LogFormatter (const std::string& pattern): m_pattern{ pattern } {
+        static std::atomic<uint64_t> s_id{ 0 };
+        m_id = ++s_id;
+
+        // formatters are created rarely, interning the pattern lets events
+        // recognize appenders whose output is identical
+        static Mutex s_mutex;
+        static std::unordered_map<std::string, uint64_t> s_patterns;
+        {
+            Mutex::Lock lock(s_mutex);
+            auto it = s_patterns.emplace(pattern, s_patterns.size() + 1).first;
+            m_patternId = it->second;
+        }
         init();
     };
 
-    class MessageFormatItem : public LogFormatter::FormatItem {
-    public:
-        MessageFormatItem(const std::string& str = ""){};
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getContent();
-        }
+    LogStreamBuf::LogStreamBuf() {
+        setp(m_inline, m_inline + INLINE_SIZE);
     };
 
-    class LevelFormatItem : public LogFormatter::FormatItem {
-    public:
-        LevelFormatItem(const std::string& str = ""){};
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << LogLevel::ToString(level);
+    void LogStreamBuf::reset() {
+        if (!m_heap.empty()) {
+            std::vector<char>().swap(m_heap);
         }
+        setp(m_inline, m_inline + INLINE_SIZE);
     };
 
-    class ElapseFormatItem : public LogFormatter::FormatItem {
-    public:
-        ElapseFormatItem(const std::string& str = ""){};
+    void LogStreamBuf::grow(size_t n) {
+        size_t used = pptr() - pbase();
+        size_t cap = std::max(used + n, (size_t)(epptr() - pbase()) * 2);
 
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getElapse();
+        if (m_heap.empty()) {
+            // leave the inline storage, copy what we have so far
+            m_heap.resize(cap);
+            memcpy(m_heap.data(), m_inline, used);
+        } else {
+            m_heap.resize(cap);
         }
-    };
-
-    class NameFormatItem : public LogFormatter::FormatItem {
-    public:
-        NameFormatItem(const std::string& str = ""){};
 
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getLogger()->getName();
-        }
+        setp(m_heap.data(), m_heap.data() + m_heap.size());
+        pbump(used);
     };
 
-    class ThreadIdFormatItem : public LogFormatter::FormatItem {
-    public:
-        ThreadIdFormatItem(const std::string& str = ""){};
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getThreadId();
+    LogStreamBuf::int_type LogStreamBuf::overflow(int_type ch) {
+        if (traits_type::eq_int_type(ch, traits_type::eof())) {
+            return traits_type::not_eof(ch);
         }
-    };
-
-    class FiberIdFormatItem : public LogFormatter::FormatItem {
-    public:
-        FiberIdFormatItem(const std::string& str = ""){};
 
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getFiberId();
-        }
+        grow(1);
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+        return ch;
     };
 
-    class ThreadNameFormatIitem : public LogFormatter::FormatItem {
-    public:
-        ThreadNameFormatIitem(const std::string& str = "") {}
-
-        void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getThreadName();
+    std::streamsize LogStreamBuf::xsputn(const char* s, std::streamsize n) {
+        if (epptr() - pptr() < n) {
+            grow(n);
         }
-    };
-
-    class DateTimeFormatItem : public LogFormatter::FormatItem {
-    public:
-        DateTimeFormatItem(const std::string &format = "%Y-%m-%d %H:%M:%S") :m_format{ format } {
-            if (m_format.empty()) {
-                m_format = "%Y-%m-%d %H:%M:%S";
-            }
-        };
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            
-            // Converts given time since epoch into calendar time, expressed in local time
-            struct tm tm;
-            time_t time = event->getTime(); 
-            localtime_r(&time, &tm);
-
-            // returns a string representing date and time using pre-defined format
-            char buf[64];
-            strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-
-            os << buf;
-        };
-
-    private:
-        std::string m_format;
-    };
-
-    class FilenameFormatItem : public LogFormatter::FormatItem {
-    public:
-        FilenameFormatItem(const std::string& str = ""){};
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getFile();
-        };
-    };
-
-    class LineFormatItem : public LogFormatter::FormatItem {
-    public:
-        LineFormatItem(const std::string& str = ""){};
 
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getLine();
-        };
+        memcpy(pptr(), s, n);
+        pbump(n);
+        return n;
     };
 
-    class NewLineFormatItem : public LogFormatter::FormatItem {
-    public:
-        NewLineFormatItem(const std::string& str = ""){};
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << std::endl;
-        };
-    };
-
-    class StringFormatItem : public LogFormatter::FormatItem {
-    public:
-        StringFormatItem(const std::string &str) : m_string(str){};
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << m_string;
-        };
-
-    private:
-        std::string m_string;
-    };
-
-    class TabFormatItem : public LogFormatter::FormatItem {
-    public:
-        TabFormatItem(const std::string &str){};
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-            os << '\t';
-        };
+    LogEvent::LogEvent()
+        : m_threadName{ &m_ownThreadName },
+        m_ss{ &m_buf },
+        m_owner{ std::this_thread::get_id() } {
     };
 
     LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
@@ -212,12 +150,84 @@ namespace Server {
         m_threadId{ threadId },
         m_fiberId{ fiberId },
         m_time{ time },
-        m_threadName{ threadName },
-        m_logger{ logger },
-        m_level{ level }
+        m_timeNs{ time * 1000000000ull },
+        m_threadName{ &m_ownThreadName },
+        m_ownThreadName{ threadName },
+        m_ss{ &m_buf },
+        m_logger{ logger.get() },
+        m_level{ level },
+        m_owner{ std::this_thread::get_id() }
     {};
+
+    void LogEvent::reset(Logger* logger, LogLevel::Level level,
+                        const char* file, int32_t line,
+                        uint32_t threadId,uint32_t fiberId, uint64_t timeNs,
+                        const std::string* threadName) {
+        m_file = file;
+        m_line = line;
+        m_threadId = threadId;
+        m_fiberId = fiberId;
+        m_timeNs = timeNs;
+        m_time = timeNs / 1000000000ull;
+
+        uint64_t start = GetProcessStartNS();
+        m_elapse = timeNs > start ? (timeNs - start) / 1000000ull : 0;
+        m_threadName = threadName;
+        m_logger = logger;
+        m_level = level;
+        m_recordOnly = false;
+        m_renderedCount = 0;
+        m_owner = std::this_thread::get_id();
+
+        // forget message and any manipulator left by the previous user
+        m_buf.reset();
+        m_ss.clear();
+        m_ss.flags(std::ios_base::dec | std::ios_base::skipws);
+        m_ss.precision(6);
+        m_ss.width(0);
+        m_ss.fill(' ');
+    };
+
+    void LogEvent::detach() {
+        if (m_threadName != &m_ownThreadName) {
+            m_ownThreadName = *m_threadName;
+            m_threadName = &m_ownThreadName;
+        }
+    };
+
+    LogEvent::ptr LogEventPool::Acquire(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
+                                        const char* file, int32_t line, bool recordOnly) {
+        static thread_local LogEvent::ptr t_pool[POOL_SIZE];
+
+        LogEvent::ptr event;
+        for (auto& slot : t_pool) {
+            if (!slot) {
+                slot = std::make_shared<LogEvent>();
+            }
+
+            // only the pool refers to it, nobody else can grab it concurrently
+            if (slot.use_count() == 1) {
+                // use_count is a relaxed load: pair it with the release of the
+                // last reference (an async writer done with the event) before
+                // reset() overwrites what that thread read
+                std::atomic_thread_fence(std::memory_order_acquire);
+                event = slot;
+                break;
+            }
+        }
+
+        if (!event) {
+            // every pooled event is still queued somewhere, fall back to heap
+            event = std::make_shared<LogEvent>();
+        }
+
+        event->reset(logger.get(), level, file, line, Server::getThreadId(),
+                    Server::getFiberId(), Server::GetCurrentNS(), &Server::Thread::GetName());
+        event->setRecordOnly(recordOnly);
+        return event;
+    };
     
-    // accepet variable arguments to pass into format(const char* fmt, va_list al), rewrite later, using variadic template
+    // accepet variable arguments to pass into format(const char* fmt, va_list al)
     void LogEvent::format(const char* fmt, ...) {
         va_list al;
         va_start(al, fmt);
@@ -227,23 +237,48 @@ namespace Server {
 
     // provide user interface to setup user-defined format
     void LogEvent::format(const char* fmt, va_list al) {
-        char* buf = nullptr;
-        
-        int len = vasprintf(&buf, fmt, al); // 
+        // print into the free space of the event buffer, a second pass is
+        // only needed when the message does not fit
+        va_list copy;
+        va_copy(copy, al);
+        char* out = m_buf.prepare(1);
+        size_t avail = m_buf.available();
+        int len = vsnprintf(out, avail, fmt, al);
+        if (len >= 0 && (size_t)len >= avail) {
+            len = vsnprintf(m_buf.prepare(len + 1), len + 1, fmt, copy);
+        }
+        va_end(copy);
 
-        if (len != -1) {
-            m_ss << std::string(buf, len);
-            free(buf);
+        if (len > 0) {
+            m_buf.commit(len);
         }
     };
 
     Logger::Logger (const std::string& name)
         : m_name{ name },
         m_level{LogLevel::Level::DEBUG},
+        m_threshold{LogLevel::Level::DEBUG},
+        m_appenders{std::make_shared<const AppenderList>()},
         m_formatter{std::make_shared<LogFormatter>("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n")} {
     };
 
+    void Logger::setLevel(LogLevel::Level val) {
+        MutexType::Lock lock(m_mutex);
+        m_level.store(val, std::memory_order_relaxed);
+        m_threshold.store(isRecording() ? std::min(val, getRecordLevel()) : val,
+                        std::memory_order_relaxed);
+    };
+
+    void Logger::setRecorder(bool enabled, LogLevel::Level level) {
+        MutexType::Lock lock(m_mutex);
+        m_recording.store(enabled, std::memory_order_relaxed);
+        m_recordLevel.store(level, std::memory_order_relaxed);
+        m_threshold.store(enabled ? std::min(getLevel(), level) : getLevel(),
+                        std::memory_order_relaxed);
+    };
+
     LogFormatter::ptr Logger::getFormatter() {
+        MutexType::Lock lock(m_mutex);
         return m_formatter;
     };
 
@@ -265,7 +300,7 @@ namespace Server {
         MutexType::Lock lock(m_mutex);
         m_formatter = val;
 
-        for (auto& i : m_appenders) {
+        for (auto& i : *m_appenders.load()) {
             MutexType::Lock ll(i->m_mutex);
             // if the appender doesnt contain formatter, assign it with logger' formatter
             if (!i->m_hasFormatter){
@@ -288,7 +323,11 @@ namespace Server {
             node["formatter"] = m_formatter->getPattern();
         }
 
-        for (auto& i : m_appenders) {
+        if (isRecording()) {
+            node["recorder"]["level"] = LogLevel::ToString(getRecordLevel());
+        }
+
+        for (auto& i : *m_appenders.load()) {
             node["appenders"].push_back(YAML::Load(i->toYamlString()));
         }
 
@@ -307,37 +346,93 @@ namespace Server {
             // appender->setFormatter(m_formatter);
         }
 
-        m_appenders.push_back(appender);
+        // copy, change and publish, threads still logging with the old list keep it alive
+        auto appenders = std::make_shared<AppenderList>(*m_appenders.load());
+        appenders->push_back(appender);
+        m_appenders.store(std::move(appenders));
     };
 
     void Logger::delAppender(LogAppender::ptr appender) {
         MutexType::Lock lock(m_mutex);
-        for (auto it = m_appenders.begin(); it != m_appenders.end(); ++it) {
+        auto appenders = std::make_shared<AppenderList>(*m_appenders.load());
+        for (auto it = appenders->begin(); it != appenders->end(); ++it) {
             if (*it == appender) {
-                m_appenders.erase(it);
+                appenders->erase(it);
                 break;
             }
         }
+        m_appenders.store(std::move(appenders));
     };
 
     void Logger::clearAppenders() {
         MutexType::Lock lock(m_mutex);
-        m_appenders.clear();
+        m_appenders.store(std::make_shared<const AppenderList>());
     };
 
-    void Logger::log(LogLevel::Level level, const LogEvent::ptr event) {
+    void Logger::log(LogLevel::Level level, const LogEvent::ptr& event) {
         if (level >= m_level) {
+            dispatch(level, event);
+        } else {
+            m_stats.add(LogStats::FILTERED);
+        }
+    };
+
+    void Logger::logBinary(const BinLogRecord& record) {
+        if (record.level >= m_level) {
+            dispatchBinary(record);
+        } else {
+            m_stats.add(LogStats::FILTERED);
+        }
+    };
+
+    void Logger::dispatch(LogLevel::Level level, const LogEvent::ptr& event) {
+        if (isRecording() && level >= getRecordLevel()) {
+            FlightRecorder::Append(m_name, level, *event);
+        }
+        if (event->isRecordOnly()) {
+            return;
+        }
+        m_stats.add(LogStats::ACCEPTED);
+
+        // no lock, appenders changed meanwhile are seen by the next event
+        auto appenders = m_appenders.load(std::memory_order_acquire);
+        if (!appenders->empty()) {
+            // output event to different destination
             auto self = shared_from_this();
-            MutexType::Lock lock(m_mutex);
-            if (!m_appenders.empty()) {
-                // output event to different destination
-                
-                for (auto &appender : m_appenders) {
-                    appender->log(self, level, event);
-                }
-            } else if (m_root) {
-                m_root->log(level, event);
+            for (auto &appender : *appenders) {
+                appender->m_stats.add(level >= appender->m_level ? LogStats::ACCEPTED
+                                                                 : LogStats::FILTERED);
+                appender->log(self, level, event);
             }
+        } else if (m_root) {
+            m_root->log(level, event);
+        }
+    };
+
+    void Logger::dispatchBinary(const BinLogRecord& record) {
+        if (isRecording() && record.level >= getRecordLevel()) {
+            static thread_local std::string t_msg;
+            t_msg.clear();
+            BinLog::Format(t_msg, record.site->getFormat(), record.site->getSignature(),
+                            record.payload, record.size);
+            FlightRecorder::Append(m_name, record.level, record.timeNs, record.threadId,
+                                record.fiberId, record.site->getFile(), record.site->getLine(), t_msg);
+        }
+        if (record.recordOnly) {
+            return;
+        }
+        m_stats.add(LogStats::ACCEPTED);
+
+        auto appenders = m_appenders.load(std::memory_order_acquire);
+        if (!appenders->empty()) {
+            auto self = shared_from_this();
+            for (auto &appender : *appenders) {
+                appender->m_stats.add(record.level >= appender->m_level ? LogStats::ACCEPTED
+                                                                        : LogStats::FILTERED);
+                appender->logBinary(self, record);
+            }
+        } else if (m_root) {
+            m_root->logBinary(record);
         }
     };
 
@@ -361,6 +456,26 @@ namespace Server {
         log(LogLevel::Level::FATAL, event);
     };
 
+    void LogAppender::logBinary(const std::shared_ptr<Logger>& logger, const BinLogRecord& record) {
+        if (record.level < m_level) {
+            return;
+        }
+
+        // text appender, format the deferred record right now
+        LogEvent::ptr event = LogEventPool::Acquire(logger, record.level,
+                                                    record.site->getFile(), record.site->getLine());
+        event->reset(logger.get(), record.level, record.site->getFile(), record.site->getLine(),
+                    record.threadId, record.fiberId, record.timeNs, &Server::Thread::GetName());
+
+        static thread_local std::string t_msg;
+        t_msg.clear();
+        BinLog::Format(t_msg, record.site->getFormat(), record.site->getSignature(),
+                        record.payload, record.size);
+        event->getSS().write(t_msg.data(), t_msg.size());
+
+        log(logger, record.level, event);
+    }
+
     void LogAppender::setFormatter(LogFormatter::ptr val) {
         MutexType::Lock lock(m_mutex);
         m_formatter = val;
@@ -376,10 +491,245 @@ namespace Server {
         return m_formatter;
     }
 
+    // Background thread writing out the lines of appenders whose flush
+    // policy has an interval, it sleeps for the shortest registered interval.
+    // It also reports the suppressed counts of limited call sites
+    class LogFlusher {
+    public:
+        using MutexType = Mutex;
+
+        // never destroyed, appenders may unregister during static destruction
+        static LogFlusher* GetInstance() {
+            static LogFlusher* s_flusher = new LogFlusher;
+            return s_flusher;
+        }
+
+        void add(BufferedLogAppender* appender, uint32_t interval) {
+            MutexType::Lock lock(m_mutex);
+            m_appenders[appender] = interval;
+            if (!m_thread) {
+                m_thread = std::make_shared<Thread>(std::bind(&LogFlusher::run, this), "log_flush");
+            }
+            m_cond.notify_one();
+        }
+
+        // start reporting summaries of limited call sites
+        void addSites() {
+            MutexType::Lock lock(m_mutex);
+            m_sites = true;
+            if (!m_thread) {
+                m_thread = std::make_shared<Thread>(std::bind(&LogFlusher::run, this), "log_flush");
+            }
+        }
+
+        // returns once the flusher no longer writes appender
+        void del(BufferedLogAppender* appender) {
+            MutexType::Lock lock(m_mutex);
+            m_appenders.erase(appender);
+            while (m_busy == appender) {
+                m_idle.wait(lock);
+            }
+        }
+
+    private:
+        void run() {
+            MutexType::Lock lock(m_mutex);
+            std::vector<BufferedLogAppender*> appenders;
+            while (true) {
+                uint32_t wait = 1000;
+                for (auto& i : m_appenders) {
+                    wait = std::min(wait, i.second);
+                }
+                m_cond.wait_for(lock, std::chrono::milliseconds(wait));
+
+                // written without m_mutex, adding or removing other appenders
+                // never waits on this I/O. del() waits while m_busy is its own
+                uint64_t now = GetCurrentNS();
+                appenders.clear();
+                for (auto& i : m_appenders) {
+                    appenders.push_back(i.first);
+                }
+                for (auto appender : appenders) {
+                    if (!m_appenders.count(appender)) {
+                        continue;           // removed meanwhile
+                    }
+                    m_busy = appender;
+                    lock.unlock();
+                    appender->flushIfDue(now);
+                    lock.lock();
+                    m_busy = nullptr;
+                    m_idle.notify_all();
+                }
+
+                if (m_sites) {
+                    lock.unlock();
+                    LogCallSiteMgr::getInstance()->flushSummaries();
+                    lock.lock();
+                }
+            }
+        }
+
+    private:
+        MutexType m_mutex;
+        std::condition_variable_any m_cond;
+        std::condition_variable_any m_idle;            // m_busy was cleared
+        std::map<BufferedLogAppender*, uint32_t> m_appenders;
+        BufferedLogAppender* m_busy = nullptr;          // being flushed without m_mutex
+        bool m_sites = false;                           // some limited site dropped messages
+        Thread::ptr m_thread;
+    };
+
+    // write every iovec, retry on partial writes and EINTR
+    static bool WriteAll(int fd, struct iovec* iov, int count) {
+        while (count > 0) {
+            ssize_t n = writev(fd, iov, count);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            while (count > 0 && (size_t)n >= iov->iov_len) {
+                n -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = (char*)iov->iov_base + n;
+                iov->iov_len -= n;
+            }
+        }
+        return true;
+    }
+
+    void FlushPolicyToYaml(YAML::Node& node, const LogFlushPolicy& policy,
+                            const LogFlushPolicy& defaults) {
+        if (policy == defaults) {
+            return;
+        }
+        node["flush"]["line"] = policy.line;
+        if (policy.bytes) {
+            node["flush"]["bytes"] = policy.bytes;
+        }
+        if (policy.interval) {
+            node["flush"]["interval"] = policy.interval;
+        }
+        if (policy.level != LogLevel::Level::UNKNOWN) {
+            node["flush"]["level"] = LogLevel::ToString(policy.level);
+        }
+    }
+
+    BufferedLogAppender::~BufferedLogAppender() {
+        LogFlusher::GetInstance()->del(this);
+        MutexType::Lock lock(m_mutex);
+        flushNoLock();
+    };
+
+    void BufferedLogAppender::setFlushPolicy(const LogFlushPolicy& policy) {
+        {
+            MutexType::Lock lock(m_mutex);
+            flushNoLock();
+            m_flushPolicy = policy;
+            m_lastFlush = GetCurrentNS();
+        }
+
+        if (policy.interval && !policy.line) {
+            LogFlusher::GetInstance()->add(this, policy.interval);
+        } else {
+            LogFlusher::GetInstance()->del(this);
+        }
+    };
+
+    LogFlushPolicy BufferedLogAppender::getFlushPolicy() {
+        MutexType::Lock lock(m_mutex);
+        return m_flushPolicy;
+    };
+
+    void BufferedLogAppender::flush() {
+        MutexType::Lock lock(m_mutex);
+        flushNoLock();
+    };
+
+    void BufferedLogAppender::flushIfDue(uint64_t nowNs) {
+        MutexType::Lock lock(m_mutex);
+        if (!m_buffer.empty() && nowNs >= m_lastFlush + m_flushPolicy.interval * 1000000ull) {
+            flushNoLock();
+        }
+    };
+
+    bool BufferedLogAppender::dueNoLock(uint64_t size, LogLevel::Level level, uint64_t nowNs) const {
+        const LogFlushPolicy& p = m_flushPolicy;
+        uint64_t limit = p.bytes ? p.bytes : LogFlushPolicy::DEFAULT_BUFFER_SIZE;
+        return p.line
+            || size >= limit
+            || (p.interval && nowNs >= m_lastFlush + p.interval * 1000000ull)
+            || (p.level != LogLevel::Level::UNKNOWN && level >= p.level);
+    };
+
+    void BufferedLogAppender::writeNoLock(const std::string& text, LogLevel::Level level, uint64_t nowNs) {
+        if (dueNoLock(m_buffer.size() + text.size(), level, nowNs)) {
+            // the line itself is not copied, it follows the buffer in the writev
+            flushNoLock(&text);
+            m_lastFlush = nowNs;
+        } else {
+            m_buffer.append(text);
+        }
+    };
+
+    void BufferedLogAppender::appendedNoLock(LogLevel::Level level, uint64_t nowNs) {
+        if (dueNoLock(m_buffer.size(), level, nowNs)) {
+            flushNoLock();
+        }
+    };
+
+    void BufferedLogAppender::stopFlusher() {
+        LogFlusher::GetInstance()->del(this);
+    };
+
+    void BufferedLogAppender::flushNoLock(const std::string* tail) {
+        struct iovec iov[2];
+        int count = 0;
+        if (!m_buffer.empty()) {
+            iov[count].iov_base = m_buffer.data();
+            iov[count++].iov_len = m_buffer.size();
+        }
+        if (tail && !tail->empty()) {
+            iov[count].iov_base = (void*)tail->data();
+            iov[count++].iov_len = tail->size();
+        }
+        if (count == 0 || m_fd < 0) {
+            m_buffer.clear();
+            return;
+        }
+
+        {
+            LogStats::Timer timer(m_stats, LogStats::IO_NS);
+            if (!WriteAll(m_fd, iov, count)) {
+                std::cout << "BufferedLogAppender write failed, errno = "
+                          << errno << " " << strerror(errno) << std::endl;
+            }
+        }
+        m_stats.add(LogStats::BYTES, m_buffer.size() + (tail ? tail->size() : 0));
+        m_stats.add(LogStats::FLUSHES);
+        m_buffer.clear();
+        m_lastFlush = GetCurrentNS();
+    };
+
     FileLogAppender::FileLogAppender (const std::string& filename): m_filename{ filename } {
         reopen();
     };
 
+    FileLogAppender::~FileLogAppender() {
+        LogFlusher::GetInstance()->del(this);
+        MutexType::Lock lock(m_mutex);
+        flushNoLock();
+        m_index.close();
+        if (m_fd >= 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    };
+
     std::string FileLogAppender::toYamlString() {
         MutexType::Lock lock(m_mutex);
         YAML::Node node;
@@ -394,6 +744,12 @@ namespace Server {
             node["formatter"] = m_formatter->getPattern();
         }
 
+        FlushPolicyToYaml(node, m_flushPolicy);
+
+        if (m_indexBucket) {
+            node["index"] = m_indexBucket;
+        }
+
         std::stringstream ss;
         ss << node;
         return ss.str();
@@ -401,18 +757,52 @@ namespace Server {
 
     bool FileLogAppender::reopen() {
         MutexType::Lock lock(m_mutex);
-        if (m_filestream) {
-            m_filestream.close();
+        flushNoLock();
+        return reopenNoLock();
+    };
+
+    bool FileLogAppender::reopenNoLock() {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+
+        m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);  // open file
+        if (m_fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        fstat(m_fd, &st);
+        m_offset = st.st_size + m_buffer.size();
+        if (m_indexBucket && (!m_index.isOpen() || m_inode != st.st_ino)) {
+            m_index.open(LogIndex::PathOf(m_filename), m_indexBucket, m_offset);
+        }
+        m_inode = st.st_ino;
+        return true;                                    // file is opened successfully
+    };
+
+    void FileLogAppender::setIndex(uint32_t bucket) {
+        MutexType::Lock lock(m_mutex);
+        flushNoLock();
+        m_indexBucket = bucket;
+        if (bucket && m_fd >= 0) {
+            m_index.open(LogIndex::PathOf(m_filename), bucket, m_offset);
+        } else {
+            m_index.close();
         }
+    };
 
-        m_filestream.open(m_filename, std::ios::app);  // open file
-        return !m_filestream;                          // file is opened successfully
+    StdoutLogAppender::StdoutLogAppender() {
+        m_fd = STDOUT_FILENO;
     };
 
     void StdoutLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
         if (level >= m_level) {
             MutexType::Lock lock(m_mutex);
-            m_formatter->format(std::cout, logger, level, event);
+            const std::string& text = *render(logger, level, event);
+            // keep the order with whatever the program printed through stdio
+            fflush(stdout);
+            writeNoLock(text, level, event->getTimeNs());
         }
     };
 
@@ -429,43 +819,595 @@ namespace Server {
             node["formatter"] = m_formatter->getPattern();
         }
 
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
-    };
+        FlushPolicyToYaml(node, m_flushPolicy);
+
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    };
+
+    void FileLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+        if (level >= m_level) {
+            uint64_t now = event->getTime();
+            // every 3 seconds check, outside the lock, whether the file was
+            // moved or removed (logrotate). only then it is flushed and
+            // opened again, the flush policy is left alone otherwise
+            struct stat st;
+            bool check = false, moved = false;
+            uint64_t last = m_lastTime.load(std::memory_order_relaxed);
+            if (now >= last + 3 && m_lastTime.compare_exchange_strong(last, now)) {
+                check = true;
+                moved = stat(m_filename.c_str(), &st) != 0;
+            }
+
+            MutexType::Lock lock(m_mutex);
+            if (check && (moved || m_fd < 0 || st.st_ino != m_inode)) {
+                // buffered lines were indexed in the old file, they end it
+                flushNoLock();
+                reopenNoLock();
+            }
+            const std::string& text = *render(logger, level, event);
+            if (m_index.isOpen()) {
+                m_index.add(now, m_offset, text.size(), (int)level, logger->getName());
+            }
+            m_offset += text.size();
+            writeNoLock(text, level, event->getTimeNs());
+        }
+    };
+
+    // events the writer takes per lock, an ERROR waits for one batch of a lower lane at most
+    static const size_t ASYNC_BATCH = 256;
+
+    const char* AsyncLogAppender::ToString(OverflowPolicy policy) {
+        switch (policy) {
+            case OverflowPolicy::BLOCK:
+                return "block";
+            case OverflowPolicy::DROP_NEWEST:
+                return "drop_newest";
+            case OverflowPolicy::DROP_DEBUG_FIRST:
+                return "drop_debug_first";
+            case OverflowPolicy::DROP_OLDEST:
+                return "drop_oldest";
+        }
+
+        return "block";
+    };
+
+    AsyncLogAppender::OverflowPolicy AsyncLogAppender::FromString(const std::string& str) {
+        if (str == "drop_newest") {
+            return OverflowPolicy::DROP_NEWEST;
+        } else if (str == "drop_debug_first") {
+            return OverflowPolicy::DROP_DEBUG_FIRST;
+        } else if (str == "drop_oldest") {
+            return OverflowPolicy::DROP_OLDEST;
+        }
+
+        return OverflowPolicy::BLOCK;
+    };
+
+    const char* AsyncLogAppender::ToString(Lane lane) {
+        switch (lane) {
+            case LANE_ERROR:
+                return "error";
+            case LANE_INFO:
+                return "info";
+            default:
+                return "debug";
+        }
+    };
+
+    AsyncLogAppender::Lane AsyncLogAppender::LaneOf(LogLevel::Level level) {
+        if (level >= LogLevel::Level::ERROR) {
+            return LANE_ERROR;
+        }
+        return level >= LogLevel::Level::INFO ? LANE_INFO : LANE_DEBUG;
+    };
+
+    AsyncLogAppender::LaneOptionsList AsyncLogAppender::DefaultLanes(size_t capacity, OverflowPolicy policy) {
+        LaneOptionsList lanes;
+        for (auto& l : lanes) {
+            l.capacity = capacity;
+            l.overflow = policy;
+        }
+        lanes[LANE_ERROR].overflow = OverflowPolicy::BLOCK;
+        return lanes;
+    };
+
+    AsyncLogAppender::AsyncLogAppender(LogAppender::ptr appender, size_t capacity, OverflowPolicy policy)
+        : AsyncLogAppender(appender, DefaultLanes(capacity, policy)) {
+    };
+
+    AsyncLogAppender::AsyncLogAppender(LogAppender::ptr appender, const LaneOptionsList& lanes)
+        : m_appender{ appender } {
+        // the rings are allocated once, pushing an event never reallocates
+        for (int i = 0; i < LANE_COUNT; ++i) {
+            Queue& q = m_lanes[i];
+            q.options = lanes[i];
+            q.options.capacity = std::max<uint32_t>(q.options.capacity, 1);
+            q.ring.resize(q.options.capacity);
+        }
+        // the ERROR lane is drained first and is never dropped
+        m_lanes[LANE_ERROR].options.overflow = OverflowPolicy::BLOCK;
+        m_back.reserve(ASYNC_BATCH);
+
+        m_thread = std::make_shared<Thread>(std::bind(&AsyncLogAppender::run, this), "async_log");
+    };
+
+    AsyncLogAppender::~AsyncLogAppender() {
+        stop();
+    };
+
+    uint64_t AsyncLogAppender::getDropped() const {
+        uint64_t dropped = 0;
+        for (auto& q : m_lanes) {
+            dropped += q.dropped;
+        }
+        return dropped;
+    };
+
+    void AsyncLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+        if (level < m_level) {
+            return;
+        }
+
+        Lane lane = LaneOf(level);
+        Queue& q = m_lanes[lane];
+        QueueMutexType::Lock lock(m_queueMutex);
+        while (q.size >= q.options.capacity && !m_stopping) {
+            OverflowPolicy policy = q.options.overflow;
+            if (policy == OverflowPolicy::DROP_NEWEST
+                || (policy == OverflowPolicy::DROP_DEBUG_FIRST && lane == LANE_DEBUG)) {
+                ++q.dropped;
+                m_stats.add(LogStats::DROPPED);
+                return;
+            }
+
+            if (policy == OverflowPolicy::DROP_OLDEST) {
+                // the slot of the evicted event is reused right below
+                q.head = (q.head + 1) % q.options.capacity;
+                --q.size;
+                --m_pending;
+                ++q.dropped;
+                m_stats.add(LogStats::DROPPED);
+                ++m_written;    // the evicted event will never reach the writer
+                break;
+            }
+
+            m_notFull.wait(lock);
+        }
+
+        if (m_stopping) {
+            ++q.dropped;
+            m_stats.add(LogStats::DROPPED);
+            return;
+        }
+
+        // the event is formatted later on writer thread
+        event->detach();
+
+        // only wake up the writer when it may be sleeping on empty lanes
+        bool wake = m_pending == 0;
+        q.ring[(q.head + q.size) % q.options.capacity] = Entry{ logger, level, event };
+        ++q.size;
+        ++m_pending;
+        ++m_accepted;
+        lock.unlock();
+
+        if (wake) {
+            m_notEmpty.notify_one();
+        }
+    };
+
+    void AsyncLogAppender::flush() {
+        QueueMutexType::Lock lock(m_queueMutex);
+        uint64_t target = m_accepted;
+        while (m_written < target && m_thread) {
+            m_drained.wait(lock);
+        }
+    };
+
+    void AsyncLogAppender::stop() {
+        Thread::ptr thread;
+        {
+            QueueMutexType::Lock lock(m_queueMutex);
+            m_stopping = true;
+            thread.swap(m_thread);
+        }
+
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+
+        if (thread) {
+            thread->join();
+        }
+        m_drained.notify_all();
+    };
+
+    void AsyncLogAppender::run() {
+        while (true) {
+            {
+                QueueMutexType::Lock lock(m_queueMutex);
+                while (m_pending == 0 && !m_stopping) {
+                    m_notEmpty.wait(lock);
+                }
+
+                if (m_pending == 0) {
+                    break;  // stopping and nothing left to write
+                }
+
+                // strict priority: take a batch of the highest non empty lane
+                for (auto& q : m_lanes) {
+                    if (!q.size) {
+                        continue;
+                    }
+                    size_t n = std::min(q.size, ASYNC_BATCH);
+                    for (size_t i = 0; i < n; ++i) {
+                        m_back.push_back(std::move(q.ring[q.head]));
+                        q.head = (q.head + 1) % q.options.capacity;
+                    }
+                    q.size -= n;
+                    m_pending -= n;
+                    break;
+                }
+            }
+            m_notFull.notify_all();
+
+            // the wrapped appender follows our formatter unless it has its own
+            LogFormatter::ptr fmt = getFormatter();
+            {
+                MutexType::Lock lock(m_appender->m_mutex);
+                if (!m_appender->m_hasFormatter) {
+                    m_appender->m_formatter = fmt;
+                }
+            }
+
+            for (auto& e : m_back) {
+                m_appender->m_stats.add(e.level >= m_appender->m_level ? LogStats::ACCEPTED
+                                                                       : LogStats::FILTERED);
+                m_appender->log(e.logger, e.level, e.event);
+            }
+
+            uint64_t count = m_back.size();
+            m_back.clear();
+
+            {
+                QueueMutexType::Lock lock(m_queueMutex);
+                m_written += count;
+            }
+            m_drained.notify_all();
+        }
+    };
+
+    static void AsyncLanesToYaml(YAML::Node& node, const AsyncLogAppender::LaneOptionsList& lanes) {
+        for (int i = 0; i < AsyncLogAppender::LANE_COUNT; ++i) {
+            YAML::Node lane = node["async"]["lanes"][AsyncLogAppender::ToString((AsyncLogAppender::Lane)i)];
+            lane["capacity"] = lanes[i].capacity;
+            lane["overflow"] = AsyncLogAppender::ToString(lanes[i].overflow);
+        }
+    }
+
+    std::string AsyncLogAppender::toYamlString() {
+        // describe the wrapped appender, with the async settings as a nested node
+        YAML::Node node = YAML::Load(m_appender->toYamlString());
+        
+        {
+            MutexType::Lock lock(m_mutex);
+            if (m_hasFormatter && m_formatter && !node["formatter"].IsDefined()) {
+                node["formatter"] = m_formatter->getPattern();
+            }
+        }
+
+        LaneOptionsList lanes;
+        for (int i = 0; i < LANE_COUNT; ++i) {
+            lanes[i] = m_lanes[i].options;
+        }
+        AsyncLanesToYaml(node, lanes);
+
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    };
+
+    // hand-rolled emitters used by the compiled formatter
+    static inline void AppendUInt(std::string& out, uint64_t v) {
+        char buf[20];
+        char* p = buf + sizeof(buf);
+        do {
+            *--p = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        out.append(p, buf + sizeof(buf) - p);
+    }
+
+    static inline void AppendInt(std::string& out, int64_t v) {
+        if (v < 0) {
+            out.push_back('-');
+            AppendUInt(out, -(uint64_t)v);
+        } else {
+            AppendUInt(out, v);
+        }
+    }
+
+    static inline void AppendPad2(std::string& out, int v) {
+        char buf[2] = { (char)('0' + v / 10 % 10), (char)('0' + v % 10) };
+        out.append(buf, 2);
+    }
+
+    static inline void AppendLevel(std::string& out, LogLevel::Level level) {
+        static const std::string_view s_levels[] = {
+            "UNKNOWN", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
+        };
+
+        size_t i = (size_t)level;
+        out.append(i < sizeof(s_levels) / sizeof(s_levels[0]) ? s_levels[i] : s_levels[0]);
+    }
+
+    // render m_dateProgram[offset, offset + length) for the given calendar time
+    static void FormatDateFields(std::string& out, const LogFormatter::Instruction* ins, size_t count,
+                                const char* literals, const struct tm& tm) {
+        using Op = LogFormatter::Op;
+        for (size_t n = 0; n < count; ++n) {
+            const LogFormatter::Instruction& i = ins[n];
+            switch (i.op) {
+                case Op::LITERAL:
+                    out.append(literals + i.offset, i.length);
+                    break;
+                case Op::DATE_YEAR:
+                    AppendInt(out, tm.tm_year + 1900);
+                    break;
+                case Op::DATE_MONTH:
+                    AppendPad2(out, tm.tm_mon + 1);
+                    break;
+                case Op::DATE_DAY:
+                    AppendPad2(out, tm.tm_mday);
+                    break;
+                case Op::DATE_HOUR:
+                    AppendPad2(out, tm.tm_hour);
+                    break;
+                case Op::DATE_MINUTE:
+                    AppendPad2(out, tm.tm_min);
+                    break;
+                case Op::DATE_SECOND:
+                    AppendPad2(out, tm.tm_sec);
+                    break;
+                case Op::DATE_STRFTIME: {
+                    char buf[64];
+                    char fmt[64];
+                    size_t len = std::min<size_t>(i.length, sizeof(fmt) - 1);
+                    memcpy(fmt, literals + i.offset, len);
+                    fmt[len] = '\0';
+                    out.append(buf, strftime(buf, sizeof(buf), fmt, &tm));
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    void LogFormatter::formatDate(std::string& out, const Instruction& ins, const LogEvent::ptr& event) {
+        // direct-mapped per-thread cache of rendered date segments
+        struct DateCache {
+            uint64_t key = 0;
+            uint64_t sec = 0;
+            std::string text;
+        };
+        static thread_local DateCache t_cache[32];
+
+        // m_id is never 0, so an empty slot never matches
+        uint64_t key = (m_id << 16) | ins.offset;
+        DateCache& c = t_cache[(m_id * 31 + ins.offset) % 32];
+        uint64_t sec = event->getTime();
+
+        if (c.key != key || c.sec != sec) {
+            struct tm tm;
+            time_t time = sec;
+            localtime_r(&time, &tm);
+
+            c.text.clear();
+            FormatDateFields(c.text, m_dateProgram.data() + ins.offset, ins.length, m_literals.data(), tm);
+            c.key = key;
+            c.sec = sec;
+        }
+
+        out.append(c.text);
+    }
+
+    void LogFormatter::format(std::string& out, const std::shared_ptr<Logger>& logger,
+                            LogLevel::Level level, const LogEvent::ptr& event) {
+        const char* literals = m_literals.data();
+
+        for (auto& i : m_program) {
+            switch (i.op) {
+                case Op::LITERAL:
+                    out.append(literals + i.offset, i.length);
+                    break;
+                case Op::MESSAGE:
+                    out.append(event->getContentView());
+                    break;
+                case Op::LEVEL:
+                    AppendLevel(out, level);
+                    break;
+                case Op::ELAPSE:
+                    AppendUInt(out, event->getElapse());
+                    break;
+                case Op::NAME:
+                    out.append(event->getLogger()->getName());
+                    break;
+                case Op::THREAD_ID:
+                    AppendUInt(out, event->getThreadId());
+                    break;
+                case Op::THREAD_NAME:
+                    out.append(event->getThreadName());
+                    break;
+                case Op::FIBER_ID:
+                    AppendUInt(out, event->getFiberId());
+                    break;
+                case Op::FILENAME:
+                    out.append(event->getFile());
+                    break;
+                case Op::LINE:
+                    AppendInt(out, event->getLine());
+                    break;
+                case Op::DATE:
+                    formatDate(out, i, event);
+                    break;
+                case Op::DATE_SUBSEC: {
+                    // leading digits of the nanoseconds within the second
+                    char buf[9];
+                    uint64_t v = event->getTimeNs() % 1000000000ull;
+                    for (int n = 8; n >= 0; --n) {
+                        buf[n] = '0' + v % 10;
+                        v /= 10;
+                    }
+                    out.append(buf, i.length);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    // stdout formatter
+    const LogEvent::Text& LogFormatter::render(const std::shared_ptr<Logger>& logger,
+                                                LogLevel::Level level, const LogEvent::ptr& event) {
+        // appenders behind an AsyncLogAppender run on its writer thread
+        // while the logging thread may still fill the cache, they format alone
+        if (event->m_owner != std::this_thread::get_id()) {
+            static thread_local LogEvent::Text t_text;
+            if (!t_text || t_text.use_count() > 1) {
+                t_text = std::make_shared<std::string>();
+            }
+            t_text->clear();
+            format(*t_text, logger, level, event);
+            return t_text;
+        }
+
+        size_t cached = std::min(event->m_renderedCount, LogEvent::RENDER_CACHE_SIZE);
+        for (size_t i = 0; i < cached; ++i) {
+            auto& r = event->m_rendered[i];
+            if (r.patternId == m_patternId && r.logger == logger.get() && r.level == level) {
+                return r.text;
+            }
+        }
+
+        auto& r = event->m_rendered[event->m_renderedCount++ % LogEvent::RENDER_CACHE_SIZE];
+        // the buffer of a previous event is reused unless an appender kept it
+        if (!r.text || r.text.use_count() > 1) {
+            r.text = std::make_shared<std::string>();
+        }
+        r.text->clear();
+        r.patternId = m_patternId;
+        r.logger = logger.get();
+        r.level = level;
+        format(*r.text, logger, level, event);
+        return r.text;
+    }
+
+    std::string LogFormatter::format(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+        std::string out;
+        format(out, logger, level, event);
+        return out;
+    }
+
+    // file output formatter
+    std::ostream& LogFormatter::format(std::ostream& ofs, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+        // render into a per-thread buffer, its capacity is kept between events
+        static thread_local std::string t_buf;
+        t_buf.clear();
+        format(t_buf, logger, level, event);
+
+        ofs.write(t_buf.data(), t_buf.size());
+        if (m_flush) {
+            ofs.flush();
+        }
+        return ofs;
+    }
+
+    void LogFormatter::addLiteral(std::vector<Instruction>& program, const std::string& str) {
+        if (str.empty()) {
+            return;
+        }
+
+        // adjacent literals (text, %T, %n) become a single span
+        if (!program.empty() && program.back().op == Op::LITERAL
+            && program.back().offset + program.back().length == m_literals.size()) {
+            program.back().length += str.size();
+        } else {
+            Instruction ins;
+            ins.op = Op::LITERAL;
+            ins.offset = m_literals.size();
+            ins.length = str.size();
+            program.push_back(ins);
+        }
+        m_literals += str;
+    }
+
+    void LogFormatter::addDateSegment(size_t begin) {
+        if (begin == m_dateProgram.size()) {
+            return;
+        }
+
+        Instruction ins;
+        ins.op = Op::DATE;
+        ins.offset = begin;
+        ins.length = m_dateProgram.size() - begin;
+        m_program.push_back(ins);
+    }
 
-    void FileLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-        if (level >= m_level) {
-            uint64_t now = event->getTime();
-            if (now >= m_lastTime + 3) {
-                reopen();
-                m_lastTime = now;
+    // "%Y-%m-%d %H:%M:%S.%3f" compiles into DATE("%Y-%m-%d %H:%M:%S.") DATE_SUBSEC(3),
+    // the DATE part only changes once per second and is cached
+    void LogFormatter::addDate(const std::string& fmt) {
+        const std::string& f = fmt.empty() ? std::string("%Y-%m-%d %H:%M:%S") : fmt;
+        size_t begin = m_dateProgram.size();
+
+        for (size_t i = 0; i < f.size(); ++i) {
+            if (f[i] != '%' || i + 1 == f.size()) {
+                addLiteral(m_dateProgram, std::string(1, f[i]));
+                continue;
             }
 
-            MutexType::Lock lock(m_mutex);
-            if(!m_formatter->format(m_filestream, logger, level, event)) {  // output the formatted string into file
-                std::cout << "error" << std::endl;
+            // %f, %1f ... %9f: fraction of second, 6 digits by default
+            size_t digits = 0;
+            if (f[i + 1] == 'f') {
+                digits = 6;
+            } else if (f[i + 1] >= '1' && f[i + 1] <= '9' && i + 2 < f.size() && f[i + 2] == 'f') {
+                digits = f[i + 1] - '0';
             }
-        }
-    };
 
-    // stdout formatter
-    std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-        std::stringstream ss;
-        
-        for (auto &i : m_items) { // use FormatItem to format event and store into ss
-            i->format(ss, logger, level, event); 
-        }
+            if (digits) {
+                addDateSegment(begin);
+                Instruction ins;
+                ins.op = Op::DATE_SUBSEC;
+                ins.length = digits;
+                m_program.push_back(ins);
 
-        return ss.str();
-    }
+                i += f[i + 1] == 'f' ? 1 : 2;
+                begin = m_dateProgram.size();
+                continue;
+            }
 
-    // file output formatter
-    std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-        for(auto& i : m_items) {
-            i->format(ofs, logger, level, event);
+            Instruction ins;
+            switch (f[++i]) {
+                case 'Y': ins.op = Op::DATE_YEAR; break;
+                case 'm': ins.op = Op::DATE_MONTH; break;
+                case 'd': ins.op = Op::DATE_DAY; break;
+                case 'H': ins.op = Op::DATE_HOUR; break;
+                case 'M': ins.op = Op::DATE_MINUTE; break;
+                case 'S': ins.op = Op::DATE_SECOND; break;
+                default:
+                    // leave uncommon specifiers to strftime
+                    ins.op = Op::DATE_STRFTIME;
+                    ins.offset = m_literals.size();
+                    ins.length = 2;
+                    m_literals += f.substr(i - 1, 2);
+                    break;
+            }
+            m_dateProgram.push_back(ins);
         }
-        return ofs;
+
+        addDateSegment(begin);
     }
 
     // set up formatItem according to the given pattern
@@ -548,42 +1490,40 @@ namespace Server {
             vec.push_back(std::make_tuple(nstr, "", 0));
         }
 
-        static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)>> s_format_items = {
-
-#define XX(str, C) \
-    {#str,[](const std::string &fmt) { return FormatItem::ptr(std::make_shared<C>(fmt)); }}
-
-            XX(m, MessageFormatItem),    // %m --- message body
-            XX(p, LevelFormatItem),      // %p --- priority level
-            XX(r, ElapseFormatItem),     // %r --- number of milliseconds elapsed since the logger created
-            XX(c, NameFormatItem),       // %c --- name of logger
-            XX(t, ThreadIdFormatItem),   // %t --- thread id
-            XX(n, NewLineFormatItem),    // %n --- newline char
-            XX(d, DateTimeFormatItem),   // %d --- time stamp
-            XX(f, FilenameFormatItem),   // %f --- file name
-            XX(l, LineFormatItem),       // %l --- line number
-            XX(T, TabFormatItem),        // %T --- Tab
-            XX(F, FiberIdFormatItem),     // %F --- Coroutine Id
-            XX(N, ThreadNameFormatIitem) // %N --- Thread name
-#undef XX
-
+        static const std::map<std::string, Op> s_format_ops = {
+            {"m", Op::MESSAGE},         // %m --- message body
+            {"p", Op::LEVEL},           // %p --- priority level
+            {"r", Op::ELAPSE},          // %r --- number of milliseconds elapsed since the logger created
+            {"c", Op::NAME},            // %c --- name of logger
+            {"t", Op::THREAD_ID},       // %t --- thread id
+            {"f", Op::FILENAME},        // %f --- file name
+            {"l", Op::LINE},            // %l --- line number
+            {"F", Op::FIBER_ID},        // %F --- Coroutine Id
+            {"N", Op::THREAD_NAME}      // %N --- Thread name
         };
 
-        // start parsing the split string and convert into the given format
+        // start compiling the split string into instructions
         for (auto &i : vec) {
+            const std::string& str = std::get<0>(i);
             if (std::get<2>(i) == 0) { // raw string
-                m_items.push_back(FormatItem::ptr(std::make_shared<StringFormatItem>(std::get<0>(i))));   
-            }
-            else {
-                auto it = s_format_items.find(std::get<0>(i)); // current string contains pattern
-
-                if (it == s_format_items.end()) {               // error pattern, which is <<pattern_error>>
-                    m_items.push_back(FormatItem::ptr(
-                        std::make_shared<StringFormatItem>("<<error_format %" + std::get<0>(i) + ">>")));
+                addLiteral(m_program, str);
+            } else if (str == "n") {   // %n --- newline char
+                addLiteral(m_program, "\n");
+                m_flush = true;
+            } else if (str == "T") {   // %T --- Tab
+                addLiteral(m_program, "\t");
+            } else if (str == "d") {   // %d --- time stamp
+                addDate(std::get<1>(i));
+            } else {
+                auto it = s_format_ops.find(str); // current string contains pattern
+
+                if (it == s_format_ops.end()) {               // error pattern, which is <<pattern_error>>
+                    addLiteral(m_program, "<<error_format %" + str + ">>");
                     m_error = true;
-                }
-                else {
-                    m_items.push_back(it->second(std::get<1>(i)));
+                } else {
+                    Instruction ins;
+                    ins.op = it->second;
+                    m_program.push_back(ins);
                 }
             }
 
@@ -594,67 +1534,221 @@ namespace Server {
     }; 
 
 LoggerManager::LoggerManager() {
-    // if (m_root == nullptr)  {std::cout << "root is null" << std::endl;} else {std::cout << "root is not null" << std::endl;};
-    // m_root.reset(new Logger);
     m_root = std::make_shared<Logger>();
     m_root->addAppender(LogAppender::ptr(std::make_shared<StdoutLogAppender>()));   // default appender for logger
-    
-    m_loggers[m_root->m_name] = m_root;                             // store default logger
+
+    MutexType::Lock lock(m_mutex);
+    insertNoLock(m_root->m_name, m_root);                           // store default logger
+    lock.unlock();
 
     init();
 };
 
-Logger::ptr LoggerManager::getLogger(const std::string& name){
-    MutexType::Lock lock(m_mutex);
-    auto it = m_loggers.find(name);
+const Logger::ptr* LoggerManager::findLogger(std::string_view name) const {
+    const Table* table = m_table.load(std::memory_order_acquire);
+    if (!table) {
+        return nullptr;
+    }
+
+    size_t hash = std::hash<std::string_view>()(name);
+    for (size_t i = hash & table->mask; ; i = (i + 1) & table->mask) {
+        const Slot& slot = table->slots[i];
+        const Logger::ptr* logger = slot.logger.load(std::memory_order_acquire);
+        if (!logger) {
+            return nullptr;
+        }
+        if (slot.hash == hash && *slot.name == name) {
+            return logger;
+        }
+    }
+};
 
-    if (it != m_loggers.end()) {
-        return it->second;
+const Logger::ptr& LoggerManager::getLogger(const std::string& name){
+    if (const Logger::ptr* logger = findLogger(name)) {
+        return *logger;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    // somebody may have created it meanwhile
+    if (const Logger::ptr* logger = findLogger(name)) {
+        return *logger;
     }
 
     // create and store an new logger with name
     Logger::ptr logger = std::make_shared<Logger>(name);
     logger->m_root = m_root;
-    m_loggers[name] = logger;
-
-    return logger;
+    return insertNoLock(name, logger);
 };
 
 bool LoggerManager::storeLogger(const std::string label, const Logger::ptr logger) {
-    if (m_loggers.find(label) != m_loggers.end()) {
+    MutexType::Lock lock(m_mutex);
+    if (findLogger(label)) {
         std::cout << "label exists: " << label << std::endl;
         return false;
     } 
 
-    m_loggers[label] = logger;
+    insertNoLock(label, logger);
     return true;
 };
 
+const Logger::ptr& LoggerManager::insertNoLock(const std::string& name, const Logger::ptr& logger) {
+    m_loggers.push_back(logger);
+    m_names.push_back(name);
+    const Logger::ptr* stored = &m_loggers.back();
+    const std::string* label = &m_names.back();
+
+    // keep the load under 1/2, a full table is copied, not resized in place
+    Table* table = m_tables.empty() ? nullptr : m_tables.back().get();
+    bool grow = !table || (table->size + 1) * 2 > table->mask + 1;
+    if (grow) {
+        Table* bigger = new Table(table ? (table->mask + 1) * 2 : 16);
+        m_tables.emplace_back(bigger);
+        for (size_t i = 0; i < m_loggers.size(); ++i) {
+            size_t hash = std::hash<std::string_view>()(m_names[i]);
+            size_t j = hash & bigger->mask;
+            while (bigger->slots[j].logger.load(std::memory_order_relaxed)) {
+                j = (j + 1) & bigger->mask;
+            }
+            bigger->slots[j].hash = hash;
+            bigger->slots[j].name = &m_names[i];
+            bigger->slots[j].logger.store(&m_loggers[i], std::memory_order_relaxed);
+            ++bigger->size;
+        }
+        m_table.store(bigger, std::memory_order_release);
+        return *stored;
+    }
+
+    // a free slot is filled first and then published, concurrent readers
+    // either see the whole entry or an empty slot
+    size_t hash = std::hash<std::string_view>()(name);
+    size_t j = hash & table->mask;
+    while (table->slots[j].logger.load(std::memory_order_relaxed)) {
+        j = (j + 1) & table->mask;
+    }
+    table->slots[j].hash = hash;
+    table->slots[j].name = label;
+    table->slots[j].logger.store(stored, std::memory_order_release);
+    ++table->size;
+    return *stored;
+};
+
+// AsyncLogAppender settings of an appender, or the default of every
+// appender of a logger
+struct LogAsyncDefine {
+    bool enabled = false;
+    AsyncLogAppender::LaneOptionsList lanes = AsyncLogAppender::DefaultLanes();
+
+    bool operator==(const LogAsyncDefine& oth) const {
+        return enabled == oth.enabled && lanes == oth.lanes;
+    }
+};
+
+// async: true, or
+// async:
+//   capacity: 8192             # every lane
+//   overflow: drop_newest      # (block, drop_newest, drop_debug_first, drop_oldest) info and debug lanes
+//   lanes:                     # per lane, the error lane always blocks
+//     error: { capacity: 1024 }
+//     debug: { capacity: 65536, overflow: drop_oldest }
+static LogAsyncDefine ParseAsync(const YAML::Node& as) {
+    LogAsyncDefine def;
+    if (as.IsScalar()) {
+        def.enabled = as.as<bool>();
+        return def;
+    }
+
+    def.enabled = true;
+    uint32_t capacity = as["capacity"].IsDefined() ? as["capacity"].as<uint32_t>() : 8192;
+    auto overflow = as["overflow"].IsDefined() ? AsyncLogAppender::FromString(as["overflow"].as<std::string>())
+                                               : AsyncLogAppender::OverflowPolicy::BLOCK;
+    def.lanes = AsyncLogAppender::DefaultLanes(capacity, overflow);
+
+    auto lanes = as["lanes"];
+    for (int i = 0; lanes.IsDefined() && i < AsyncLogAppender::LANE_COUNT; ++i) {
+        auto l = lanes[AsyncLogAppender::ToString((AsyncLogAppender::Lane)i)];
+        if (!l.IsDefined()) {
+            continue;
+        }
+        if (l.IsScalar()) {
+            def.lanes[i].capacity = l.as<uint32_t>();
+            continue;
+        }
+        if (l["capacity"].IsDefined()) {
+            def.lanes[i].capacity = l["capacity"].as<uint32_t>();
+        }
+        if (l["overflow"].IsDefined() && i != AsyncLogAppender::LANE_ERROR) {
+            def.lanes[i].overflow = AsyncLogAppender::FromString(l["overflow"].as<std::string>());
+        }
+    }
+    return def;
+}
+
 struct LogAppenderDefine {
-    int type = 0; // 1 File, 2 Stdout
+    int type = 0; // 1 File, 2 Stdout, 3 BinaryFile, 4 RollingFile, 5 Socket
     LogLevel::Level level = LogLevel::Level::UNKNOWN;
     std::string formatter;
     std::string file;
 
+    // wrap the appender into an AsyncLogAppender
+    LogAsyncDefine async;
+
+    // RollingFileLogAppender only
+    RollingFileOptions rolling;
+
+    // FileLogAppender, StdoutLogAppender and BinaryFileLogAppender only
+    LogFlushPolicy flush;
+
+    // FileLogAppender only, seconds per time index entry, 0 for no index
+    uint32_t index = 0;
+
+    // SocketLogAppender only
+    std::string address;
+    SocketLogOptions socket;
+
     bool operator==(const LogAppenderDefine& oth) const {
         return type == oth.type
             && level == oth.level
             && formatter == oth.formatter
-            && file == oth.file;
+            && file == oth.file
+            && async == oth.async
+            && rolling == oth.rolling
+            && flush == oth.flush
+            && index == oth.index
+            && address == oth.address
+            && socket == oth.socket;
     }
 };
     
+// flight recorder settings of a logger
+struct LogRecorderDefine {
+    bool enabled = false;
+    LogLevel::Level level = LogLevel::Level::DEBUG;
+    uint32_t capacity = 0;      // records per thread, 0 keeps the current one
+    std::string file;           // crash dump file, empty for stderr
+
+    bool operator==(const LogRecorderDefine& oth) const {
+        return enabled == oth.enabled
+            && level == oth.level
+            && capacity == oth.capacity
+            && file == oth.file;
+    }
+};
+
 struct LogDefine {
     std::string name ;
     LogLevel::Level level = LogLevel::Level::UNKNOWN;
     std::string formatter;
     std::vector<LogAppenderDefine> appenders;
+    LogRecorderDefine recorder;
+    LogAsyncDefine async;       // default of the appenders without their own
 
     bool operator==(const LogDefine& oth) const {
         return name == oth.name
         && level == oth.level
         && formatter == oth.formatter
-        && appenders == oth.appenders;
+        && appenders == oth.appenders
+        && recorder == oth.recorder
+        && async == oth.async;
     }
     
     bool operator!=(const LogDefine& oth) const {
@@ -667,14 +1761,11 @@ struct LogDefine {
     }
 };
 
-// fully specialized template for conversion from string to LogDefine
+// fully specialized template for conversion from yaml node to LogDefine
 template<>
-class LexicalCast<std::string, LogDefine> {
+class FromNode<LogDefine> {
 public:
-    LogDefine operator()(const std::string& v){
-        // accept yaml format string and convert to yaml node / node sequence
-        YAML::Node node = YAML::Load(v);
-        
+    LogDefine operator()(const YAML::Node& node){
         LogDefine ld;
         if (!node["name"].IsDefined()) {
             std::cout << "log config error: name is null, " << node
@@ -687,6 +1778,33 @@ public:
         if (node["formatter"].IsDefined()) {
             ld.formatter = node["formatter"].as<std::string>();
         }
+
+        // recorder: true, or
+        // recorder:
+        //   level: debug
+        //   capacity: 4096
+        //   file: crash.log
+        if (node["recorder"].IsDefined()) {
+            auto r = node["recorder"];
+            if (r.IsScalar()) {
+                ld.recorder.enabled = r.as<bool>();
+            } else {
+                ld.recorder.enabled = true;
+                if (r["level"].IsDefined()) {
+                    ld.recorder.level = LogLevel::FromString(r["level"].as<std::string>());
+                }
+                if (r["capacity"].IsDefined()) {
+                    ld.recorder.capacity = r["capacity"].as<uint32_t>();
+                }
+                if (r["file"].IsDefined()) {
+                    ld.recorder.file = r["file"].as<std::string>();
+                }
+            }
+        }
+
+        if (node["async"].IsDefined()) {
+            ld.async = ParseAsync(node["async"]);
+        }
         
         if (node["appenders"].IsDefined()) {
             // add each appender into logDefine
@@ -700,6 +1818,7 @@ public:
 
                 std::string type = a["type"].as<std::string>();
                 LogAppenderDefine lad;
+                lad.async = ld.async;
                 if (type == "FileLogAppender") {
                     lad.type = 1;
                     if (!a["file"].IsDefined()) {
@@ -711,16 +1830,123 @@ public:
                     if (a["formatter"].IsDefined()) {
                         lad.formatter = a["formatter"].as<std::string>();
                     }
+                    // index: 1     # seconds per entry of "<file>.idx"
+                    if (a["index"].IsDefined()) {
+                        lad.index = a["index"].as<uint32_t>();
+                    }
+                } else if (type == "BinaryFileLogAppender") {
+                    lad.type = 3;
+                    if (!a["file"].IsDefined()) {
+                        std::cout << "log config error: binaryFileAppender file is null, " << a
+                                << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    lad.flush = BinaryFileLogAppender::DefaultFlushPolicy();
+                } else if (type == "RollingFileLogAppender") {
+                    lad.type = 4;
+                    if (!a["file"].IsDefined()) {
+                        std::cout << "log config error: rollingFileAppender file is null, " << a
+                                << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if (a["formatter"].IsDefined()) {
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
+
+                    // rolling:
+                    //   max_size: 67108864
+                    //   interval: 3600
+                    //   max_files: 24
+                    //   compress: true
+                    //   suffix: "%Y%m%d-%H%M%S"
+                    auto r = a["rolling"];
+                    if (r.IsDefined()) {
+                        if (r["max_size"].IsDefined()) {
+                            lad.rolling.maxSize = r["max_size"].as<uint64_t>();
+                        }
+                        if (r["interval"].IsDefined()) {
+                            lad.rolling.interval = r["interval"].as<uint32_t>();
+                        }
+                        if (r["max_files"].IsDefined()) {
+                            lad.rolling.maxFiles = r["max_files"].as<uint32_t>();
+                        }
+                        if (r["compress"].IsDefined()) {
+                            lad.rolling.compress = r["compress"].as<bool>();
+                        }
+                        if (r["suffix"].IsDefined()) {
+                            lad.rolling.suffix = r["suffix"].as<std::string>();
+                        }
+                    }
                 } else if (type == "StdoutLogAppender") {
                     lad.type = 2;
                     if (a["formatter"].IsDefined()) {
                         lad.formatter = a["formatter"].as<std::string>();
                     }
+                } else if (type == "SocketLogAppender") {
+                    lad.type = 5;
+                    if (!a["address"].IsDefined()) {
+                        std::cout << "log config error: socketAppender address is null, " << a
+                                << std::endl;
+                        continue;
+                    }
+                    lad.address = a["address"].as<std::string>();
+                    if (a["formatter"].IsDefined()) {
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
+
+                    // spool: 4194304
+                    // retry:
+                    //   min: 100       # ms
+                    //   max: 5000
+                    if (a["spool"].IsDefined()) {
+                        lad.socket.spoolSize = a["spool"].as<uint64_t>();
+                    }
+                    auto r = a["retry"];
+                    if (r.IsDefined()) {
+                        if (r["min"].IsDefined()) {
+                            lad.socket.retryMin = r["min"].as<uint32_t>();
+                        }
+                        if (r["max"].IsDefined()) {
+                            lad.socket.retryMax = r["max"].as<uint32_t>();
+                        }
+                    }
                 } else {
                     std::cout << "Log config error: appender type is invalid, " << a
                             << std::endl;
                     continue;
                 }
+
+                // flush: line, or
+                // flush:
+                //   line: false        # every line (default when flush is not set)
+                //   bytes: 65536       # buffered bytes
+                //   interval: 100      # milliseconds since the last flush
+                //   level: error       # events at or above level
+                // fields not given keep the default of the appender type
+                if ((lad.type == 1 || lad.type == 2 || lad.type == 3) && a["flush"].IsDefined()) {
+                    auto f = a["flush"];
+                    if (f.IsScalar()) {
+                        lad.flush.line = f.as<std::string>() == "line";
+                    } else {
+                        lad.flush.line = f["line"].IsDefined() && f["line"].as<bool>();
+                        if (f["bytes"].IsDefined()) {
+                            lad.flush.bytes = f["bytes"].as<uint64_t>();
+                        }
+                        if (f["interval"].IsDefined()) {
+                            lad.flush.interval = f["interval"].as<uint32_t>();
+                        }
+                        if (f["level"].IsDefined()) {
+                            lad.flush.level = LogLevel::FromString(f["level"].as<std::string>());
+                        }
+                    }
+                }
+
+                // overrides the async of the logger
+                if (a["async"].IsDefined()) {
+                    lad.async = ParseAsync(a["async"]);
+                }
                 
                 ld.appenders.push_back(lad);
             }
@@ -730,6 +1956,16 @@ public:
     };
 };
 
+// fully specialized template for conversion from string to LogDefine
+template<>
+class LexicalCast<std::string, LogDefine> {
+public:
+    LogDefine operator()(const std::string& v){
+        // accept yaml format string and convert to yaml node / node sequence
+        return FromNode<LogDefine>()(YAML::Load(v));
+    };
+};
+
 // fully specialized template for conversion from LogDefine to string
 template<>
 class LexicalCast<LogDefine, std::string> {
@@ -748,6 +1984,20 @@ public:
             node["formatter"] = i.formatter;
         }
 
+        if (i.async.enabled) {
+            AsyncLanesToYaml(node, i.async.lanes);
+        }
+
+        if (i.recorder.enabled) {
+            node["recorder"]["level"] = LogLevel::ToString(i.recorder.level);
+            if (i.recorder.capacity) {
+                node["recorder"]["capacity"] = i.recorder.capacity;
+            }
+            if (!i.recorder.file.empty()) {
+                node["recorder"]["file"] = i.recorder.file;
+            }
+        }
+
         for (auto& a : i.appenders) {
             YAML::Node na;
             if (a.type == 1) {
@@ -755,6 +2005,23 @@ public:
                 na["file"] = a.file;
             } else if (a.type == 2) {
                 na["type"] = "StdoutLogAppender";
+            } else if (a.type == 3) {
+                na["type"] = "BinaryFileLogAppender";
+                na["file"] = a.file;
+            } else if (a.type == 4) {
+                na["type"] = "RollingFileLogAppender";
+                na["file"] = a.file;
+                na["rolling"]["max_size"] = a.rolling.maxSize;
+                na["rolling"]["interval"] = a.rolling.interval;
+                na["rolling"]["max_files"] = a.rolling.maxFiles;
+                na["rolling"]["compress"] = a.rolling.compress;
+                na["rolling"]["suffix"] = a.rolling.suffix;
+            } else if (a.type == 5) {
+                na["type"] = "SocketLogAppender";
+                na["address"] = a.address;
+                na["spool"] = a.socket.spoolSize;
+                na["retry"]["min"] = a.socket.retryMin;
+                na["retry"]["max"] = a.socket.retryMax;
             }
         
             if (a.level != LogLevel::Level::UNKNOWN) {
@@ -765,6 +2032,22 @@ public:
                 na["formatter"] = a.formatter;
             }
 
+            if (a.type == 1 || a.type == 2) {
+                FlushPolicyToYaml(na, a.flush);
+            } else if (a.type == 3) {
+                FlushPolicyToYaml(na, a.flush, BinaryFileLogAppender::DefaultFlushPolicy());
+            }
+
+            if (a.type == 1 && a.index) {
+                na["index"] = a.index;
+            }
+
+            if (a.async.enabled) {
+                AsyncLanesToYaml(na, a.async.lanes);
+            } else if (i.async.enabled) {
+                na["async"] = false;
+            }
+
             node["appenders"].push_back(na);
         }
 
@@ -774,13 +2057,155 @@ public:
     };
 };
 
+uint8_t LogCallSite::registerSite() {
+    return LogCallSiteMgr::getInstance()->add(this);
+};
+
+void LogLimitedSite::summary(const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+    uint64_t now = GetCurrentNS();
+    uint64_t next = m_nextSummary.load(std::memory_order_relaxed);
+    // one thread wins the window, the others go on without a summary
+    if (now < next || !m_nextSummary.compare_exchange_strong(next, now + SUMMARY_INTERVAL_NS,
+                                                            std::memory_order_relaxed)) {
+        return;
+    }
+
+    uint64_t n = m_suppressed.exchange(0, std::memory_order_relaxed);
+    if (n) {
+        // the summary goes where the messages of the site go
+        LogEventWrap(LogEventPool::Acquire(logger, level, getFile(), getLine(),
+                                        SERVER_LOG_RECORD_ONLY(logger, level, (*this)))).getSS()
+            << "suppressed " << n << " messages";
+    }
+};
+
+void LogLimitedSite::track(const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+    LogCallSiteMgr::getInstance()->track(this, logger, level);
+};
+
+void LogCallSiteManager::setRules(const std::set<std::string>& rules) {
+    MutexType::Lock lock(m_mutex);
+    m_rules.clear();
+    for (auto& i : rules) {
+        // "file:line", anything not ending in a number is a whole file
+        size_t pos = i.rfind(':');
+        int32_t line = 0;
+        if (pos != std::string::npos && pos + 1 < i.size()
+            && i.find_first_not_of("0123456789", pos + 1) == std::string::npos) {
+            line = atoi(i.c_str() + pos + 1);
+            m_rules.emplace_back(i.substr(0, pos), line);
+        } else {
+            m_rules.emplace_back(i, 0);
+        }
+    }
+
+    for (LogCallSite* site = m_sites; site; site = site->m_next) {
+        site->m_state.store(match(site) ? LogCallSite::ENABLED : LogCallSite::DISABLED,
+                            std::memory_order_relaxed);
+    }
+};
+
+uint8_t LogCallSiteManager::add(LogCallSite* site) {
+    MutexType::Lock lock(m_mutex);
+    uint8_t state = site->m_state.load(std::memory_order_relaxed);
+    if (state != LogCallSite::UNREGISTERED) {
+        return state;       // another thread got here first
+    }
+
+    site->m_next = m_sites;
+    m_sites = site;
+    state = match(site) ? LogCallSite::ENABLED : LogCallSite::DISABLED;
+    site->m_state.store(state, std::memory_order_relaxed);
+    return state;
+};
+
+std::vector<std::string> LogCallSiteManager::getEnabled() {
+    MutexType::Lock lock(m_mutex);
+    std::vector<std::string> result;
+    for (LogCallSite* site = m_sites; site; site = site->m_next) {
+        if (site->m_state.load(std::memory_order_relaxed) == LogCallSite::ENABLED) {
+            result.push_back(std::string(site->getFile()) + ":" + std::to_string(site->getLine()));
+        }
+    }
+    return result;
+};
+
+void LogCallSiteManager::track(LogLimitedSite* site, const std::shared_ptr<Logger>& logger,
+                                LogLevel::Level level) {
+    bool first = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        site->m_logger = logger;
+        site->m_level = level;
+        if (!site->m_tracked) {
+            site->m_tracked = true;
+            site->m_nextLimited = m_limited;
+            m_limited = site;
+            first = !site->m_nextLimited;
+        }
+    }
+    // the flusher logs the summaries, never under m_mutex
+    if (first) {
+        LogFlusher::GetInstance()->addSites();
+    }
+};
+
+void LogCallSiteManager::flushSummaries() {
+    struct Pending {
+        LogLimitedSite* site;
+        Logger::ptr logger;
+        LogLevel::Level level;
+    };
+    std::vector<Pending> pending;
+    {
+        MutexType::Lock lock(m_mutex);
+        for (LogLimitedSite* site = m_limited; site; site = site->m_nextLimited) {
+            if (site->m_suppressed.load(std::memory_order_relaxed) != 0) {
+                pending.push_back({ site, site->m_logger.lock(), site->m_level });
+            }
+        }
+    }
+
+    // logged without m_mutex, the appenders may reach new call sites.
+    // The logger may be gone, or its level raised since the drop
+    for (auto& i : pending) {
+        if (i.logger && SERVER_LOG_ENABLED(i.logger, i.level, (*i.site))) {
+            i.site->summary(i.logger, i.level);
+        }
+    }
+};
+
+bool LogCallSiteManager::match(const LogCallSite* site) const {
+    std::string_view file = site->getFile();
+    for (auto& [path, line] : m_rules) {
+        if (line != 0 && line != site->getLine()) {
+            continue;
+        }
+        // path suffix, only on a directory boundary
+        if (file.size() >= path.size() && file.substr(file.size() - path.size()) == path
+            && (file.size() == path.size() || file[file.size() - path.size() - 1] == '/')) {
+            return true;
+        }
+    }
+    return false;
+};
+
 // define loggers configuration before main()
 Server::ConfigArg<std::set<LogDefine>>::ptr g_log_defines = 
     Server::ConfigMgr::lookUp("logs", std::set<LogDefine>(), "logs config");
 
+// call sites logged regardless of their logger level
+Server::ConfigArg<std::set<std::string>>::ptr g_log_sites =
+    Server::ConfigMgr::lookUp("log_sites", std::set<std::string>(), "log call sites switched on");
+
 // intialize before main() to config logger, using logs.yaml
 struct LogIniter {
     LogIniter() {
+        g_log_sites->addListener([](const std::set<std::string>& oldValue,
+                                        const std::set<std::string>& newValue) {
+            LogCallSiteMgr::getInstance()->setRules(newValue);
+        });
+
         g_log_defines->addListener([](const std::set<LogDefine>& oldValue, 
                                             const std::set<LogDefine>& newValue) {
             
@@ -807,16 +2232,42 @@ struct LogIniter {
                     // new formatter in config.yaml
                     logger->setFormatter(i.formatter);
                 }
+
+                if (i.recorder.enabled) {
+                    if (i.recorder.capacity) {
+                        FlightRecorder::SetCapacity(i.recorder.capacity);
+                    }
+                    if (!i.recorder.file.empty()) {
+                        FlightRecorder::SetDumpFile(i.recorder.file);
+                    }
+                    FlightRecorder::InstallSignalHandlers();
+                }
+                logger->setRecorder(i.recorder.enabled, i.recorder.level);
                 
                 // reset all appenders
                 logger->clearAppenders();
                 for (auto& a : i.appenders) {
                     Server::LogAppender::ptr ap;
 
-                    if (a.type == 1) {
-                        ap.reset(new FileLogAppender(a.file));
-                    } else if (a.type == 2) {
-                        ap.reset(new StdoutLogAppender);                    
+                    if (a.type == 1 || a.type == 2) {
+                        BufferedLogAppender::ptr bp;
+                        if (a.type == 1) {
+                            FileLogAppender::ptr fp(new FileLogAppender(a.file));
+                            fp->setIndex(a.index);
+                            bp = fp;
+                        } else {
+                            bp.reset(new StdoutLogAppender);
+                        }
+                        bp->setFlushPolicy(a.flush);
+                        ap = bp;
+                    } else if (a.type == 3) {
+                        BinaryFileLogAppender::ptr bp(new BinaryFileLogAppender(a.file));
+                        bp->setFlushPolicy(a.flush);
+                        ap = bp;
+                    } else if (a.type == 4) {
+                        ap.reset(new RollingFileLogAppender(a.file, a.rolling));
+                    } else if (a.type == 5) {
+                        ap.reset(new SocketLogAppender(a.address, a.socket));
                     }
 
                     ap->setLevel(a.level);
@@ -829,6 +2280,12 @@ struct LogIniter {
                                     << " formatter = " << a.formatter << " is invalid " << std::endl;
                         }
                     }
+
+                    if (a.async.enabled) {
+                        // the real appender is driven by a background writer thread
+                        ap.reset(new AsyncLogAppender(ap, a.async.lanes));
+                        ap->setLevel(a.level);
+                    }
                     logger->addAppender(ap);
                 }
             }
@@ -839,6 +2296,7 @@ struct LogIniter {
                     // the logger is deleted
                     auto logger = SERVER_LOG_NAME(i.name);
                     logger->setLevel((LogLevel::Level)0);
+                    logger->setRecorder(false);
                     logger->clearAppenders();
                 }
             }
@@ -856,7 +2314,7 @@ std::string LoggerManager::toYamlString() {
     MutexType::Lock lock(m_mutex);
     YAML::Node node;
     for (auto& i : m_loggers) {
-        node.push_back(YAML::Load(i.second->toYamlString()));
+        node.push_back(YAML::Load(i->toYamlString()));
     }
 
     std::stringstream ss;
@@ -864,4 +2322,130 @@ std::string LoggerManager::toYamlString() {
     return ss.str();
 }
 
+// type and target of an appender, read back from its configuration
+// no appender lock is taken, a scrape never waits on file or socket I/O
+static LoggerStats::Appender AppenderStats(const LogAppender::ptr& appender) {
+    LoggerStats::Appender stats;
+    stats.type = appender->getTypeName();
+    stats.target = appender->getTarget();
+    stats.counters = appender->getStats().snapshot();
+    return stats;
+};
+
+std::vector<LoggerStats> LoggerManager::stats() {
+    // only the logger list is copied under the lock, registration never
+    // waits for the snapshot
+    std::vector<std::pair<std::string, Logger::ptr>> loggers;
+    {
+        MutexType::Lock lock(m_mutex);
+        for (size_t i = 0; i < m_loggers.size(); ++i) {
+            loggers.emplace_back(m_names[i], m_loggers[i]);
+        }
+    }
+
+    std::vector<LoggerStats> result;
+    for (auto& i : loggers) {
+        const Logger::ptr& logger = i.second;
+        auto appenders = logger->m_appenders.load(std::memory_order_acquire);
+        LoggerStats stats;
+        stats.name = i.first;
+        stats.counters = logger->m_stats.snapshot();
+        for (auto& appender : *appenders) {
+            stats.appenders.push_back(AppenderStats(appender));
+            if (auto async = std::dynamic_pointer_cast<AsyncLogAppender>(appender)) {
+                stats.appenders.push_back(AppenderStats(async->getAppender()));
+            }
+        }
+
+        bool used = !stats.appenders.empty();
+        for (int c = 0; c < LogStats::COUNTER_COUNT && !used; ++c) {
+            used = stats.counters.values[c] != 0;
+        }
+        if (used) {
+            result.push_back(std::move(stats));
+        }
+    }
+    return result;
+};
+
+std::string LoggerManager::statsToYamlString() {
+    YAML::Node node(YAML::NodeType::Sequence);
+    for (auto& logger : stats()) {
+        YAML::Node n;
+        n["name"] = logger.name;
+        for (int c = 0; c < LogStats::COUNTER_COUNT; ++c) {
+            n[LogStats::ToString((LogStats::Counter)c)] = logger.counters.values[c];
+        }
+        for (auto& appender : logger.appenders) {
+            YAML::Node a;
+            a["type"] = appender.type;
+            if (!appender.target.empty()) {
+                a["target"] = appender.target;
+            }
+            for (int c = 0; c < LogStats::COUNTER_COUNT; ++c) {
+                a[LogStats::ToString((LogStats::Counter)c)] = appender.counters.values[c];
+            }
+            n["appenders"].push_back(a);
+        }
+        node.push_back(n);
+    }
+
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+};
+
+// quoted json string
+static void JsonString(std::stringstream& ss, const std::string& str) {
+    ss << '"';
+    for (unsigned char c : str) {
+        switch (c) {
+            case '"':  ss << "\\\""; break;
+            case '\\': ss << "\\\\"; break;
+            case '\n': ss << "\\n"; break;
+            case '\t': ss << "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    ss << buf;
+                } else {
+                    ss << c;
+                }
+        }
+    }
+    ss << '"';
+};
+
+static void JsonCounters(std::stringstream& ss, const LogStats::Snapshot& counters) {
+    for (int c = 0; c < LogStats::COUNTER_COUNT; ++c) {
+        ss << ",\"" << LogStats::ToString((LogStats::Counter)c) << "\":" << counters.values[c];
+    }
+};
+
+std::string LoggerManager::statsToJsonString() {
+    std::stringstream ss;
+    ss << '[';
+    bool first = true;
+    for (auto& logger : stats()) {
+        ss << (first ? "" : ",") << "{\"name\":";
+        first = false;
+        JsonString(ss, logger.name);
+        JsonCounters(ss, logger.counters);
+        ss << ",\"appenders\":[";
+        for (size_t i = 0; i < logger.appenders.size(); ++i) {
+            auto& appender = logger.appenders[i];
+            ss << (i ? "," : "") << "{\"type\":";
+            JsonString(ss, appender.type);
+            ss << ",\"target\":";
+            JsonString(ss, appender.target);
+            JsonCounters(ss, appender.counters);
+            ss << '}';
+        }
+        ss << "]}";
+    }
+    ss << ']';
+    return ss.str();
+};
+
 }; // namespace Server
@@ -12,18 +12,47 @@
 #include <time.h>
 #include <string.h>
 #include <map>
+#include <unordered_map>
+#include <thread>
+#include <deque>
+#include <set>
+#include <stdarg.h>
+#include <string_view>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include <array>
 
 #include "util.hpp"
 #include "singleton.hpp"
 #include "thread.hpp"
-
-// retrieve event input stream from logger
+#include "logfmt.hpp"
+#include "logstats.hpp"
+#include "logindex.hpp"
+
+// Statements below this level are removed at compile time, build with
+// -DSERVER_LOG_MIN_LEVEL=2 to drop every DEBUG statement (see LogLevel::Level)
+#ifndef SERVER_LOG_MIN_LEVEL
+#define SERVER_LOG_MIN_LEVEL 0
+#endif
+
+// true if the statement survives the compile time level, and either the
+// logger level (or its flight recorder level) or its call site is switched
+// on through "log_sites" config
+#define SERVER_LOG_ENABLED(logger, level, site) \
+    ((int)(level) >= SERVER_LOG_MIN_LEVEL && (logger->getThreshold() <= level || site.enabled()))
+
+// true if the statement only goes to the flight recorder, not to appenders
+#define SERVER_LOG_RECORD_ONLY(logger, level, site) \
+    (logger->getLevel() > level && !site.enabled())
+
+// retrieve event input stream from logger, the event is taken from a
+// thread local pool so a log line does not allocate in steady state
 #define SERVER_LOG_LEVEL(logger, level) \
-    if (logger->getLevel() <= level) \
-        Server::LogEventWrap(   \
-            Server::LogEvent::ptr(new Server::LogEvent( \
-            logger, level, __FILE__, __LINE__, 0, Server::getThreadId(), \
-            Server::getFiberId(), time(0), Server::Thread::GetName()))).getSS()
+    if (static constinit Server::LogCallSite __log_site{ __FILE__, __LINE__ }; \
+        SERVER_LOG_ENABLED(logger, level, __log_site)) \
+        Server::LogEventWrap(Server::LogEventPool::Acquire( \
+            logger, level, __FILE__, __LINE__, SERVER_LOG_RECORD_ONLY(logger, level, __log_site))).getSS()
 
 #define SERVER_LOG_DEBUG(logger) SERVER_LOG_LEVEL(logger, Server::LogLevel::Level::DEBUG)
 #define SERVER_LOG_INFO(logger) SERVER_LOG_LEVEL(logger, Server::LogLevel::Level::INFO)
@@ -33,10 +62,10 @@
 
 // Support user defined format
 #define SERVER_LOG_FMT_LEVEL(logger, level, fmt, ...) \
-    if(logger->getLevel() <= level) \
-        Server::LogEventWrap(Server::LogEvent::ptr(new Server::LogEvent(logger, level, \
-        __FILE__, __LINE__,  0, Server::getThreadId(), \
-        Server::getFiberId(), time(0), Server::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+    if (static constinit Server::LogCallSite __log_site{ __FILE__, __LINE__ }; \
+        SERVER_LOG_ENABLED(logger, level, __log_site)) \
+        Server::LogEventWrap(Server::LogEventPool::Acquire( \
+            logger, level, __FILE__, __LINE__, SERVER_LOG_RECORD_ONLY(logger, level, __log_site))).getEvent()->format(fmt, __VA_ARGS__)
 
 #define SERVER_LOG_FMT_DEBUG(logger, fmt, ...) SERVER_LOG_FMT_LEVEL(logger, Server::LogLevel::Level::DEBUG, fmt, __VA_ARGS__)
 #define SERVER_LOG_FMT_INFO(logger, fmt, ...) SERVER_LOG_FMT_LEVEL(logger, Server::LogLevel::Level::INFO, fmt, __VA_ARGS__)
@@ -44,15 +73,50 @@
 #define SERVER_LOG_FMT_ERROR(logger, fmt, ...) SERVER_LOG_FMT_LEVEL(logger, Server::LogLevel::Level::ERROR, fmt, __VA_ARGS__)
 #define SERVER_LOG_FMT_FATAL(logger, fmt, ...) SERVER_LOG_FMT_LEVEL(logger, Server::LogLevel::Level::FATAL, fmt, __VA_ARGS__)
 
+// "{}" format checked against the argument types at compile time (see
+// LogFormatSpec), written straight into the event without allocating
+#define SERVER_LOG_FORMAT_LEVEL(logger, level, fmt, ...) \
+    if (static constinit Server::LogCallSite __log_site{ __FILE__, __LINE__ }; \
+        SERVER_LOG_ENABLED(logger, level, __log_site)) \
+        Server::LogEventWrap(Server::LogEventPool::Acquire( \
+            logger, level, __FILE__, __LINE__, SERVER_LOG_RECORD_ONLY(logger, level, __log_site))) \
+            .getEvent()->print(fmt __VA_OPT__(,) __VA_ARGS__)
+
+#define SERVER_LOG_FORMAT_DEBUG(logger, fmt, ...) SERVER_LOG_FORMAT_LEVEL(logger, Server::LogLevel::Level::DEBUG, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SERVER_LOG_FORMAT_INFO(logger, fmt, ...) SERVER_LOG_FORMAT_LEVEL(logger, Server::LogLevel::Level::INFO, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SERVER_LOG_FORMAT_WARN(logger, fmt, ...) SERVER_LOG_FORMAT_LEVEL(logger, Server::LogLevel::Level::WARN, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SERVER_LOG_FORMAT_ERROR(logger, fmt, ...) SERVER_LOG_FORMAT_LEVEL(logger, Server::LogLevel::Level::ERROR, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SERVER_LOG_FORMAT_FATAL(logger, fmt, ...) SERVER_LOG_FORMAT_LEVEL(logger, Server::LogLevel::Level::FATAL, fmt __VA_OPT__(,) __VA_ARGS__)
+
+// Log only the 1st, (n+1)th, (2n+1)th ... time the statement is reached
+#define SERVER_LOG_EVERY_N(logger, level, n) \
+    if (static constinit Server::LogEveryNSite __log_site{ __FILE__, __LINE__ }; \
+        SERVER_LOG_ENABLED(logger, level, __log_site) && __log_site.admit(logger, level, n)) \
+        Server::LogEventWrap(Server::LogEventPool::Acquire( \
+            logger, level, __FILE__, __LINE__, SERVER_LOG_RECORD_ONLY(logger, level, __log_site))).getSS()
+
+// Log at most perSecond times per second (bursts up to one second worth)
+#define SERVER_LOG_RATE_LIMITED(logger, level, perSecond) \
+    if (static constinit Server::LogRateLimitedSite __log_site{ __FILE__, __LINE__ }; \
+        SERVER_LOG_ENABLED(logger, level, __log_site) && __log_site.admit(logger, level, perSecond)) \
+        Server::LogEventWrap(Server::LogEventPool::Acquire( \
+            logger, level, __FILE__, __LINE__, SERVER_LOG_RECORD_ONLY(logger, level, __log_site))).getSS()
+
 // Get default logger from Mgr
 #define SERVER_LOG_ROOT() Server::LoggerMgr::getInstance()->getRoot()
 // Get logger with specific name 
 #define SERVER_LOG_NAME(name) Server::LoggerMgr::getInstance()->getLogger(name)
 
+namespace YAML {
+class Node;
+}
+
 namespace Server {
 
 class Logger;
 class LoggerManager;
+class LogFormatter;
+struct BinLogRecord;
 
 // Log (message) Level
 class LogLevel {
@@ -73,54 +137,304 @@ public:
     static  LogLevel::Level FromString(const std::string& str);
 };
 
+// Static state of one log statement. It is constant initialized and only
+// registers itself in LogCallSiteManager the first time it is reached, so
+// a call site can be switched on at runtime without lowering the logger level
+class LogCallSite {
+public:
+    constexpr LogCallSite(const char* file, int32_t line)
+        : m_file{ file }, m_line{ line } {}
+
+    bool enabled() {
+        uint8_t state = m_state.load(std::memory_order_relaxed);
+        if (state == UNREGISTERED) [[unlikely]] {
+            state = registerSite();
+        }
+        return state == ENABLED;
+    }
+
+    const char* getFile() const { return m_file; }
+    int32_t getLine() const { return m_line; }
+
+private:
+    friend class LogCallSiteManager;
+
+    enum State : uint8_t {
+        UNREGISTERED = 0,
+        DISABLED     = 1,
+        ENABLED      = 2
+    };
+
+    uint8_t registerSite();
+
+private:
+    const char* m_file;
+    int32_t m_line;
+    std::atomic<uint8_t> m_state{ UNREGISTERED };
+    LogCallSite* m_next = nullptr;      // intrusive list of registered sites
+};
+
+// Call site which drops some of its messages. Dropped messages are counted
+// and reported as "suppressed N messages" (at most once per second) right
+// before the next message that gets through, or by the log flusher thread
+// if no message gets through anymore
+class LogLimitedSite : public LogCallSite {
+public:
+    static constexpr uint64_t SUMMARY_INTERVAL_NS = 1000000000ull;
+
+    constexpr LogLimitedSite(const char* file, int32_t line)
+        : LogCallSite(file, line) {}
+
+    uint64_t getSuppressed() const { return m_suppressed.load(std::memory_order_relaxed); }
+
+protected:
+    void suppress(const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+        // the first drop since the last summary tells the flusher where to report
+        if (m_suppressed.fetch_add(1, std::memory_order_relaxed) == 0) [[unlikely]] {
+            track(logger, level);
+        }
+    }
+
+    bool pass(const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+        if (m_suppressed.load(std::memory_order_relaxed) != 0) [[unlikely]] {
+            summary(logger, level);
+        }
+        return true;
+    }
+
+private:
+    friend class LogCallSiteManager;
+
+    void summary(const std::shared_ptr<Logger>& logger, LogLevel::Level level);
+    void track(const std::shared_ptr<Logger>& logger, LogLevel::Level level);
+
+private:
+    std::atomic<uint64_t> m_suppressed{ 0 };
+    std::atomic<uint64_t> m_nextSummary{ 0 };   // ns, earliest time of the next summary
+    // guarded by the LogCallSiteManager mutex
+    std::weak_ptr<Logger> m_logger;             // logger and level of the last drop
+    LogLevel::Level m_level = LogLevel::Level::UNKNOWN;
+    bool m_tracked = false;
+    LogLimitedSite* m_nextLimited = nullptr;    // intrusive list of sites which dropped
+};
+
+// 1-in-N sampling, see SERVER_LOG_EVERY_N
+class LogEveryNSite : public LogLimitedSite {
+public:
+    constexpr LogEveryNSite(const char* file, int32_t line)
+        : LogLimitedSite(file, line) {}
+
+    bool admit(const std::shared_ptr<Logger>& logger, LogLevel::Level level, uint64_t n) {
+        if (n <= 1 || m_count.fetch_add(1, std::memory_order_relaxed) % n == 0) {
+            return pass(logger, level);
+        }
+        suppress(logger, level);
+        return false;
+    }
+
+private:
+    std::atomic<uint64_t> m_count{ 0 };
+};
+
+// Token bucket in its GCRA form, a single atomic theoretical arrival time
+// replaces the token count and the refill timestamp, see SERVER_LOG_RATE_LIMITED
+class LogRateLimitedSite : public LogLimitedSite {
+public:
+    constexpr LogRateLimitedSite(const char* file, int32_t line)
+        : LogLimitedSite(file, line) {}
+
+    bool admit(const std::shared_ptr<Logger>& logger, LogLevel::Level level, double perSecond) {
+        if (perSecond <= 0) {
+            suppress(logger, level);
+            return false;
+        }
+
+        const uint64_t window = 1000000000ull;          // burst of one second worth of messages
+        uint64_t interval = window / perSecond;
+        uint64_t now = GetCurrentNS();
+        uint64_t tat = m_tat.load(std::memory_order_relaxed);
+        while (true) {
+            uint64_t base = std::max(tat, now);
+            if (base - now + interval > window) {
+                suppress(logger, level);
+                return false;
+            }
+            if (m_tat.compare_exchange_weak(tat, base + interval, std::memory_order_relaxed)) {
+                return pass(logger, level);
+            }
+        }
+    }
+
+private:
+    std::atomic<uint64_t> m_tat{ 0 };
+};
+
+// Stream buffer writing into an inline fixed-size array, it only moves
+// to the heap when a single message outgrows the inline storage
+class LogStreamBuf : public std::streambuf {
+public:
+    static constexpr size_t INLINE_SIZE = 512;
+
+    LogStreamBuf();
+
+    // message written so far
+    std::string_view view() const { return std::string_view(pbase(), pptr() - pbase()); }
+
+    // drop the message and go back to inline storage
+    void reset();
+
+    void append(const char* s, size_t n) {
+        if ((size_t)(epptr() - pptr()) < n) {
+            grow(n);
+        }
+        memcpy(pptr(), s, n);
+        pbump(n);
+    }
+
+    void fill(char c, size_t n) {
+        if ((size_t)(epptr() - pptr()) < n) {
+            grow(n);
+        }
+        memset(pptr(), c, n);
+        pbump(n);
+    }
+
+    // at least n writable bytes at the end of the message, commit() the
+    // ones actually written
+    char* prepare(size_t n) {
+        if ((size_t)(epptr() - pptr()) < n) {
+            grow(n);
+        }
+        return pptr();
+    }
+
+    size_t available() const { return epptr() - pptr(); }
+
+    void commit(size_t n) { pbump(n); }
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+private:
+    // make room for at least n more bytes
+    void grow(size_t n);
+
+private:
+    char m_inline[INLINE_SIZE];
+    std::vector<char> m_heap;   // only used by oversize messages
+};
+
 // Log (message) Event
 class LogEvent {
+friend class LogFormatter;
 public:
     using ptr = std::shared_ptr<LogEvent>;
-    LogEvent (){};
+    // formatted event shared by the appenders, read only once rendered
+    using Text = std::shared_ptr<std::string>;
+    LogEvent ();
     
     LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
             const char* file, int32_t line, uint32_t elapse, 
             uint32_t threadId,uint32_t fiberId, uint64_t time,
             const std::string& threadName);
 
+    LogEvent(const LogEvent&) = delete;
+    LogEvent& operator=(const LogEvent&) = delete;
+
+    // reinitialize a pooled event, logger and thread name are borrowed
+    // and must outlive the event (see detach()), time is in nanoseconds
+    void reset(Logger* logger, LogLevel::Level level,
+            const char* file, int32_t line,
+            uint32_t threadId,uint32_t fiberId, uint64_t timeNs,
+            const std::string* threadName);
+
+    // copy borrowed data so the event can be used after the logging
+    // thread moved on (e.g. by an asynchronous appender)
+    void detach();
+
     const char* getFile () const { return m_file; };
 
     int32_t getLine () const { return m_line; };
 
-    uint32_t getElapse () const { return m_elapse; };
+    uint64_t getElapse () const { return m_elapse; };
 
     uint32_t getFiberId () const { return m_fiberId; };
 
     uint32_t getThreadId () const {return m_threadId; };
 
-    uint32_t getTime () const { return m_time; };
+    // seconds since epoch
+    uint64_t getTime () const { return m_time; };
+
+    // nanoseconds since epoch
+    uint64_t getTimeNs () const { return m_timeNs; };
 
-    std::string getContent () const { return m_ss.str(); };
+    std::string getContent () const { return std::string(m_buf.view()); };
 
-    std::shared_ptr<Logger> getLogger() const { return m_logger; };
+    // message body without copying
+    std::string_view getContentView () const { return m_buf.view(); };
+
+    Logger* getLogger() const { return m_logger; };
 
     LogLevel::Level getLevel() const { return m_level; };
 
-    std::stringstream& getSS() { return m_ss; };
+    // below the logger level, only the flight recorder keeps it
+    bool isRecordOnly() const { return m_recordOnly; };
+
+    void setRecordOnly(bool v) { m_recordOnly = v; };
+
+    std::ostream& getSS() { return m_ss; };
 
-    const std::string& getThreadName() const { return m_threadName; };
+    const std::string& getThreadName() const { return *m_threadName; };
 
-    // use user-defined formatter to format event
-    void format(const char* fmt, ...);
-    void format(const char* fmt, va_list al);
+    // printf style message, arguments are checked by the compiler
+    void format(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    void format(const char* fmt, va_list al) __attribute__((format(printf, 2, 0)));
+
+    // "{}" style message, see SERVER_LOG_FORMAT_*
+    template<typename... Args>
+    void print(LogFormatString<std::type_identity_t<Args>...> fmt, const Args&... args) {
+        LogFormat::Format(m_buf, fmt.get(), args...);
+    }
 
 private:
     const char* m_file    = nullptr;  // file name
     int32_t m_line        = 0;        // lines' number
-    uint32_t m_elapse     = 0;        // milliseconds between program start and current
+    uint64_t m_elapse     = 0;        // milliseconds between program start and current
     uint32_t m_threadId   = 0;        // thread Id
     uint32_t m_fiberId    = 0;        // coroutine Id
-    uint64_t m_time       = 0;        // time stamp
-    std::string m_threadName;         // Thread name
-    std::stringstream m_ss;           // input stream for user input
-    std::shared_ptr<Logger> m_logger; // ptr to the logger which format current event
-    LogLevel::Level m_level;          // event level
+    uint64_t m_time       = 0;        // time stamp in seconds
+    uint64_t m_timeNs     = 0;        // time stamp in nanoseconds
+    const std::string* m_threadName;  // Thread name, points to m_ownThreadName or a thread local name
+    std::string m_ownThreadName;      // Thread name owned by event
+    LogStreamBuf m_buf;               // inline storage of user input
+    std::ostream m_ss;                // input stream for user input
+    Logger* m_logger = nullptr;       // the logger which format current event
+    LogLevel::Level m_level = LogLevel::Level::UNKNOWN; // event level
+    bool m_recordOnly = false;        // only for the flight recorder
+
+    // formatter output of the event, see LogFormatter::render
+    struct Rendered {
+        uint64_t patternId = 0;
+        Logger* logger = nullptr;
+        LogLevel::Level level = LogLevel::Level::UNKNOWN;
+        Text text;
+    };
+    static constexpr size_t RENDER_CACHE_SIZE = 4;
+    Rendered m_rendered[RENDER_CACHE_SIZE];
+    size_t m_renderedCount = 0;
+    std::thread::id m_owner;          // only the logging thread uses the cache
+};
+
+// Thread local pool of events used by the SERVER_LOG_* macros, an event is
+// reused once nobody but the pool holds it
+class LogEventPool {
+public:
+    static constexpr size_t POOL_SIZE = 16;
+
+    // get a ready-to-fill event for current thread
+    static LogEvent::ptr Acquire(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
+                                const char* file, int32_t line, bool recordOnly = false);
 };
 
 // A Wrapper for Event, which can be used to retrieve input stream of event
@@ -130,15 +444,17 @@ public:
     ~LogEventWrap();
 
     // get log event
-    LogEvent::ptr getEvent() const { return m_event;}
+    const LogEvent::ptr& getEvent() const { return m_event;}
 
     // get event input stream
-    std::stringstream& getSS();
+    std::ostream& getSS();
 private:
     LogEvent::ptr m_event;
 };
 
-// Log formatter
+// Log formatter, the pattern is compiled once into a flat program of
+// literal spans and field opcodes, which renders an event into a
+// contiguous char buffer without going through iostream
 class LogFormatter {
 public:
     using ptr = std::shared_ptr<LogFormatter>;
@@ -146,49 +462,107 @@ public:
     LogFormatter (const std::string& pattern);
 
     std::ostream& format(std::ostream& ofs,
-                        std::shared_ptr<Logger> logger,
+                        const std::shared_ptr<Logger>& logger,
                         LogLevel::Level level,
-                        LogEvent::ptr event);
+                        const LogEvent::ptr& event);
 
-    std::string format (std::shared_ptr<Logger> logger,
+    std::string format (const std::shared_ptr<Logger>& logger,
                         LogLevel::Level level,
-                        LogEvent::ptr event); // format event to string
+                        const LogEvent::ptr& event); // format event to string
+
+    // append formatted event to caller supplied buffer
+    void format (std::string& out,
+                const std::shared_ptr<Logger>& logger,
+                LogLevel::Level level,
+                const LogEvent::ptr& event);
+
+    // formatted event, rendered once per pattern on the logging thread and
+    // shared by every appender using the same pattern (the reference is
+    // valid until the next render of this thread, copy it to keep the text)
+    const LogEvent::Text& render(const std::shared_ptr<Logger>& logger,
+                                LogLevel::Level level,
+                                const LogEvent::ptr& event);
 public:
-    // sub-module to parse Log Event, each formatItem is related to specific pattern(placeholder in pattern)
-    class FormatItem {
-    public:
-        using ptr = std::shared_ptr<FormatItem>;
-
-        // FormatItem (const std::string& fmt = "") {};
-
-        virtual ~FormatItem (){};
+    // operation of one compiled pattern element
+    enum class Op : uint8_t {
+        LITERAL,        // %T, %n and raw text, span in m_literals
+        MESSAGE,        // %m
+        LEVEL,          // %p
+        ELAPSE,         // %r
+        NAME,           // %c
+        THREAD_ID,      // %t
+        THREAD_NAME,    // %N
+        FIBER_ID,       // %F
+        FILENAME,       // %f
+        LINE,           // %l
+        DATE,           // second resolution part of %d{}, span in m_dateProgram
+        DATE_SUBSEC,    // %d{%3f}, length is the number of digits
+        // only used inside m_dateProgram
+        DATE_YEAR,      // %Y
+        DATE_MONTH,     // %m
+        DATE_DAY,       // %d
+        DATE_HOUR,      // %H
+        DATE_MINUTE,    // %M
+        DATE_SECOND,    // %S
+        DATE_STRFTIME   // other specifiers, strftime format span in m_literals
+    };
 
-        virtual void format (std::ostream& os,
-                            std::shared_ptr<Logger> logger,
-                            LogLevel::Level level,
-                            LogEvent::ptr event) = 0;
+    struct Instruction {
+        Op op;
+        uint32_t offset = 0;    // span in m_literals or m_dateProgram
+        uint32_t length = 0;
     };
     
-    void init ();                         // config formatterItem with the given pattern(m_pattern)
+    void init ();                         // compile the given pattern(m_pattern)
     bool isError() const { return m_error; }; 
     const std::string getPattern() const { return m_pattern; }
+private:
+    // append a literal span into program, merged with previous literal
+    void addLiteral(std::vector<Instruction>& program, const std::string& str);
+
+    // compile a %d{...} sub-format into date instructions
+    void addDate(const std::string& fmt);
+
+    // append the DATE instruction covering m_dateProgram[begin, end)
+    void addDateSegment(size_t begin);
+
+    // render a DATE instruction, cached per thread until the second changes
+    void formatDate(std::string& out, const Instruction& ins, const LogEvent::ptr& event);
+
 private:
     std::string m_pattern;                // format event according to pattern
-    std::vector<FormatItem::ptr> m_items; // list of base Formatitem to format each event
+    std::vector<Instruction> m_program;   // compiled pattern
+    std::vector<Instruction> m_dateProgram; // date fields referred by DATE instructions
+    uint64_t m_id;                        // unique formatter id, key of the per-thread date cache
+    uint64_t m_patternId;                 // same for every formatter of the same pattern
+    std::string m_literals;               // storage of all literal spans
+    bool m_flush = false;                 // pattern ends lines, flush ostream like std::endl did
     bool m_error = false;                 // determine current pattern is invalid
 };
 
 // Log ouput destination
 class LogAppender {
 friend class Logger;
+friend class AsyncLogAppender;
 public:
     using ptr = std::shared_ptr<LogAppender>;
     using MutexType = Spinlock;
     
     virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, const LogEvent::ptr event) = 0; // output log
 
+    // output a deferred-formatting record (see binlog.hpp), text appenders
+    // format it into an event and call log()
+    virtual void logBinary(const std::shared_ptr<Logger>& logger, const BinLogRecord& record);
+
     // output to yaml string
     virtual std::string toYamlString() = 0;
+
+    // class name as in the yaml config, for statistics
+    virtual std::string getTypeName() const { return "LogAppender"; }
+
+    // file or address written to, empty for none. fixed at construction,
+    // no lock taken
+    virtual std::string getTarget() const { return ""; }
     
     // set new formatter
     void setFormatter(LogFormatter::ptr val);
@@ -202,13 +576,25 @@ public:
     // retrieve logging level
     LogLevel::Level getLevel() const {return m_level; }
 
+    // cost counters, see LoggerManager::stats
+    const LogStats& getStats() const { return m_stats; }
+
     virtual ~LogAppender(){};
 
+protected:
+    // m_formatter->render, timed into FORMAT_NS
+    const LogEvent::Text& render(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
+                                const LogEvent::ptr& event) {
+        LogStats::Timer timer(m_stats, LogStats::FORMAT_NS);
+        return m_formatter->render(logger, level, event);
+    }
+
 protected:
     LogFormatter::ptr m_formatter;                              // format output to destination
     LogLevel::Level m_level = LogLevel::Level::DEBUG;           // Minimum level of Log the Appender can process
     bool m_hasFormatter = false;                                // Appender has its own formatter, not using logger formatter
     MutexType m_mutex;
+    LogStats m_stats;
 };
 
 // Logger
@@ -217,10 +603,18 @@ class Logger : public std::enable_shared_from_this<Logger> {
 public:
     using ptr = std::shared_ptr<Logger>;
     using MutexType = Spinlock;
+    using AppenderList = std::vector<LogAppender::ptr>;
 
     Logger(const std::string& name = "root");
 
-    void log(LogLevel::Level level, const LogEvent::ptr event); // use appender to output log
+    void log(LogLevel::Level level, const LogEvent::ptr& event); // use appender to output log
+
+    void logBinary(const BinLogRecord& record); // output a SERVER_LOG_BIN_* record
+
+    // output without checking the logger level, the SERVER_LOG_* macros
+    // already did it (and may have been switched on per call site)
+    void dispatch(LogLevel::Level level, const LogEvent::ptr& event);
+    void dispatchBinary(const BinLogRecord& record);
 
     void debug(LogEvent::ptr event);
     void info(LogEvent::ptr event);
@@ -235,9 +629,20 @@ public:
 
     const std::string& getName() const { return m_name; };
 
-    LogLevel::Level getLevel() const { return m_level; };
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); };
+
+    void setLevel(LogLevel::Level val);
+
+    // keep events at or above level in the flight recorder, even the ones
+    // below the logger level which are not output
+    void setRecorder(bool enabled, LogLevel::Level level = LogLevel::Level::DEBUG);
+
+    bool isRecording() const { return m_recording.load(std::memory_order_relaxed); };
+
+    LogLevel::Level getRecordLevel() const { return m_recordLevel.load(std::memory_order_relaxed); };
 
-    void setLevel(LogLevel::Level val) { m_level = val; };
+    // lowest level any statement of this logger is captured at
+    LogLevel::Level getThreshold() const { return m_threshold.load(std::memory_order_relaxed); };
 
     void setFormatter(const std::string& val);
     void setFormatter(LogFormatter::ptr val);
@@ -246,51 +651,265 @@ public:
 
     std::string toYamlString();
 
+    // events accepted and filtered by the logger level
+    const LogStats& getStats() const { return m_stats; }
+
 private:
     std::string m_name;                         // logger name
-    LogLevel::Level m_level;                    // minimum Level of Log which can be processed by Logger
-    MutexType m_mutex;
-    std::list<LogAppender::ptr> m_appenders;    // a list of appenders to output log, we can customize appenders to output to different position
+    std::atomic<LogLevel::Level> m_level;       // minimum Level of Log which can be processed by Logger
+    std::atomic<bool> m_recording{ false };     // feed the flight recorder
+    std::atomic<LogLevel::Level> m_recordLevel{ LogLevel::Level::DEBUG };
+    std::atomic<LogLevel::Level> m_threshold;   // min of m_level and m_recordLevel (if recording)
+    MutexType m_mutex;                          // serialize changes, logging only loads the snapshot
+    // appenders to output log, an immutable list replaced as a whole on every change
+    std::atomic<std::shared_ptr<const AppenderList>> m_appenders;
     LogFormatter::ptr m_formatter;              // when the added formatter is not set properly, assign logger formatter to it
     Logger::ptr m_root;
+    LogStats m_stats;
+};
+
+// When a BufferedLogAppender writes its buffered lines out, any condition
+// that holds triggers a flush
+struct LogFlushPolicy {
+    bool line = true;                   // every line, the default
+    uint64_t bytes = 0;                 // buffered bytes reach this size (64KB if 0)
+    uint32_t interval = 0;              // milliseconds since the last flush, 0 disables
+    LogLevel::Level level = LogLevel::Level::UNKNOWN;   // event at or above level, UNKNOWN disables
+
+    static constexpr uint64_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+    bool operator==(const LogFlushPolicy& oth) const {
+        return line == oth.line
+            && bytes == oth.bytes
+            && interval == oth.interval
+            && level == oth.level;
+    }
+};
+
+// node["flush"] of an appender, nothing if policy is the default of the appender
+void FlushPolicyToYaml(YAML::Node& node, const LogFlushPolicy& policy,
+                        const LogFlushPolicy& defaults = LogFlushPolicy());
+
+// Output to a file descriptor through a user space buffer, the buffer and
+// the current line go out together in one writev when the policy says so
+class BufferedLogAppender : public LogAppender {
+public:
+    using ptr = std::shared_ptr<BufferedLogAppender>;
+
+    ~BufferedLogAppender();
+
+    void setFlushPolicy(const LogFlushPolicy& policy);
+    LogFlushPolicy getFlushPolicy();
+
+    // write the buffered lines now
+    void flush();
+
+    // flush if the interval of the policy passed, called by the flusher thread
+    void flushIfDue(uint64_t nowNs);
+
+protected:
+    // buffer or write one formatted line
+    void writeNoLock(const std::string& text, LogLevel::Level level, uint64_t nowNs);
+
+    // a record was appended to m_buffer, write it out if the policy says so
+    void appendedNoLock(LogLevel::Level level, uint64_t nowNs);
+
+    // no more interval flushes, call it before closing m_fd in a destructor
+    void stopFlusher();
+
+    // write the buffer followed by tail (if any)
+    void flushNoLock(const std::string* tail = nullptr);
+
+private:
+    // true if size bytes to write, or the event, trigger the policy
+    bool dueNoLock(uint64_t size, LogLevel::Level level, uint64_t nowNs) const;
+
+protected:
+    int m_fd = -1;
+    LogFlushPolicy m_flushPolicy;
+    std::string m_buffer;           // lines not written yet
+    uint64_t m_lastFlush = 0;       // nanoseconds
 };
 
 // Output to console
-class StdoutLogAppender : public LogAppender {
+class StdoutLogAppender : public BufferedLogAppender {
 public:
     using ptr = std::shared_ptr<StdoutLogAppender>;
+
+    StdoutLogAppender();
+
     virtual void log (Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
     virtual std::string toYamlString() override;
+    std::string getTypeName() const override { return "StdoutLogAppender"; }
 };
 
 // Output to file
-class FileLogAppender : public LogAppender {
+class FileLogAppender : public BufferedLogAppender {
 public:
     using ptr = std::shared_ptr<FileLogAppender>;
 
     FileLogAppender(const std::string& filename);
+    ~FileLogAppender();
 
     void log (Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
     std::string toYamlString() override;
+    std::string getTypeName() const override { return "FileLogAppender"; }
+    std::string getTarget() const override { return m_filename; }
     bool reopen ();             // if the output file is opened, close and open it
 
+    // maintain a time index "<file>.idx" with one entry per bucket seconds, 0 disables
+    void setIndex(uint32_t bucket);
+    uint32_t getIndex() const { return m_indexBucket; }
+
+private:
+    // open m_filename again, m_mutex held, the buffer is not flushed
+    bool reopenNoLock();
+
 private:
     std::string m_filename;     // opened file
-    std::ofstream m_filestream; // file stream binded to opened file
-    uint64_t m_lastTime = 0;
+    std::atomic<uint64_t> m_lastTime{ 0 };  // last check whether the file was moved
+    uint64_t m_offset = 0;      // file size once the buffer is written
+    uint64_t m_inode = 0;       // a new inode means the file was rotated away
+    uint32_t m_indexBucket = 0;
+    LogIndexWriter m_index;
 };  
 
 /* add more customized appender below */
 
-// Mangger to store all loggers, we can retrieve logger from Mangager
+// Output through a wrapped appender on a background thread, callers only
+// push the event into a queue, the writer thread drains it in batches.
+// Events queue in one bounded lane per severity class and the writer
+// always drains the ERROR lane first, so a flood of DEBUG/INFO lines can
+// neither delay nor evict an ERROR or FATAL line. Events of different
+// lanes may therefore be written out of order.
+class AsyncLogAppender : public LogAppender {
+public:
+    using ptr = std::shared_ptr<AsyncLogAppender>;
+    using QueueMutexType = Mutex;
+
+    // policy applied when a lane reaches its capacity
+    enum class OverflowPolicy {
+        BLOCK            = 0,   // wait until the writer thread takes events
+        DROP_NEWEST      = 1,   // discard the incoming event
+        DROP_DEBUG_FIRST = 2,   // discard in the DEBUG lane, block in the others
+        DROP_OLDEST      = 3    // evict the oldest event of the lane
+    };
+
+    // severity classes, in draining order
+    enum Lane {
+        LANE_ERROR = 0,     // ERROR and FATAL, never dropped, producers block
+        LANE_INFO  = 1,     // INFO and WARN
+        LANE_DEBUG = 2,
+        LANE_COUNT = 3
+    };
+
+    struct LaneOptions {
+        uint32_t capacity = 8192;
+        OverflowPolicy overflow = OverflowPolicy::BLOCK;
+
+        bool operator==(const LaneOptions& oth) const {
+            return capacity == oth.capacity && overflow == oth.overflow;
+        }
+    };
+    using LaneOptionsList = std::array<LaneOptions, LANE_COUNT>;
+
+    static const char* ToString(OverflowPolicy policy);
+    static OverflowPolicy FromString(const std::string& str);
+    static const char* ToString(Lane lane);
+    static Lane LaneOf(LogLevel::Level level);
+
+    // every lane holds capacity events, policy applies to the INFO and DEBUG lanes
+    static LaneOptionsList DefaultLanes(size_t capacity = 8192,
+                                        OverflowPolicy policy = OverflowPolicy::BLOCK);
+
+    AsyncLogAppender(LogAppender::ptr appender, size_t capacity = 8192,
+                    OverflowPolicy policy = OverflowPolicy::BLOCK);
+    AsyncLogAppender(LogAppender::ptr appender, const LaneOptionsList& lanes);
+    ~AsyncLogAppender();
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+    std::string getTypeName() const override { return "AsyncLogAppender"; }
+
+    // wait until all events accepted so far are written by the wrapped appender
+    void flush();
+
+    // drain remaining events and join the writer thread
+    void stop();
+
+    LogAppender::ptr getAppender() const { return m_appender; }
+    const LaneOptions& getLaneOptions(Lane lane) const { return m_lanes[lane].options; }
+
+    // number of events discarded by the overflow policies
+    uint64_t getDropped() const;
+    uint64_t getDropped(Lane lane) const { return m_lanes[lane].dropped; }
+
+private:
+    // writer thread entry
+    void run();
+
+private:
+    struct Entry {
+        Logger::ptr logger;
+        LogLevel::Level level;
+        LogEvent::ptr event;
+    };
+
+    // bounded ring of one lane, allocated once
+    struct Queue {
+        LaneOptions options;
+        std::vector<Entry> ring;
+        size_t head = 0;
+        size_t size = 0;
+        std::atomic<uint64_t> dropped{ 0 };
+    };
+
+    LogAppender::ptr m_appender;            // appender doing the real output
+
+    QueueMutexType m_queueMutex;            // protects the lanes and counters below
+    std::condition_variable_any m_notEmpty; // writer waits for events
+    std::condition_variable_any m_notFull;  // producers wait for space (BLOCK policy)
+    std::condition_variable_any m_drained;  // flush() waits for the writer
+    Queue m_lanes[LANE_COUNT];
+    size_t m_pending = 0;                   // events in all lanes
+    std::vector<Entry> m_back;              // batch drained by writer thread
+    uint64_t m_accepted = 0;                // events pushed into a lane
+    uint64_t m_written = 0;                 // events handed to wrapped appender
+    bool m_stopping = false;
+
+    Thread::ptr m_thread;
+};
+
+// Counters of a logger and of its appenders at one point in time
+struct LoggerStats {
+    struct Appender {
+        std::string type;           // "FileLogAppender", ...
+        std::string target;         // file or address, empty for stdout
+        LogStats::Snapshot counters;
+    };
+
+    std::string name;
+    LogStats::Snapshot counters;
+    std::vector<Appender> appenders;    // a wrapped appender follows its AsyncLogAppender
+};
+
+// Mangger to store all loggers, we can retrieve logger from Mangager.
+// Loggers are never removed, so lookups run on an open addressing table
+// without any lock: a new logger is written into a free slot before it is
+// published, a full table is copied into a bigger one and the old one is
+// kept alive (readers may still be probing it) until the manager dies
 class LoggerManager {
 public:
-    // Use Spinock in LogMgr
+    // Use Spinock in LogMgr, only taken to create a logger
     using MutexType = Spinlock;
     LoggerManager();
 
-    // get a customized logger
-    Logger::ptr getLogger(const std::string& name);
+    // get a customized logger, created on first use, the reference stays
+    // valid as long as the manager
+    const Logger::ptr& getLogger(const std::string& name);
+
+    // lookup only, nullptr if there is no such logger
+    const Logger::ptr* findLogger(std::string_view name) const;
 
     // retrieve a default logger
     Logger::ptr getRoot() const { return m_root; };
@@ -303,9 +922,36 @@ public:
 
     std::string toYamlString ();
 
+    // counters of every logger with events or appenders
+    std::vector<LoggerStats> stats();
+
+    // stats() as a yaml sequence or a json array
+    std::string statsToYamlString();
+    std::string statsToJsonString();
+
+private:
+    struct Slot {
+        size_t hash = 0;
+        std::atomic<const Logger::ptr*> logger{ nullptr };   // published after hash
+        const std::string* name = nullptr;                   // label, the logger name by default
+    };
+
+    struct Table {
+        Table(size_t capacity): mask{ capacity - 1 }, slots{ new Slot[capacity] } {}
+
+        size_t mask;
+        size_t size = 0;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    const Logger::ptr& insertNoLock(const std::string& name, const Logger::ptr& logger);
+
 private:
     MutexType m_mutex;
-    std::map<std::string, Logger::ptr> m_loggers;
+    std::deque<Logger::ptr> m_loggers;                  // stable storage of all loggers
+    std::deque<std::string> m_names;                    // stable storage of their labels
+    std::atomic<const Table*> m_table{ nullptr };       // current lookup table
+    std::vector<std::unique_ptr<Table>> m_tables;       // every table ever published
 
     // default logger
     Logger::ptr m_root;
@@ -313,6 +959,59 @@ private:
 
 using LoggerMgr = Server::Singleton<LoggerManager>;
 
+// A logger resolved once, meant for statics:
+//   static Server::LoggerHandle g_logger("system");
+//   SERVER_LOG_INFO(g_logger) << "...";
+// checking the level is a load of the cached pointer and the level
+class LoggerHandle {
+public:
+    LoggerHandle(const std::string& name)
+        : m_ptr{ &LoggerMgr::getInstance()->getLogger(name) },
+        m_logger{ m_ptr->get() } {}
+
+    Logger* operator->() const { return m_logger; }
+    operator const Logger::ptr&() const { return *m_ptr; }
+    const Logger::ptr& get() const { return *m_ptr; }
+
+private:
+    const Logger::ptr* m_ptr;
+    Logger* m_logger;
+};
+
+// Registry of reached call sites and the rules switching them on,
+// a rule is "file" (every statement of the file) or "file:line", and file
+// may be any path suffix, e.g. "scheduler.cpp:42" or "source/fiber.cpp"
+class LogCallSiteManager {
+public:
+    using MutexType = Spinlock;
+
+    // replace all rules, registered sites are updated right away
+    void setRules(const std::set<std::string>& rules);
+
+    // register a site reached for the first time, return its state
+    uint8_t add(LogCallSite* site);
+
+    // "file:line" of every registered site switched on
+    std::vector<std::string> getEnabled();
+
+    // remember where a limited site reports, the first time after a summary
+    void track(LogLimitedSite* site, const std::shared_ptr<Logger>& logger, LogLevel::Level level);
+
+    // report the pending counts of limited sites, called by the log flusher
+    void flushSummaries();
+
+private:
+    bool match(const LogCallSite* site) const;
+
+private:
+    MutexType m_mutex;
+    std::vector<std::pair<std::string, int32_t>> m_rules;   // line 0 matches whole file
+    LogCallSite* m_sites = nullptr;
+    LogLimitedSite* m_limited = nullptr;                    // only ever grows
+};
+
+using LogCallSiteMgr = Server::Singleton<LogCallSiteManager>;
+
 } // namespace Server
 
 #endif
\ No newline at end of file
@@ -0,0 +1,417 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include "logfile.hpp"
+#include "config.hpp"
+
+namespace Server {
+
+// open (or create) a file and map at least capacity bytes of it,
+// an existing file continues after its last non zero byte
+static bool MapSegment(const std::string& path, uint64_t capacity, LogSegment& seg) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "RollingFileLogAppender open " << path << " failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    uint64_t size = st.st_size;
+    capacity = std::max<uint64_t>(capacity, size);
+    if (capacity == 0) {
+        close(fd);
+        return false;
+    }
+
+    // reserve the blocks up front, a full disk must not SIGBUS the writer
+    int rt = posix_fallocate(fd, 0, capacity);
+    if (rt != 0 && ftruncate(fd, capacity) != 0) {
+        std::cout << "RollingFileLogAppender allocate " << path << " failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cout << "RollingFileLogAppender mmap " << path << " failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    seg.fd = fd;
+    seg.data = (char*)data;
+    seg.capacity = capacity;
+    seg.offset = size;
+    while (seg.offset > 0 && seg.data[seg.offset - 1] == 0) {
+        --seg.offset;
+    }
+    return true;
+}
+
+// unmap and cut the zero padding off
+static void UnmapSegment(LogSegment& seg) {
+    if (seg.fd < 0) {
+        return;
+    }
+    munmap(seg.data, seg.capacity);
+    if (ftruncate(seg.fd, seg.offset) != 0) {
+        std::cout << "RollingFileLogAppender truncate failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+    }
+    close(seg.fd);
+    seg = LogSegment();
+}
+
+RollingFileLogAppender::RollingFileLogAppender(const std::string& filename,
+                                               const RollingFileOptions& options)
+    : m_filename{ filename },
+    m_nextName{ filename + ".next" },
+    m_options{ options } {
+    m_options.maxSize = std::max<uint64_t>(m_options.maxSize, 4096);
+
+    recover();
+
+    uint64_t now = time(0);
+    MapSegment(m_filename, m_options.maxSize, m_cur);
+    m_cur.start = now;
+    updateRollTime(now);
+
+    m_thread = std::make_shared<Thread>(std::bind(&RollingFileLogAppender::run, this), "log_roll");
+};
+
+RollingFileLogAppender::~RollingFileLogAppender() {
+    {
+        JobMutexType::Lock lock(m_jobMutex);
+        m_stopping = true;
+    }
+    m_jobCond.notify_all();
+    if (m_thread) {
+        m_thread->join();
+    }
+
+    MutexType::Lock lock(m_mutex);
+    UnmapSegment(m_cur);
+    if (m_next.fd >= 0) {
+        bool empty = m_next.offset == 0;
+        UnmapSegment(m_next);
+        if (empty) {
+            unlink(m_nextName.c_str());
+        }
+    }
+};
+
+void RollingFileLogAppender::recover() {
+    // a crash between rotation and the rename leaves the active segment at
+    // <file>.next, an empty (zero filled) one can simply be reused
+    int fd = open(m_nextName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    char c = 0;
+    bool empty = read(fd, &c, 1) != 1 || c == 0;
+    close(fd);
+    if (empty) {
+        return;
+    }
+
+    struct stat st;
+    if (stat(m_filename.c_str(), &st) == 0) {
+        LogSegment old;
+        if (MapSegment(m_filename, 0, old)) {
+            UnmapSegment(old);      // drop the zero padding
+        }
+        rename(m_filename.c_str(), archiveName(st.st_mtime).c_str());
+    }
+    LogSegment active;
+    if (MapSegment(m_nextName, 0, active)) {
+        UnmapSegment(active);
+    }
+    rename(m_nextName.c_str(), m_filename.c_str());
+};
+
+void RollingFileLogAppender::updateRollTime(uint64_t now) {
+    m_rollTime = m_options.interval ? (now / m_options.interval + 1) * m_options.interval : 0;
+};
+
+void RollingFileLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        return;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    const std::string& text = *render(logger, level, event);
+    LogStats::Timer timer(m_stats, LogStats::IO_NS);
+    append(text.data(), text.size(), event->getTime());
+};
+
+void RollingFileLogAppender::append(const char* data, size_t len, uint64_t now) {
+    bool full = m_cur.offset + len > m_options.maxSize;
+    bool expired = m_rollTime && now >= m_rollTime;
+    if ((full || expired) && m_cur.offset > 0 && m_next.fd >= 0) {
+        rollNoLock(now);
+    } else if (expired && m_cur.offset == 0) {
+        updateRollTime(now);    // nothing written during the interval, keep the segment
+    }
+
+    if (m_cur.fd < 0) {
+        return;
+    }
+
+    // next segment not ready yet (or a huge line), let the current one grow
+    if (m_cur.offset + len > m_cur.capacity && !growNoLock(len)) {
+        return;
+    }
+
+    memcpy(m_cur.data + m_cur.offset, data, len);
+    m_cur.offset += len;
+};
+
+void RollingFileLogAppender::rollNoLock(uint64_t now) {
+    {
+        JobMutexType::Lock lock(m_jobMutex);
+        m_finished.push_back(m_cur);
+    }
+
+    m_cur = m_next;
+    m_cur.start = now;
+    m_next = LogSegment();
+    updateRollTime(now);
+
+    m_jobCond.notify_one();
+};
+
+bool RollingFileLogAppender::growNoLock(size_t len) {
+    uint64_t capacity = std::max(m_cur.capacity * 2, m_cur.offset + len);
+    if (ftruncate(m_cur.fd, capacity) != 0) {
+        return false;
+    }
+
+    void* data = mremap(m_cur.data, m_cur.capacity, capacity, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    m_cur.data = (char*)data;
+    m_cur.capacity = capacity;
+    return true;
+};
+
+void RollingFileLogAppender::rotate() {
+    MutexType::Lock lock(m_mutex);
+    if (m_cur.offset > 0 && m_next.fd >= 0) {
+        rollNoLock(time(0));
+    }
+};
+
+void RollingFileLogAppender::flush() {
+    MutexType::Lock lock(m_mutex);
+    if (m_cur.fd >= 0) {
+        LogStats::Timer timer(m_stats, LogStats::IO_NS);
+        msync(m_cur.data, m_cur.offset, MS_SYNC);
+        m_stats.add(LogStats::FLUSHES);
+    }
+};
+
+std::string RollingFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "RollingFileLogAppender";
+    node["file"] = m_filename;
+    node["rolling"]["max_size"] = m_options.maxSize;
+    node["rolling"]["interval"] = m_options.interval;
+    node["rolling"]["max_files"] = m_options.maxFiles;
+    node["rolling"]["compress"] = m_options.compress;
+    node["rolling"]["suffix"] = m_options.suffix;
+
+    if (m_level != LogLevel::Level::UNKNOWN) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+
+    if (m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+};
+
+void RollingFileLogAppender::run() {
+    while (true) {
+        // keep a mapped segment ready, so rotation is a swap on the hot path
+        bool ready;
+        {
+            MutexType::Lock lock(m_mutex);
+            ready = m_next.fd >= 0;
+        }
+        if (!ready && !m_stalled) {
+            LogSegment next;
+            if (MapSegment(m_nextName, m_options.maxSize, next)) {
+                MutexType::Lock lock(m_mutex);
+                m_next = next;
+            }
+        }
+
+        std::vector<LogSegment> finished;
+        {
+            JobMutexType::Lock lock(m_jobMutex);
+            while (m_finished.empty() && !m_stopping) {
+                m_jobCond.wait(lock);
+            }
+            if (m_finished.empty()) {
+                break;
+            }
+            finished.swap(m_finished);
+        }
+
+        for (auto& i : finished) {
+            finish(i);
+        }
+        retain();
+    }
+};
+
+void RollingFileLogAppender::finish(LogSegment& segment) {
+    uint64_t start = segment.start;
+    UnmapSegment(segment);
+
+    // the finished segment is still named <file>, the active one <file>.next
+    std::string archive = archiveName(start);
+    bool archived = rename(m_filename.c_str(), archive.c_str()) == 0;
+    if (!archived) {
+        std::cout << "RollingFileLogAppender rename " << m_filename << " failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+    }
+
+    if (rename(m_nextName.c_str(), m_filename.c_str()) != 0) {
+        // the active segment keeps the .next name, stop preparing new ones
+        std::cout << "RollingFileLogAppender rename " << m_nextName << " failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+        m_stalled = true;
+    }
+
+    if (archived && m_options.compress) {
+        compress(archive);
+    }
+};
+
+std::string RollingFileLogAppender::archiveName(uint64_t start) {
+    time_t t = start;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char buf[128];
+    size_t n = strftime(buf, sizeof(buf), m_options.suffix.c_str(), &tm);
+
+    std::string base = m_filename + "." + std::string(buf, n);
+    std::string name = base;
+    struct stat st;
+    for (int i = 1; stat(name.c_str(), &st) == 0 || stat((name + ".gz").c_str(), &st) == 0; ++i) {
+        name = base + "." + std::to_string(i);
+    }
+    return name;
+};
+
+void RollingFileLogAppender::compress(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    std::string gzPath = path + ".gz";
+    gzFile gz = gzopen(gzPath.c_str(), "wb");
+    if (!gz) {
+        close(fd);
+        return;
+    }
+
+    char buf[64 * 1024];
+    bool ok = true;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (gzwrite(gz, buf, n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    ok = gzclose(gz) == Z_OK && ok && n == 0;
+    close(fd);
+
+    // keep the plain file if anything went wrong
+    unlink(ok ? path.c_str() : gzPath.c_str());
+};
+
+// name (without "<file>.") is one archiveName made: <suffix>[.N][.gz]
+static bool IsArchiveName(std::string name, const std::string& suffix) {
+    if (name.size() > 3 && name.compare(name.size() - 3, 3, ".gz") == 0) {
+        name.resize(name.size() - 3);
+    }
+
+    auto matches = [&suffix](const std::string& str) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(str.c_str(), suffix.c_str(), &tm);
+        return end && *end == '\0';
+    };
+    if (matches(name)) {
+        return true;
+    }
+
+    // a second archive of the same second
+    size_t dot = name.rfind('.');
+    return dot != std::string::npos && dot + 1 < name.size()
+        && name.find_first_not_of("0123456789", dot + 1) == std::string::npos
+        && matches(name.substr(0, dot));
+};
+
+void RollingFileLogAppender::retain() {
+    if (m_options.maxFiles == 0) {
+        return;
+    }
+
+    std::string path = m_filename;
+    std::string dir = dirname(&path[0]);
+    path = m_filename;
+    std::string prefix = std::string(basename(&path[0])) + ".";
+
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+
+    // finished segments, oldest first. other files next to the log
+    // (<file>.next, <file>.idx, backups, ...) are never touched
+    std::vector<std::pair<time_t, std::string>> files;
+    while (struct dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.compare(0, prefix.size(), prefix) != 0
+            || !IsArchiveName(name.substr(prefix.size()), m_options.suffix)) {
+            continue;
+        }
+        std::string full = dir + "/" + name;
+        struct stat st;
+        if (stat(full.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            files.emplace_back(st.st_mtime, full);
+        }
+    }
+    closedir(d);
+
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i + m_options.maxFiles < files.size(); ++i) {
+        unlink(files[i].second.c_str());
+    }
+};
+
+}
@@ -0,0 +1,102 @@
+#ifndef __SERVER_LOGFILE_HPP__
+#define __SERVER_LOGFILE_HPP__
+
+#include <string>
+#include <vector>
+#include <condition_variable>
+
+#include "log.hpp"
+#include "mutex.hpp"
+#include "thread.hpp"
+
+namespace Server {
+
+// Rotation settings of RollingFileLogAppender
+struct RollingFileOptions {
+    uint64_t maxSize = 64 * 1024 * 1024;    // segment size in bytes, rotate when full
+    uint32_t interval = 0;                  // rotate every interval seconds (aligned to epoch), 0 disables
+    uint32_t maxFiles = 0;                  // finished segments kept, 0 keeps all
+    bool compress = false;                  // gzip finished segments
+    std::string suffix = "%Y%m%d-%H%M%S";   // strftime pattern appended to finished segments
+
+    bool operator==(const RollingFileOptions& oth) const {
+        return maxSize == oth.maxSize
+            && interval == oth.interval
+            && maxFiles == oth.maxFiles
+            && compress == oth.compress
+            && suffix == oth.suffix;
+    }
+};
+
+// A memory mapped log file
+struct LogSegment {
+    int fd = -1;
+    char* data = nullptr;
+    uint64_t capacity = 0;      // mapped bytes
+    uint64_t offset = 0;        // bytes written
+    uint64_t start = 0;         // time the segment became active
+};
+
+// Append log lines into a pre-allocated memory mapped segment. When the
+// segment is full (or the interval passed) it switches to the next segment
+// prepared by a background thread, which also renames the finished one to
+// "<file>.<suffix>", compresses it and removes old ones. The hot path only
+// copies bytes, it never opens or closes a file.
+//
+// The active segment is zero padded until it is finished.
+class RollingFileLogAppender : public LogAppender {
+public:
+    using ptr = std::shared_ptr<RollingFileLogAppender>;
+    using JobMutexType = Mutex;
+
+    RollingFileLogAppender(const std::string& filename,
+                           const RollingFileOptions& options = RollingFileOptions());
+    ~RollingFileLogAppender();
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+    std::string getTypeName() const override { return "RollingFileLogAppender"; }
+    std::string getTarget() const override { return m_filename; }
+
+    // finish the current segment now (if the next one is ready)
+    void rotate();
+
+    // write dirty pages of the current segment to disk
+    void flush();
+
+    const std::string& getFilename() const { return m_filename; }
+    const RollingFileOptions& getOptions() const { return m_options; }
+
+private:
+    void append(const char* data, size_t len, uint64_t now);
+    void rollNoLock(uint64_t now);
+    bool growNoLock(size_t len);
+    void updateRollTime(uint64_t now);
+    void recover();
+
+    // background thread
+    void run();
+    void finish(LogSegment& segment);
+    std::string archiveName(uint64_t start);
+    void compress(const std::string& path);
+    void retain();
+
+private:
+    std::string m_filename;
+    std::string m_nextName;                 // "<file>.next", where the next segment is prepared
+    RollingFileOptions m_options;
+    LogSegment m_cur;
+    LogSegment m_next;                      // ready to use if fd >= 0
+    uint64_t m_rollTime = 0;                // time based rotation deadline, 0 if disabled
+
+    JobMutexType m_jobMutex;
+    std::condition_variable_any m_jobCond;
+    std::vector<LogSegment> m_finished;     // handed over to the background thread
+    bool m_stopping = false;
+    bool m_stalled = false;                 // renaming failed, no more segments are prepared
+    Thread::ptr m_thread;
+};
+
+}
+
+#endif
@@ -0,0 +1,186 @@
+#include <charconv>
+
+#include "logfmt.hpp"
+#include "log.hpp"
+
+namespace Server {
+
+// write s padded to the field width, numbers are right aligned by default
+// and zero padded after their sign / base prefix if asked to
+static void Pad(LogStreamBuf& buf, const LogFormatSpec& spec, const char* s, size_t n,
+                bool numeric, size_t prefix = 0) {
+    if (spec.width <= n) {
+        buf.append(s, n);
+        return;
+    }
+
+    size_t fill = spec.width - n;
+    if (numeric && spec.zero && spec.align == 0) {
+        buf.append(s, prefix);
+        buf.fill('0', fill);
+        buf.append(s + prefix, n - prefix);
+    } else if (spec.align == '<' || (spec.align == 0 && !numeric)) {
+        buf.append(s, n);
+        buf.fill(' ', fill);
+    } else {
+        buf.fill(' ', fill);
+        buf.append(s, n);
+    }
+}
+
+static void WriteInteger(LogStreamBuf& buf, const LogFormatSpec& spec, uint64_t magnitude, bool negative) {
+    if (spec.type == 'c') {
+        char c = (char)magnitude;
+        Pad(buf, spec, &c, 1, false);
+        return;
+    }
+
+    char tmp[72];
+    char* p = tmp;
+    if (negative) {
+        *p++ = '-';
+    }
+
+    int base = 10;
+    switch (spec.type) {
+        case 'x':
+        case 'X':
+            base = 16;
+            break;
+        case 'o':
+            base = 8;
+            break;
+        case 'b':
+            base = 2;
+            break;
+    }
+
+    char* digits = p;
+    p = std::to_chars(p, tmp + sizeof(tmp), magnitude, base).ptr;
+    if (spec.type == 'X') {
+        for (char* c = digits; c < p; ++c) {
+            *c = toupper(*c);
+        }
+    }
+    Pad(buf, spec, tmp, p - tmp, true, negative ? 1 : 0);
+}
+
+static void WriteDouble(LogStreamBuf& buf, const LogFormatSpec& spec, double v) {
+    char tmp[512];
+    std::to_chars_result r;
+    std::chars_format format = std::chars_format::general;
+    switch (spec.type) {
+        case 'f':
+        case 'F':
+            format = std::chars_format::fixed;
+            break;
+        case 'e':
+        case 'E':
+            format = std::chars_format::scientific;
+            break;
+    }
+
+    if (spec.precision >= 0) {
+        r = std::to_chars(tmp, tmp + sizeof(tmp), v, format, spec.precision);
+    } else if (spec.type) {
+        r = std::to_chars(tmp, tmp + sizeof(tmp), v, format, 6);
+    } else {
+        r = std::to_chars(tmp, tmp + sizeof(tmp), v);      // shortest round trip
+    }
+    if (r.ec != std::errc()) {
+        buf.append("(float)", 7);
+        return;
+    }
+
+    if (spec.type == 'F' || spec.type == 'E' || spec.type == 'G') {
+        for (char* c = tmp; c < r.ptr; ++c) {
+            *c = toupper(*c);
+        }
+    }
+    Pad(buf, spec, tmp, r.ptr - tmp, true, tmp[0] == '-' ? 1 : 0);
+}
+
+void LogFormat::Write(LogStreamBuf& buf, const LogFormatSpec& spec, const LogFormatValue& value) {
+    switch (value.kind) {
+        case LogFormatValue::INT:
+            WriteInteger(buf, spec, value.i < 0 ? 0 - (uint64_t)value.i : value.i, value.i < 0);
+            break;
+        case LogFormatValue::UINT:
+            WriteInteger(buf, spec, value.u, false);
+            break;
+        case LogFormatValue::CHAR:
+            if (spec.type && spec.type != 'c') {
+                WriteInteger(buf, spec, (unsigned char)value.c, false);
+            } else {
+                Pad(buf, spec, &value.c, 1, false);
+            }
+            break;
+        case LogFormatValue::DOUBLE:
+            WriteDouble(buf, spec, value.d);
+            break;
+        case LogFormatValue::BOOL:
+            if (spec.type == 'd') {
+                WriteInteger(buf, spec, value.b, false);
+            } else {
+                Pad(buf, spec, value.b ? "true" : "false", value.b ? 4 : 5, false);
+            }
+            break;
+        case LogFormatValue::STRING: {
+            size_t n = value.s.size;
+            if (spec.precision >= 0 && (size_t)spec.precision < n) {
+                n = spec.precision;
+            }
+            Pad(buf, spec, value.s.data, n, false);
+            break;
+        }
+        case LogFormatValue::POINTER: {
+            char tmp[20] = { '0', 'x' };
+            char* p = std::to_chars(tmp + 2, tmp + sizeof(tmp), (uintptr_t)value.p, 16).ptr;
+            Pad(buf, spec, tmp, p - tmp, true, 2);
+            break;
+        }
+        case LogFormatValue::CUSTOM: {
+            // width and precision do not apply, the type prints itself
+            std::ostream os(&buf);
+            value.custom.write(os, value.custom.value);
+            break;
+        }
+    }
+};
+
+void LogFormat::Run(LogStreamBuf& buf, std::string_view fmt, const LogFormatValue* values, size_t count) {
+    size_t arg = 0;
+    size_t literal = 0;     // start of the pending literal text
+    for (size_t i = 0; i < fmt.size(); ) {
+        char c = fmt[i];
+        if (c != '{' && c != '}') {
+            ++i;
+            continue;
+        }
+
+        buf.append(fmt.data() + literal, i - literal);
+        if (i + 1 < fmt.size() && fmt[i + 1] == c) {
+            // "{{" or "}}"
+            buf.append(&c, 1);
+            i += 2;
+            literal = i;
+            continue;
+        }
+
+        // the literal was checked at compile time, be lenient anyway
+        LogFormatSpec spec;
+        size_t next = c == '{' ? ParseField(fmt, i, spec) : std::string_view::npos;
+        if (next == std::string_view::npos || arg >= count) {
+            literal = i;
+            ++i;
+            continue;
+        }
+
+        Write(buf, spec, values[arg++]);
+        i = next;
+        literal = i;
+    }
+    buf.append(fmt.data() + literal, fmt.size() - literal);
+};
+
+}
@@ -0,0 +1,295 @@
+#ifndef __SERVER_LOGFMT_HPP__
+#define __SERVER_LOGFMT_HPP__
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <type_traits>
+
+namespace Server {
+
+class LogStreamBuf;
+
+// Replacement field "{:[<|>][0][width][.precision][type]}" of SERVER_LOG_FORMAT_*
+//   integers: d x X o b c       floating point: f F e E g G
+//   strings:  s (precision cuts) pointers: p     bool: s d
+struct LogFormatSpec {
+    char align = 0;         // '<' or '>', 0 for the default of the argument
+    bool zero = false;      // pad numbers with '0' after the sign
+    uint32_t width = 0;
+    int32_t precision = -1;
+    char type = 0;
+};
+
+// One type erased argument, built on the stack of the logging call
+struct LogFormatValue {
+    enum Kind : uint8_t {
+        INT,
+        UINT,
+        DOUBLE,
+        BOOL,
+        CHAR,
+        STRING,
+        POINTER,
+        CUSTOM      // anything else with an operator<<
+    };
+
+    Kind kind;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        bool b;
+        char c;
+        const void* p;
+        struct {
+            const char* data;
+            size_t size;
+        } s;
+        struct {
+            const void* value;
+            void (*write)(std::ostream& os, const void* value);
+        } custom;
+    };
+};
+
+// Map an argument type to its kind, types without a specialization (and
+// without operator<<) are rejected at compile time
+template<typename T, typename = void>
+struct LogFormatArg;
+
+template<typename T>
+struct LogFormatArg<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>
+                                        && !std::is_same_v<T, char>>> {
+    static constexpr LogFormatValue::Kind KIND = std::is_signed_v<T> ? LogFormatValue::INT
+                                                                     : LogFormatValue::UINT;
+    static LogFormatValue Make(T v) {
+        LogFormatValue r{ KIND };
+        if constexpr (std::is_signed_v<T>) {
+            r.i = v;
+        } else {
+            r.u = v;
+        }
+        return r;
+    }
+};
+
+template<typename T>
+struct LogFormatArg<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static constexpr LogFormatValue::Kind KIND = LogFormatValue::DOUBLE;
+    static LogFormatValue Make(T v) {
+        LogFormatValue r{ KIND };
+        r.d = v;
+        return r;
+    }
+};
+
+template<>
+struct LogFormatArg<bool> {
+    static constexpr LogFormatValue::Kind KIND = LogFormatValue::BOOL;
+    static LogFormatValue Make(bool v) {
+        LogFormatValue r{ KIND };
+        r.b = v;
+        return r;
+    }
+};
+
+template<>
+struct LogFormatArg<char> {
+    static constexpr LogFormatValue::Kind KIND = LogFormatValue::CHAR;
+    static LogFormatValue Make(char v) {
+        LogFormatValue r{ KIND };
+        r.c = v;
+        return r;
+    }
+};
+
+template<typename T>
+struct LogFormatArg<T, std::enable_if_t<std::is_same_v<T, const char*> || std::is_same_v<T, char*>>> {
+    static constexpr LogFormatValue::Kind KIND = LogFormatValue::STRING;
+    static LogFormatValue Make(const char* v) {
+        LogFormatValue r{ KIND };
+        r.s.data = v ? v : "(null)";
+        r.s.size = strlen(r.s.data);
+        return r;
+    }
+};
+
+template<typename T>
+struct LogFormatArg<T, std::enable_if_t<std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>>> {
+    static constexpr LogFormatValue::Kind KIND = LogFormatValue::STRING;
+    static LogFormatValue Make(std::string_view v) {
+        LogFormatValue r{ KIND };
+        r.s.data = v.data();
+        r.s.size = v.size();
+        return r;
+    }
+};
+
+template<typename T>
+struct LogFormatArg<T, std::enable_if_t<(std::is_pointer_v<T> && !std::is_same_v<T, const char*>
+                                         && !std::is_same_v<T, char*>) || std::is_null_pointer_v<T>>> {
+    static constexpr LogFormatValue::Kind KIND = LogFormatValue::POINTER;
+    static LogFormatValue Make(T v) {
+        LogFormatValue r{ KIND };
+        r.p = (const void*)v;
+        return r;
+    }
+};
+
+template<typename T>
+concept LogStreamable = requires(std::ostream& os, const T& v) { os << v; };
+
+template<typename T>
+struct LogFormatArg<T, std::enable_if_t<!std::is_arithmetic_v<T> && !std::is_pointer_v<T>
+                                        && !std::is_null_pointer_v<T> && !std::is_same_v<T, std::string>
+                                        && !std::is_same_v<T, std::string_view> && LogStreamable<T>>> {
+    static constexpr LogFormatValue::Kind KIND = LogFormatValue::CUSTOM;
+    static LogFormatValue Make(const T& v) {
+        LogFormatValue r{ KIND };
+        r.custom.value = &v;
+        r.custom.write = [](std::ostream& os, const void* value) {
+            os << *(const T*)value;
+        };
+        return r;
+    }
+};
+
+// not defined on purpose, calling it in a constant expression is the
+// compile error of a bad SERVER_LOG_FORMAT_* format string
+void LogFormatStringError(const char* reason);
+
+class LogFormat {
+public:
+    // parse the field starting at fmt[pos] == '{', return the position
+    // after its '}' or std::string_view::npos if it is malformed
+    static constexpr size_t ParseField(std::string_view fmt, size_t pos, LogFormatSpec& spec) {
+        spec = LogFormatSpec();
+        ++pos;
+        if (pos < fmt.size() && fmt[pos] == ':') {
+            ++pos;
+            if (pos < fmt.size() && (fmt[pos] == '<' || fmt[pos] == '>')) {
+                spec.align = fmt[pos++];
+            }
+            if (pos < fmt.size() && fmt[pos] == '0') {
+                spec.zero = true;
+                ++pos;
+            }
+            while (pos < fmt.size() && fmt[pos] >= '0' && fmt[pos] <= '9') {
+                spec.width = spec.width * 10 + (fmt[pos++] - '0');
+            }
+            if (pos < fmt.size() && fmt[pos] == '.') {
+                ++pos;
+                spec.precision = 0;
+                if (pos >= fmt.size() || fmt[pos] < '0' || fmt[pos] > '9') {
+                    return std::string_view::npos;
+                }
+                while (pos < fmt.size() && fmt[pos] >= '0' && fmt[pos] <= '9') {
+                    spec.precision = spec.precision * 10 + (fmt[pos++] - '0');
+                }
+            }
+            if (pos < fmt.size() && fmt[pos] != '}') {
+                spec.type = fmt[pos++];
+            }
+        }
+        if (pos >= fmt.size() || fmt[pos] != '}') {
+            return std::string_view::npos;
+        }
+        return pos + 1;
+    }
+
+    // presentation type allowed for an argument kind, 0 is the default
+    static constexpr bool Accepts(LogFormatValue::Kind kind, char type) {
+        if (type == 0) {
+            return true;
+        }
+        std::string_view types;
+        switch (kind) {
+            case LogFormatValue::INT:
+            case LogFormatValue::UINT:
+            case LogFormatValue::CHAR:      types = "dxXobc"; break;
+            case LogFormatValue::DOUBLE:    types = "fFeEgG"; break;
+            case LogFormatValue::BOOL:      types = "sd"; break;
+            case LogFormatValue::STRING:    types = "s"; break;
+            case LogFormatValue::POINTER:   types = "p"; break;
+            case LogFormatValue::CUSTOM:    break;
+        }
+        return types.find(type) != std::string_view::npos;
+    }
+
+    // compile time validation of a format string against the argument kinds
+    static consteval void Check(std::string_view fmt, const LogFormatValue::Kind* kinds, size_t count) {
+        size_t arg = 0;
+        for (size_t i = 0; i < fmt.size(); ) {
+            if (fmt[i] == '{') {
+                if (i + 1 < fmt.size() && fmt[i + 1] == '{') {
+                    i += 2;
+                    continue;
+                }
+                LogFormatSpec spec;
+                size_t next = ParseField(fmt, i, spec);
+                if (next == std::string_view::npos) {
+                    LogFormatStringError("malformed replacement field");
+                }
+                if (arg >= count) {
+                    LogFormatStringError("more replacement fields than arguments");
+                }
+                if (!Accepts(kinds[arg], spec.type)) {
+                    LogFormatStringError("presentation type does not fit the argument");
+                }
+                ++arg;
+                i = next;
+            } else if (fmt[i] == '}') {
+                if (i + 1 >= fmt.size() || fmt[i + 1] != '}') {
+                    LogFormatStringError("unmatched '}'");
+                }
+                i += 2;
+            } else {
+                ++i;
+            }
+        }
+        if (arg != count) {
+            LogFormatStringError("more arguments than replacement fields");
+        }
+    }
+
+    // append the formatted message to buf, no allocation unless the message
+    // outgrows the inline storage of buf
+    template<typename... Args>
+    static void Format(LogStreamBuf& buf, std::string_view fmt, const Args&... args) {
+        const LogFormatValue values[] = { LogFormatArg<std::decay_t<Args>>::Make(args)...,
+                                          LogFormatValue{ LogFormatValue::CUSTOM } };
+        Run(buf, fmt, values, sizeof...(Args));
+    }
+
+    static void Run(LogStreamBuf& buf, std::string_view fmt, const LogFormatValue* values, size_t count);
+
+private:
+    static void Write(LogStreamBuf& buf, const LogFormatSpec& spec, const LogFormatValue& value);
+};
+
+// Format string of SERVER_LOG_FORMAT_*, checked against the argument types
+// when it is built from a literal, like std::format_string
+template<typename... Args>
+class LogFormatString {
+public:
+    template<typename S>
+        requires std::is_convertible_v<const S&, std::string_view>
+    consteval LogFormatString(const S& s)
+        : m_str{ s } {
+        constexpr LogFormatValue::Kind kinds[] = { LogFormatArg<std::decay_t<Args>>::KIND...,
+                                                   LogFormatValue::CUSTOM };
+        LogFormat::Check(m_str, kinds, sizeof...(Args));
+    }
+
+    std::string_view get() const { return m_str; }
+
+private:
+    std::string_view m_str;
+};
+
+}
+
+#endif
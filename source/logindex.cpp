@@ -0,0 +1,189 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+#include "logindex.hpp"
+
+namespace Server {
+
+static_assert(sizeof(LogIndexEntry) == 40, "LogIndexEntry is stored as is");
+static_assert(sizeof(LogIndex::Header) == 16, "LogIndex::Header is stored as is");
+
+uint64_t LogIndex::LoggerBit(std::string_view name) {
+    return 1ull << (std::hash<std::string_view>()(name) % 64);
+};
+
+// read exactly len bytes at offset
+static bool ReadAt(int fd, void* buf, size_t len, off_t offset) {
+    char* p = (char*)buf;
+    while (len) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+};
+
+static bool WriteFull(int fd, const void* buf, size_t len) {
+    const char* p = (const char*)buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+};
+
+bool LogIndexWriter::open(const std::string& path, uint32_t bucket, uint64_t fileSize) {
+    close();
+    m_bucket = std::max<uint32_t>(bucket, 1);
+
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        std::cout << "LogIndexWriter open " << path << " failed, errno = " << errno
+                  << " " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    fstat(m_fd, &st);
+    uint64_t size = st.st_size;
+
+    // keep a matching index, drop a torn last entry
+    LogIndex::Header header;
+    bool keep = size >= sizeof(header) && ReadAt(m_fd, &header, sizeof(header), 0)
+             && memcmp(header.magic, LogIndex::MAGIC, sizeof(header.magic)) == 0
+             && header.version == LogIndex::VERSION
+             && header.bucket == m_bucket;
+    if (keep) {
+        size -= (size - sizeof(header)) % sizeof(LogIndexEntry);
+        LogIndexEntry last;
+        if (size > sizeof(header)) {
+            // the log file was truncated or replaced
+            keep = ReadAt(m_fd, &last, sizeof(last), size - sizeof(last))
+                && last.offset + last.length <= fileSize;
+        }
+    }
+
+    if (!keep) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LogIndex::MAGIC, sizeof(header.magic));
+        header.version = LogIndex::VERSION;
+        header.bucket = m_bucket;
+        size = sizeof(header);
+        if (ftruncate(m_fd, 0) || pwrite(m_fd, &header, sizeof(header), 0) != sizeof(header)) {
+            std::cout << "LogIndexWriter init " << path << " failed, errno = " << errno
+                      << " " << strerror(errno) << std::endl;
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+    }
+
+    ftruncate(m_fd, size);
+    lseek(m_fd, size, SEEK_SET);
+    m_cur = LogIndexEntry();
+    return true;
+};
+
+void LogIndexWriter::close() {
+    if (m_fd < 0) {
+        return;
+    }
+    writeEntry();
+    ::close(m_fd);
+    m_fd = -1;
+};
+
+void LogIndexWriter::add(uint64_t time, uint64_t offset, size_t len, int level,
+                         std::string_view logger) {
+    if (m_fd < 0) {
+        return;
+    }
+
+    if (m_cur.lines && (time >= m_cur.time + m_bucket
+                        || offset != m_cur.offset + m_cur.length)) {
+        // next bucket, or bytes the index did not see (written while it was off)
+        writeEntry();
+    }
+    if (!m_cur.lines) {
+        m_cur.time = std::max(time - time % m_bucket, m_cur.time);
+        m_cur.offset = offset;
+    }
+
+    m_cur.length += len;
+    ++m_cur.lines;
+    m_cur.levels |= 1u << level;
+    m_cur.loggers |= LogIndex::LoggerBit(logger);
+};
+
+void LogIndexWriter::writeEntry() {
+    if (!m_cur.lines) {
+        return;
+    }
+    if (!WriteFull(m_fd, &m_cur, sizeof(m_cur))) {
+        std::cout << "LogIndexWriter write failed, errno = " << errno
+                  << " " << strerror(errno) << std::endl;
+    }
+
+    // the next bucket never starts before this one
+    LogIndexEntry next;
+    next.time = m_cur.time;
+    m_cur = next;
+};
+
+bool LogIndexReader::open(const std::string& path) {
+    m_entries.clear();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    LogIndex::Header header;
+    bool ok = (uint64_t)st.st_size >= sizeof(header) && ReadAt(fd, &header, sizeof(header), 0)
+           && memcmp(header.magic, LogIndex::MAGIC, sizeof(header.magic)) == 0
+           && header.version == LogIndex::VERSION;
+    if (ok) {
+        m_bucket = header.bucket;
+        m_entries.resize((st.st_size - sizeof(header)) / sizeof(LogIndexEntry));
+        ok = m_entries.empty() || ReadAt(fd, m_entries.data(),
+                                         m_entries.size() * sizeof(LogIndexEntry), sizeof(header));
+    }
+    ::close(fd);
+    return ok;
+};
+
+std::pair<size_t, size_t> LogIndexReader::find(uint64_t from, uint64_t to) const {
+    // entries before first only hold lines older than from
+    auto first = std::partition_point(m_entries.begin(), m_entries.end(),
+                    [&](const LogIndexEntry& e) { return e.time + m_bucket <= from; });
+    auto last = std::partition_point(first, m_entries.end(),
+                    [&](const LogIndexEntry& e) { return e.time <= to; });
+    // the next bucket may hold a few late lines
+    if (last != m_entries.end()) {
+        ++last;
+    }
+    return { first - m_entries.begin(), last - m_entries.begin() };
+};
+
+}
@@ -0,0 +1,92 @@
+#ifndef __SERVER_LOGINDEX_HPP__
+#define __SERVER_LOGINDEX_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+namespace Server {
+
+// One time bucket of a log file: the lines logged during
+// [time, time + bucket) are the bytes [offset, offset + length).
+// A line arriving late (its time is before the bucket) stays in the
+// current bucket, so bucket times only grow.
+struct LogIndexEntry {
+    uint64_t time = 0;          // first second of the bucket
+    uint64_t offset = 0;        // byte offset of its first line
+    uint64_t length = 0;        // bytes of its lines
+    uint32_t lines = 0;
+    uint32_t levels = 0;        // bit 1 << level of every level seen
+    uint64_t loggers = 0;       // LogIndex::LoggerBit of every logger seen
+};
+
+// Sidecar time index of a text log file, "<file>.idx": a 16 bytes
+// header followed by one LogIndexEntry per bucket. An entry is appended
+// when its bucket ends, lines after the last entry are not indexed yet.
+class LogIndex {
+public:
+    static constexpr char MAGIC[4] = { 'S', 'L', 'I', 'X' };
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t bucket;        // seconds per entry
+        uint32_t reserved;
+    };
+
+    static std::string PathOf(const std::string& file) { return file + ".idx"; }
+
+    // one of 64 bits per logger name, a bloom filter of a single hash
+    static uint64_t LoggerBit(std::string_view name);
+};
+
+// Maintains the index while a FileLogAppender writes, not thread safe,
+// the appender calls it under its own lock
+class LogIndexWriter {
+public:
+    ~LogIndexWriter() { close(); }
+
+    // fileSize: bytes already in the log file. An index which does not
+    // match (other bucket, entries past the end of the file) is restarted
+    bool open(const std::string& path, uint32_t bucket, uint64_t fileSize);
+
+    // write the open bucket and close the index
+    void close();
+
+    // a line of len bytes at offset
+    void add(uint64_t time, uint64_t offset, size_t len, int level, std::string_view logger);
+
+    bool isOpen() const { return m_fd >= 0; }
+    uint32_t getBucket() const { return m_bucket; }
+
+private:
+    void writeEntry();
+
+private:
+    int m_fd = -1;
+    uint32_t m_bucket = 0;
+    LogIndexEntry m_cur;        // open bucket, valid when lines > 0
+};
+
+// Loads an index to find the byte range of a time range
+class LogIndexReader {
+public:
+    bool open(const std::string& path);
+
+    uint32_t getBucket() const { return m_bucket; }
+    const std::vector<LogIndexEntry>& getEntries() const { return m_entries; }
+
+    // [first, last) entries which may hold lines timed in [from, to]
+    std::pair<size_t, size_t> find(uint64_t from, uint64_t to) const;
+
+private:
+    uint32_t m_bucket = 0;
+    std::vector<LogIndexEntry> m_entries;
+};
+
+}
+
+#endif
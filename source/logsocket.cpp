@@ -0,0 +1,401 @@
+#include <sys/un.h>
+#include <sys/timerfd.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <iostream>
+#include <sstream>
+#include <yaml-cpp/yaml.h>
+
+#include "logsocket.hpp"
+
+namespace Server {
+
+// lines per sendmsg / sendmmsg call
+static const size_t SEND_BATCH = 64;
+
+SocketLogAppender::SocketLogAppender(const std::string& address, const SocketLogOptions& options,
+                                     IOManager* iom)
+    :m_address{ address }
+    ,m_options{ options }
+    ,m_iom{ iom ? iom : DefaultIOManager() } {
+    memset(&m_addr, 0, sizeof(m_addr));
+    m_options.retryMin = std::max<uint32_t>(m_options.retryMin, 1);
+    m_options.retryMax = std::max(m_options.retryMax, m_options.retryMin);
+    m_valid = resolve();
+
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd < 0) {
+        std::cout << "SocketLogAppender timerfd_create failed, errno = " << errno
+                  << " " << strerror(errno) << std::endl;
+        m_valid = false;
+    }
+};
+
+SocketLogAppender::~SocketLogAppender() {
+    // the drain fiber holds the appender, it is already gone
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    if (m_timerFd >= 0) {
+        close(m_timerFd);
+    }
+};
+
+IOManager* SocketLogAppender::DefaultIOManager() {
+    // leaked on purpose, appenders may log until the very end of the process
+    static IOManager* s_iom = new IOManager(1, false, "log_io");
+    return s_iom;
+};
+
+bool SocketLogAppender::resolve() {
+    size_t pos = m_address.find("://");
+    if (pos == std::string::npos) {
+        std::cout << "SocketLogAppender invalid address " << m_address << std::endl;
+        return false;
+    }
+
+    std::string scheme = m_address.substr(0, pos);
+    std::string rest = m_address.substr(pos + 3);
+    if (scheme == "unix") {
+        sockaddr_un* addr = (sockaddr_un*)&m_addr;
+        if (rest.empty() || rest.size() >= sizeof(addr->sun_path)) {
+            std::cout << "SocketLogAppender invalid unix socket path " << m_address << std::endl;
+            return false;
+        }
+        addr->sun_family = AF_UNIX;
+        memcpy(addr->sun_path, rest.c_str(), rest.size() + 1);
+        m_addrLen = sizeof(sockaddr_un);
+        m_sockType = SOCK_STREAM;
+        return true;
+    }
+
+    if (scheme != "tcp" && scheme != "udp") {
+        std::cout << "SocketLogAppender unknown scheme " << m_address << std::endl;
+        return false;
+    }
+    m_sockType = scheme == "tcp" ? SOCK_STREAM : SOCK_DGRAM;
+
+    // "host:port" or "[v6 host]:port"
+    size_t colon = rest.rfind(':');
+    if (colon == std::string::npos) {
+        std::cout << "SocketLogAppender missing port " << m_address << std::endl;
+        return false;
+    }
+    std::string host = rest.substr(0, colon);
+    std::string port = rest.substr(colon + 1);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = m_sockType;
+    addrinfo* result = nullptr;
+    int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if (ret || !result) {
+        std::cout << "SocketLogAppender getaddrinfo " << m_address << " failed, "
+                  << gai_strerror(ret) << std::endl;
+        return false;
+    }
+
+    memcpy(&m_addr, result->ai_addr, result->ai_addrlen);
+    m_addrLen = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+};
+
+void SocketLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+    if (level < m_level) {
+        return;
+    }
+
+    bool schedule = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!m_valid) {
+            ++m_dropped;
+            m_stats.add(LogStats::DROPPED);
+            return;
+        }
+
+        // keep a reference to the shared text, no copy
+        const LogEvent::Text& text = render(logger, level, event);
+        m_spool.push_back(text);
+        m_spoolBytes += text->size();
+        // the lines being sent count too, a line larger than the spool is dropped itself
+        while (m_spoolBytes > m_options.spoolSize && !m_spool.empty()) {
+            m_spoolBytes -= m_spool.front()->size();
+            m_spool.pop_front();
+            ++m_dropped;
+            m_stats.add(LogStats::DROPPED);
+        }
+
+        if (!m_draining) {
+            m_draining = true;
+            schedule = true;
+        }
+    }
+
+    if (schedule) {
+        m_iom->schedule(std::bind(&SocketLogAppender::drain, shared_from_this()));
+    }
+};
+
+void SocketLogAppender::drain() {
+    std::deque<LogEvent::Text> batch;
+    size_t offset = 0;          // bytes of batch.front() already sent
+    uint32_t retry = m_options.retryMin;
+    while (true) {
+        {
+            MutexType::Lock lock(m_mutex);
+            if (batch.empty()) {
+                batch.swap(m_spool);
+            }
+            if (batch.empty()) {
+                m_draining = false;
+                return;
+            }
+        }
+
+        // nobody can log here anymore, do not reconnect for the leftovers
+        if (m_fd < 0 && orphaned()) {
+            release(batch, batch.size(), false);
+            offset = 0;
+            continue;
+        }
+
+        if (m_fd < 0 && !connect()) {
+            sleep(retry);
+            retry = std::min(retry * 2, m_options.retryMax);
+            continue;
+        }
+        retry = m_options.retryMin;
+
+        bool ok = m_sockType == SOCK_STREAM ? sendStream(batch, offset) : sendDatagram(batch);
+        if (!ok) {
+            // the collector sees the partly sent line again in full
+            offset = 0;
+            closeSocket();
+        }
+    }
+};
+
+bool SocketLogAppender::connect() {
+    int fd = socket(m_addr.ss_family, m_sockType | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        report("socket", errno);
+        return false;
+    }
+
+    int ret = ::connect(fd, (const sockaddr*)&m_addr, m_addrLen);
+    if (ret && errno == EINPROGRESS) {
+        if (!waitEvent(fd, IOManager::WRITE)) {
+            close(fd);
+            return false;
+        }
+
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        ret = err ? -1 : 0;
+        errno = err;
+    }
+
+    if (ret) {
+        report("connect", errno);
+        close(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    m_reported = false;
+    m_connected = true;
+    return true;
+};
+
+bool SocketLogAppender::sendStream(std::deque<LogEvent::Text>& batch, size_t& offset) {
+    iovec iov[SEND_BATCH];
+    while (!batch.empty()) {
+        size_t count = 0;
+        for (auto it = batch.begin(); it != batch.end() && count < SEND_BATCH; ++it, ++count) {
+            size_t skip = count == 0 ? offset : 0;
+            iov[count].iov_base = (void*)((*it)->data() + skip);
+            iov[count].iov_len = (*it)->size() - skip;
+        }
+
+        // writev with MSG_NOSIGNAL, a closed peer must not raise SIGPIPE
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n;
+        {
+            LogStats::Timer timer(m_stats, LogStats::IO_NS);
+            n = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && waitEvent(m_fd, IOManager::WRITE)) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                report("send", errno);
+            }
+            return false;
+        }
+
+        m_stats.add(LogStats::BYTES, n);
+        m_stats.add(LogStats::FLUSHES);
+        size_t written = n;
+        size_t done = 0;
+        for (auto it = batch.begin(); written && it != batch.end(); ++it) {
+            size_t left = (*it)->size() - offset;
+            if (written < left) {
+                offset += written;
+                break;
+            }
+            written -= left;
+            offset = 0;
+            ++done;
+        }
+        release(batch, done, true);
+    }
+    return true;
+};
+
+bool SocketLogAppender::sendDatagram(std::deque<LogEvent::Text>& batch) {
+    mmsghdr msgs[SEND_BATCH];
+    iovec iov[SEND_BATCH];
+    while (!batch.empty()) {
+        size_t count = 0;
+        for (auto it = batch.begin(); it != batch.end() && count < SEND_BATCH; ++it, ++count) {
+            iov[count].iov_base = (void*)(*it)->data();
+            iov[count].iov_len = (*it)->size();
+            memset(&msgs[count], 0, sizeof(mmsghdr));
+            msgs[count].msg_hdr.msg_iov = &iov[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n;
+        {
+            LogStats::Timer timer(m_stats, LogStats::IO_NS);
+            n = sendmmsg(m_fd, msgs, count, MSG_NOSIGNAL);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && waitEvent(m_fd, IOManager::WRITE)) {
+                continue;
+            }
+            if (errno == ECONNREFUSED || errno == EMSGSIZE) {
+                // nobody listens (yet) or the line does not fit a datagram, drop it
+                release(batch, 1, false);
+                continue;
+            }
+            if (errno != EAGAIN) {
+                report("sendmmsg", errno);
+            }
+            return false;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            m_stats.add(LogStats::BYTES, iov[i].iov_len);
+        }
+        m_stats.add(LogStats::FLUSHES);
+        release(batch, n, true);
+    }
+    return true;
+};
+
+void SocketLogAppender::release(std::deque<LogEvent::Text>& batch, size_t count, bool sent) {
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bytes += batch.front()->size();
+        batch.pop_front();
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        m_spoolBytes -= bytes;
+    }
+
+    if (sent) {
+        m_sent += count;
+    } else {
+        m_dropped += count;
+        m_stats.add(LogStats::DROPPED, count);
+    }
+};
+
+bool SocketLogAppender::waitEvent(int fd, IOManager::Event event) {
+    // only the fiber holds the appender, waiting would keep it alive for nothing
+    if (orphaned() || m_iom->addEvent(fd, event)) {
+        return false;
+    }
+    Fiber::yieldToHold();
+    return true;
+};
+
+void SocketLogAppender::sleep(uint32_t ms) {
+    itimerspec ts;
+    memset(&ts, 0, sizeof(ts));
+    ts.it_value.tv_sec = ms / 1000;
+    ts.it_value.tv_nsec = (ms % 1000) * 1000000ull;
+    if (timerfd_settime(m_timerFd, 0, &ts, nullptr)) {
+        return;
+    }
+
+    waitEvent(m_timerFd, IOManager::READ);
+
+    uint64_t expirations;
+    while (read(m_timerFd, &expirations, sizeof(expirations)) < 0 && errno == EINTR);
+};
+
+void SocketLogAppender::closeSocket() {
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_connected = false;
+};
+
+void SocketLogAppender::report(const char* what, int err) {
+    // once per outage, not at every reconnection attempt
+    if (m_reported) {
+        return;
+    }
+    m_reported = true;
+    std::cout << "SocketLogAppender " << what << " " << m_address << " failed, errno = "
+              << err << " " << strerror(err) << std::endl;
+};
+
+std::string SocketLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "SocketLogAppender";
+    node["address"] = m_address;
+    node["spool"] = m_options.spoolSize;
+    node["retry"]["min"] = m_options.retryMin;
+    node["retry"]["max"] = m_options.retryMax;
+
+    if (m_level != LogLevel::Level::UNKNOWN) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+
+    if (m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+};
+
+}
@@ -0,0 +1,112 @@
+#ifndef __SERVER_LOGSOCKET_HPP__
+#define __SERVER_LOGSOCKET_HPP__
+
+#include <sys/socket.h>
+#include <string>
+#include <deque>
+#include <atomic>
+
+#include "log.hpp"
+#include "iomanager.hpp"
+
+namespace Server {
+
+// Spool and reconnection settings of SocketLogAppender
+struct SocketLogOptions {
+    uint64_t spoolSize = 4 * 1024 * 1024;   // bytes kept while the collector is slow or away
+    uint32_t retryMin = 100;                // ms before the first reconnection attempt
+    uint32_t retryMax = 5000;               // ms, the delay doubles up to this
+
+    bool operator==(const SocketLogOptions& oth) const {
+        return spoolSize == oth.spoolSize
+            && retryMin == oth.retryMin
+            && retryMax == oth.retryMax;
+    }
+};
+
+// Ship formatted lines to a log collector at
+//   "tcp://host:port", "udp://host:port" or "unix:///path/to/socket"
+// log() only appends the line to an in-memory spool, a fiber on an
+// IOManager drains it with non-blocking vectored sends. When the socket is
+// full the fiber waits for WRITE instead of blocking a thread, when the
+// connection fails it reconnects with exponential backoff. Meanwhile the
+// spool, lines being sent included, is bounded by spoolSize, the oldest
+// waiting lines are dropped first.
+//
+// The drain fiber holds the appender, it outlives its last owner until the
+// lines it took are handed to the socket. Once the fiber is the only owner
+// it no longer waits nor reconnects, what the socket does not take is dropped.
+//
+// Stream sockets carry the lines back to back, udp sends one datagram per line.
+class SocketLogAppender : public LogAppender,
+                          public std::enable_shared_from_this<SocketLogAppender> {
+public:
+    using ptr = std::shared_ptr<SocketLogAppender>;
+
+    // iom: where the drain fiber runs, nullptr for a shared "log_io" IOManager
+    SocketLogAppender(const std::string& address,
+                      const SocketLogOptions& options = SocketLogOptions(),
+                      IOManager* iom = nullptr);
+    ~SocketLogAppender();
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+    std::string getTypeName() const override { return "SocketLogAppender"; }
+    std::string getTarget() const override { return m_address; }
+
+    const std::string& getAddress() const { return m_address; }
+    const SocketLogOptions& getOptions() const { return m_options; }
+
+    bool isConnected() const { return m_connected; }
+
+    // lines dropped because the spool was full (or the address is invalid)
+    uint64_t getDropped() const { return m_dropped; }
+
+    // lines handed to the socket
+    uint64_t getSent() const { return m_sent; }
+
+    // IOManager of appenders created without one, one thread, never stopped
+    static IOManager* DefaultIOManager();
+
+private:
+    bool resolve();
+
+    // drain fiber
+    void drain();
+    bool orphaned() const { return weak_from_this().use_count() <= 1; }
+    void release(std::deque<LogEvent::Text>& batch, size_t count, bool sent);
+    bool connect();
+    bool sendStream(std::deque<LogEvent::Text>& batch, size_t& offset);
+    bool sendDatagram(std::deque<LogEvent::Text>& batch);
+    bool waitEvent(int fd, IOManager::Event event);
+    void sleep(uint32_t ms);
+    void closeSocket();
+    void report(const char* what, int err);
+
+private:
+    std::string m_address;
+    SocketLogOptions m_options;
+    IOManager* m_iom;
+
+    bool m_valid = false;
+    int m_sockType = SOCK_STREAM;
+    sockaddr_storage m_addr;
+    socklen_t m_addrLen = 0;
+
+    int m_fd = -1;                          // only touched by the drain fiber
+    int m_timerFd = -1;
+    bool m_reported = false;                // an error was printed since the last connection
+
+    // guarded by m_mutex
+    std::deque<LogEvent::Text> m_spool;
+    uint64_t m_spoolBytes = 0;              // m_spool and the batch of the drain fiber
+    bool m_draining = false;                // the drain fiber is scheduled or running
+
+    std::atomic<bool> m_connected{ false };
+    std::atomic<uint64_t> m_dropped{ 0 };
+    std::atomic<uint64_t> m_sent{ 0 };
+};
+
+}
+
+#endif
@@ -0,0 +1,33 @@
+#include "logstats.hpp"
+
+namespace Server {
+
+const char* LogStats::ToString(Counter counter) {
+    switch (counter) {
+        case ACCEPTED:  return "accepted";
+        case FILTERED:  return "filtered";
+        case BYTES:     return "bytes";
+        case FORMAT_NS: return "format_ns";
+        case IO_NS:     return "io_ns";
+        case DROPPED:   return "dropped";
+        case FLUSHES:   return "flushes";
+        default:        return "unknown";
+    }
+};
+
+uint32_t LogStats::NextShard() {
+    static std::atomic<uint32_t> s_next{ 0 };
+    return s_next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+};
+
+LogStats::Snapshot LogStats::snapshot() const {
+    Snapshot s;
+    for (auto& shard : m_shards) {
+        for (int i = 0; i < COUNTER_COUNT; ++i) {
+            s.values[i] += shard.values[i].load(std::memory_order_relaxed);
+        }
+    }
+    return s;
+};
+
+}
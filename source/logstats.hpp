@@ -0,0 +1,105 @@
+#ifndef __SERVER_LOGSTATS_HPP__
+#define __SERVER_LOGSTATS_HPP__
+
+#include <stdint.h>
+#include <atomic>
+
+#include "util.hpp"
+
+namespace Server {
+
+// Cost counters of a logger or an appender, cheap enough to stay on in
+// production: every thread adds into its own cache line sized shard with a
+// relaxed atomic, so no cache line is shared by logging threads (unless
+// there are more threads than shards). A snapshot sums the shards.
+//
+// Time counters are sampled, one call in TIME_SAMPLE per thread and per
+// counter is timed and counted TIME_SAMPLE times, they are estimates.
+// Each counter samples on its own, so timers running in a fixed order
+// for every event are all measured.
+class LogStats {
+public:
+    enum Counter {
+        ACCEPTED = 0,   // events handed to the outputs
+        FILTERED,       // events built but rejected by a level check
+        BYTES,          // bytes written
+        FORMAT_NS,      // time spent formatting
+        IO_NS,          // time spent writing
+        DROPPED,        // events discarded by an overflow policy
+        FLUSHES,        // writes of buffered output
+        COUNTER_COUNT
+    };
+
+    static constexpr size_t SHARDS = 16;
+    static constexpr uint32_t TIME_SAMPLE = 16;
+
+    struct Snapshot {
+        uint64_t values[COUNTER_COUNT] = {};
+
+        uint64_t operator[](Counter c) const { return values[c]; }
+
+        Snapshot& operator+=(const Snapshot& oth) {
+            for (int i = 0; i < COUNTER_COUNT; ++i) {
+                values[i] += oth.values[i];
+            }
+            return *this;
+        }
+    };
+
+    // measures the scope for one in TIME_SAMPLE constructions of the same
+    // counter on a thread
+    class Timer {
+    public:
+        Timer(LogStats& stats, Counter counter): m_stats{ stats }, m_counter{ counter } {
+            if (++Local().sample[counter] % TIME_SAMPLE == 0) [[unlikely]] {
+                m_start = GetCurrentNS();
+            }
+        }
+
+        ~Timer() {
+            if (m_start) [[unlikely]] {
+                m_stats.add(m_counter, (GetCurrentNS() - m_start) * TIME_SAMPLE);
+            }
+        }
+
+    private:
+        LogStats& m_stats;
+        Counter m_counter;
+        uint64_t m_start = 0;
+    };
+
+    static const char* ToString(Counter counter);
+
+    void add(Counter counter, uint64_t value = 1) {
+        m_shards[Local().shard].values[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> values[COUNTER_COUNT] = {};
+    };
+
+    struct ThreadState {
+        uint32_t shard;
+        uint32_t sample[COUNTER_COUNT] = {};
+
+        ThreadState(): shard{ NextShard() } {}
+    };
+
+    static ThreadState& Local() {
+        static thread_local ThreadState t_state;
+        return t_state;
+    }
+
+    // threads take the shards round robin
+    static uint32_t NextShard();
+
+private:
+    Shard m_shards[SHARDS];
+};
+
+}
+
+#endif
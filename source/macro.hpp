@@ -4,6 +4,7 @@
 #include <string.h>
 #include <assert.h>
 #include "util.hpp"
+#include "recorder.hpp"
 
 
 #define SERVER_ASSERT(x) \
@@ -11,6 +12,7 @@
         SERVER_LOG_ERROR(SERVER_LOG_ROOT()) << "\n" << "ASSERTION FAILED: " #x \
             << "\nbacktrace:\n" \
             << Server::BacktraceToString(100, 2, "\t\t"); \
+        Server::FlightRecorder::CrashDump("assertion failed: " #x); \
         assert(x); \
     }
 
@@ -20,6 +22,7 @@
             << "\n" << w \
             << "\nbacktrace:\n" \
             << Server::BacktraceToString(100, 2, "\t\t"); \
+        Server::FlightRecorder::CrashDump("assertion failed: " #x); \
         assert(x); \
     }
 
@@ -0,0 +1,392 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "recorder.hpp"
+
+namespace Server {
+
+namespace {
+
+struct Ring {
+    size_t capacity = 0;
+    std::atomic<uint64_t> head{ 0 };        // index of the next record
+    std::atomic<bool> inUse{ true };        // owned by a living thread
+    FlightRecorder::Record* records = nullptr;
+};
+
+// plain copy of a record taken by the dumper
+struct Entry {
+    uint64_t timeNs;
+    const char* file;
+    int32_t line;
+    uint32_t threadId;
+    uint32_t fiberId;
+    uint8_t level;
+    uint16_t length;
+    char logger[FlightRecorder::NAME_SIZE];
+    char message[FlightRecorder::MESSAGE_SIZE];
+};
+
+std::atomic<Ring*> s_rings[FlightRecorder::MAX_RINGS];
+std::atomic<size_t> s_ringCount{ 0 };
+std::atomic<size_t> s_capacity{ 1024 };
+std::atomic<int> s_dumpFd{ STDERR_FILENO };
+std::atomic<bool> s_dumping{ false };
+std::atomic<bool> s_crashDumped{ false };
+std::atomic<bool> s_installed{ false };
+
+struct RingHolder {
+    Ring* ring = nullptr;
+
+    // the ring outlives its thread, a new thread takes it over later
+    ~RingHolder() {
+        if (ring) {
+            ring->inUse.store(false, std::memory_order_release);
+        }
+    }
+};
+
+thread_local RingHolder t_ring;
+
+Ring* GetRing() {
+    if (t_ring.ring) [[likely]] {
+        return t_ring.ring;
+    }
+
+    size_t capacity = s_capacity.load(std::memory_order_relaxed);
+    size_t count = std::min(s_ringCount.load(std::memory_order_acquire), FlightRecorder::MAX_RINGS);
+    for (size_t i = 0; i < count; ++i) {
+        Ring* ring = s_rings[i].load(std::memory_order_acquire);
+        bool used = false;
+        if (ring && ring->capacity == capacity
+            && ring->inUse.compare_exchange_strong(used, true, std::memory_order_acquire)) {
+            t_ring.ring = ring;
+            return ring;
+        }
+    }
+
+    size_t index = s_ringCount.fetch_add(1, std::memory_order_acq_rel);
+    if (index >= FlightRecorder::MAX_RINGS) {
+        return nullptr;     // too many threads, this one records nothing
+    }
+
+    Ring* ring = new Ring;
+    ring->capacity = capacity;
+    ring->records = new FlightRecorder::Record[capacity];
+    s_rings[index].store(ring, std::memory_order_release);
+    t_ring.ring = ring;
+    return ring;
+}
+
+// seqlock read of the record with the given index, false if the slot is
+// being written or already holds a newer record (every write adds 2 to seq)
+bool ReadRecord(const FlightRecorder::Record& r, uint64_t index, size_t capacity, Entry& e) {
+    uint64_t seq = r.seq.load(std::memory_order_acquire);
+    if (seq != (index / capacity + 1) * 2) {
+        return false;
+    }
+
+    e.timeNs = r.timeNs;
+    e.file = r.file;
+    e.line = r.line;
+    e.threadId = r.threadId;
+    e.fiberId = r.fiberId;
+    e.level = r.level;
+    e.length = std::min<uint16_t>(r.length, FlightRecorder::MESSAGE_SIZE);
+    memcpy(e.logger, r.logger, sizeof(e.logger));
+    memcpy(e.message, r.message, e.length);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return r.seq.load(std::memory_order_relaxed) == seq;
+}
+
+// async-signal-safe line building, no allocation and no locale
+
+class LineWriter {
+public:
+    LineWriter(int fd): m_fd{ fd } {}
+    ~LineWriter() { flush(); }
+
+    void append(const char* s, size_t n) {
+        while (n) {
+            size_t c = std::min(n, sizeof(m_buf) - m_size);
+            memcpy(m_buf + m_size, s, c);
+            m_size += c;
+            s += c;
+            n -= c;
+            if (m_size == sizeof(m_buf)) {
+                flush();
+            }
+        }
+    }
+
+    void append(const char* s) { append(s, strlen(s)); }
+
+    void appendUInt(uint64_t v, int width = 0) {
+        char tmp[24];
+        int n = 0;
+        do {
+            tmp[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        while (n < width) {
+            tmp[n++] = '0';
+        }
+        while (n) {
+            char c = tmp[--n];
+            append(&c, 1);
+        }
+    }
+
+    void flush() {
+        size_t offset = 0;
+        while (offset < m_size) {
+            ssize_t n = write(m_fd, m_buf + offset, m_size - offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            offset += n;
+        }
+        m_size = 0;
+    }
+
+private:
+    int m_fd;
+    char m_buf[4096];
+    size_t m_size = 0;
+};
+
+// UTC calendar date from days since epoch (H. Hinnant's algorithm), localtime is not signal safe
+void AppendTime(LineWriter& w, uint64_t timeNs) {
+    int64_t secs = timeNs / 1000000000ull;
+    int64_t days = secs / 86400;
+    int64_t rem = secs % 86400;
+
+    int64_t z = days + 719468;
+    int64_t era = z / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int64_t d = doy - (153 * mp + 2) / 5 + 1;
+    int64_t m = mp < 10 ? mp + 3 : mp - 9;
+    int64_t y = yoe + era * 400 + (m <= 2);
+
+    w.appendUInt(y, 4);
+    w.append("-");
+    w.appendUInt(m, 2);
+    w.append("-");
+    w.appendUInt(d, 2);
+    w.append(" ");
+    w.appendUInt(rem / 3600, 2);
+    w.append(":");
+    w.appendUInt(rem % 3600 / 60, 2);
+    w.append(":");
+    w.appendUInt(rem % 60, 2);
+    w.append(".");
+    w.appendUInt(timeNs % 1000000000ull, 9);
+    w.append("Z");
+}
+
+struct sigaction s_oldActions[NSIG];
+
+const char* SignalName(int sig) {
+    switch (sig) {
+        case SIGSEGV: return "SIGSEGV";
+        case SIGABRT: return "SIGABRT";
+        case SIGBUS:  return "SIGBUS";
+        case SIGFPE:  return "SIGFPE";
+        case SIGILL:  return "SIGILL";
+        default:      return "signal";
+    }
+}
+
+void OnFatalSignal(int sig) {
+    FlightRecorder::CrashDump(SignalName(sig));
+
+    // hand over to whatever was installed before, the signal is delivered
+    // again once this handler returns (or right away for abort)
+    sigaction(sig, &s_oldActions[sig], nullptr);
+    raise(sig);
+}
+
+void OnDumpSignal(int) {
+    int saved = errno;
+    FlightRecorder::Dump(s_dumpFd.load(std::memory_order_relaxed), "SIGUSR2");
+    errno = saved;
+}
+
+}
+
+void FlightRecorder::Append(const std::string& logger, LogLevel::Level level, const LogEvent& event) {
+    Append(logger, level, event.getTimeNs(), event.getThreadId(), event.getFiberId(),
+           event.getFile(), event.getLine(), event.getContentView());
+};
+
+void FlightRecorder::Append(const std::string& logger, LogLevel::Level level, uint64_t timeNs,
+                            uint32_t threadId, uint32_t fiberId, const char* file, int32_t line,
+                            std::string_view message) {
+    Ring* ring = GetRing();
+    if (!ring) {
+        return;
+    }
+
+    // single writer per ring, readers retry or skip on a seq mismatch
+    uint64_t index = ring->head.load(std::memory_order_relaxed);
+    Record& r = ring->records[index % ring->capacity];
+    uint64_t seq = r.seq.load(std::memory_order_relaxed);
+    r.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    r.timeNs = timeNs;
+    r.file = file;
+    r.line = line;
+    r.threadId = threadId;
+    r.fiberId = fiberId;
+    r.level = (uint8_t)level;
+    size_t nameLen = std::min(logger.size(), NAME_SIZE - 1);
+    memcpy(r.logger, logger.data(), nameLen);
+    r.logger[nameLen] = '\0';
+    r.length = std::min(message.size(), MESSAGE_SIZE);
+    memcpy(r.message, message.data(), r.length);
+
+    r.seq.store(seq + 2, std::memory_order_release);
+    ring->head.store(index + 1, std::memory_order_release);
+};
+
+void FlightRecorder::Dump(int fd, const char* reason) {
+    // one dump at a time, a nested call (signal during a dump) just returns
+    if (s_dumping.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+
+    static uint64_t s_cursor[MAX_RINGS];
+    static uint64_t s_end[MAX_RINGS];
+    static Ring* s_snapshot[MAX_RINGS];
+
+    size_t count = std::min(s_ringCount.load(std::memory_order_acquire), MAX_RINGS);
+    for (size_t i = 0; i < count; ++i) {
+        Ring* ring = s_rings[i].load(std::memory_order_acquire);
+        s_snapshot[i] = ring;
+        if (ring) {
+            s_end[i] = ring->head.load(std::memory_order_acquire);
+            s_cursor[i] = s_end[i] > ring->capacity ? s_end[i] - ring->capacity : 0;
+        }
+    }
+
+    LineWriter w(fd);
+    w.append("==== flight recorder dump (");
+    w.append(reason);
+    w.append(") ====\n");
+
+    // merge the rings by time, rings are ordered by themselves
+    Entry best;
+    Entry e;
+    while (true) {
+        int bestRing = -1;
+        for (size_t i = 0; i < count; ++i) {
+            Ring* ring = s_snapshot[i];
+            while (ring && s_cursor[i] < s_end[i]) {
+                const Record& r = ring->records[s_cursor[i] % ring->capacity];
+                if (ReadRecord(r, s_cursor[i], ring->capacity, e)) {
+                    if (bestRing < 0 || e.timeNs < best.timeNs) {
+                        best = e;
+                        bestRing = i;
+                    }
+                    break;
+                }
+                ++s_cursor[i];
+            }
+        }
+        if (bestRing < 0) {
+            break;
+        }
+        ++s_cursor[bestRing];
+
+        AppendTime(w, best.timeNs);
+        w.append("\t");
+        w.appendUInt(best.threadId);
+        w.append("\t");
+        w.appendUInt(best.fiberId);
+        w.append("\t[");
+        w.append(LogLevel::ToString((LogLevel::Level)best.level));
+        w.append("]\t[");
+        w.append(best.logger);
+        w.append("]\t");
+        w.append(best.file ? best.file : "");
+        w.append(":");
+        w.appendUInt(best.line);
+        w.append("\t");
+        w.append(best.message, best.length);
+        w.append("\n");
+    }
+
+    w.append("==== end of flight recorder dump ====\n");
+    w.flush();
+    s_dumping.store(false, std::memory_order_release);
+};
+
+void FlightRecorder::CrashDump(const char* reason) {
+    // nothing was ever recorded, no logger opted in
+    if (s_ringCount.load(std::memory_order_acquire) == 0) {
+        return;
+    }
+    if (s_crashDumped.exchange(true)) {
+        return;
+    }
+    Dump(s_dumpFd.load(std::memory_order_relaxed), reason);
+};
+
+void FlightRecorder::SetCapacity(size_t capacity) {
+    s_capacity.store(std::max<size_t>(capacity, 16), std::memory_order_relaxed);
+};
+
+bool FlightRecorder::SetDumpFile(const std::string& path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "FlightRecorder open " << path << " failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // the first file gets its own fd, later files are dup'ed onto it. a
+    // dump may be writing to that fd, it is never closed nor reused
+    int cur = STDERR_FILENO;
+    if (s_dumpFd.compare_exchange_strong(cur, fd)) {
+        return true;
+    }
+    if (dup3(fd, cur, O_CLOEXEC) < 0) {
+        std::cout << "FlightRecorder dup3 " << path << " failed, errno = "
+                  << errno << " " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+    close(fd);
+    return true;
+};
+
+void FlightRecorder::InstallSignalHandlers() {
+    if (s_installed.exchange(true)) {
+        return;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = OnFatalSignal;
+    for (int sig : { SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL }) {
+        sigaction(sig, &sa, &s_oldActions[sig]);
+    }
+
+    sa.sa_handler = OnDumpSignal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, nullptr);
+};
+
+}
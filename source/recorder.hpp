@@ -0,0 +1,62 @@
+#ifndef __SERVER_RECORDER_HPP__
+#define __SERVER_RECORDER_HPP__
+
+#include <atomic>
+#include <string>
+#include <string_view>
+
+#include "log.hpp"
+
+namespace Server {
+
+// Flight recorder: every thread owns a ring of the most recent events of
+// the loggers which enabled it (Logger::setRecorder, "recorder" in logs
+// config), at any level. Recording copies the raw fields and message, no
+// pattern formatting, no lock, no I/O. The rings are written out only when
+// a SERVER_ASSERT fails, on a fatal signal, or on request (Dump, SIGUSR2).
+class FlightRecorder {
+public:
+    static constexpr size_t MAX_RINGS = 256;        // threads with a ring at the same time
+    static constexpr size_t NAME_SIZE = 24;         // logger name, truncated
+    static constexpr size_t MESSAGE_SIZE = 192;     // message, truncated
+
+    struct Record {
+        std::atomic<uint64_t> seq{ 0 };     // odd while the owner thread writes it
+        uint64_t timeNs;
+        const char* file;
+        int32_t line;
+        uint32_t threadId;
+        uint32_t fiberId;
+        uint8_t level;
+        uint16_t length;
+        char logger[NAME_SIZE];
+        char message[MESSAGE_SIZE];
+    };
+
+    // capture an event into the ring of current thread
+    static void Append(const std::string& logger, LogLevel::Level level, const LogEvent& event);
+    static void Append(const std::string& logger, LogLevel::Level level, uint64_t timeNs,
+                       uint32_t threadId, uint32_t fiberId, const char* file, int32_t line,
+                       std::string_view message);
+
+    // write every ring to fd, oldest record first, async-signal-safe
+    static void Dump(int fd, const char* reason = "requested");
+
+    // Dump into the dump file once per process, for assertions and fatal
+    // signals. Nothing is written if no logger ever recorded
+    static void CrashDump(const char* reason);
+
+    // records per ring, used by rings created afterwards (default 1024)
+    static void SetCapacity(size_t capacity);
+
+    // file the crash dumps append to, stderr by default
+    static bool SetDumpFile(const std::string& path);
+
+    // dump on SIGSEGV/SIGABRT/SIGBUS/SIGFPE/SIGILL (then run the previous
+    // handler) and on SIGUSR2, installed once
+    static void InstallSignalHandlers();
+};
+
+}
+
+#endif
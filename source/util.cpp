@@ -1,4 +1,11 @@
 #include <execinfo.h>
+#include <time.h>
+#include <atomic>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
 
 #include "util.hpp"
 #include "log.hpp"
@@ -9,13 +16,128 @@ namespace Server {
 Server::Logger::ptr g_logger = SERVER_LOG_NAME("system");
 
 pid_t getThreadId(){
-    return syscall(SYS_gettid);
+    // thread id never changes, avoid a syscall on every log event
+    static thread_local pid_t t_id = 0;
+    if (!t_id) {
+        t_id = syscall(SYS_gettid);
+    }
+    return t_id;
 };
 
 uint32_t getFiberId(){
     return Server::Fiber::getFiberId();
 };
 
+static uint64_t RealtimeNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// TSC ticks at a constant rate across P/C-states
+static bool HasInvariantTsc() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return edx & (1u << 8);
+}
+
+// rough nanoseconds per tick, refined by every re-anchor afterwards
+static double CalibrateTsc() {
+    uint64_t ns0 = RealtimeNS();
+    uint64_t tsc0 = __rdtsc();
+    uint64_t ns1 = ns0;
+    while (ns1 - ns0 < 1000000) {
+        ns1 = RealtimeNS();
+    }
+    uint64_t tsc1 = __rdtsc();
+    return (double)(ns1 - ns0) / (tsc1 - tsc0);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+// One anchor shared by every thread, published with a sequence lock: odd
+// while a thread re-anchors it, readers retry if it changed under them
+struct TscAnchor {
+    std::atomic<uint64_t> seq{ 0 };
+    std::atomic<uint64_t> tsc{ 0 };
+    std::atomic<uint64_t> ns{ 0 };
+    std::atomic<double> nsPerTick{ 0 };
+};
+
+static TscAnchor s_anchor;
+#endif
+
+uint64_t GetCurrentNS() {
+    // re-anchoring may step the clock back a little, a thread never sees it
+    static thread_local uint64_t t_last = 0;
+    uint64_t result;
+
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool s_useTsc = HasInvariantTsc();
+    if (!s_useTsc) {
+        result = RealtimeNS();
+        t_last = std::max(t_last, result);
+        return t_last;
+    }
+
+    static const double s_nsPerTick = CalibrateTsc();
+
+    uint64_t seq, anchorTsc, anchorNs;
+    double nsPerTick;
+    while (true) {
+        seq = s_anchor.seq.load(std::memory_order_acquire);
+        anchorTsc = s_anchor.tsc.load(std::memory_order_relaxed);
+        anchorNs = s_anchor.ns.load(std::memory_order_relaxed);
+        nsPerTick = s_anchor.nsPerTick.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(seq & 1) && s_anchor.seq.load(std::memory_order_relaxed) == seq) {
+            break;
+        }
+    }
+
+    uint64_t tsc = __rdtsc();
+    if (anchorTsc != 0 && tsc < anchorTsc) {
+        // read on a core slightly behind the one which re-anchored
+        result = anchorNs;
+    } else {
+        result = anchorNs + (uint64_t)((tsc - anchorTsc) * nsPerTick);
+        if (anchorTsc == 0 || result - anchorNs >= 1000000000ull) {
+            // one thread re-anchors to the real clock and refines the tick
+            // rate over the last interval, the others keep extrapolating
+            uint64_t now = RealtimeNS();
+            if (s_anchor.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+                std::atomic_thread_fence(std::memory_order_release);
+                s_anchor.nsPerTick.store(anchorTsc != 0 && now > anchorNs
+                                            ? (double)(now - anchorNs) / (tsc - anchorTsc)
+                                            : s_nsPerTick, std::memory_order_relaxed);
+                s_anchor.tsc.store(tsc, std::memory_order_relaxed);
+                s_anchor.ns.store(now, std::memory_order_relaxed);
+                s_anchor.seq.store(seq + 2, std::memory_order_release);
+            }
+            if (anchorTsc == 0) {
+                result = now;
+            }
+        }
+    }
+#else
+    result = RealtimeNS();
+#endif
+
+    t_last = std::max(t_last, result);
+    return t_last;
+}
+
+uint64_t GetProcessStartNS() {
+    static const uint64_t s_start = GetCurrentNS();
+    return s_start;
+}
+
+// capture the start time while the library is loaded
+static uint64_t s_processStart = GetProcessStartNS();
+
 void Backtrace(std::vector<std::string>& bt, int size, int skip){
     void** array = (void**)malloc((sizeof(void*) * size));
 
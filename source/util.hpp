@@ -17,6 +17,15 @@ pid_t getThreadId();
 // Get coroutine id from kernel
 uint32_t getFiberId();
 
+// Get wall clock time in nanoseconds, read from the TSC when it is
+// invariant and re-anchored to CLOCK_REALTIME about once per second.
+// All threads extrapolate from the same anchor, and the time a thread
+// reads never decreases
+uint64_t GetCurrentNS();
+
+// Get wall clock time in nanoseconds when the process started
+uint64_t GetProcessStartNS();
+
 // Get stack frames
 void Backtrace(std::vector<std::string>& bt, int size = 64, int skip = 1);
 
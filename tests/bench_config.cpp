@@ -0,0 +1,157 @@
+#include "../source/config.hpp"
+#include "../source/util.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <unistd.h>
+
+// Reload a large generated config, as a service with thousands of keys does.
+//   parse  - YAML::Load of the text only
+//   load   - ConfigMgr::loadFromYaml, values decoded from the parsed nodes
+//   string - every value serialized and decoded with fromString, what
+//            loadFromYaml did before FromNode
+//   diff   - ConfigMgr::applyYamlDiff of a reload changing one key
+//   file   - ConfigMgr::loadFromFile, reading and parsing the file
+//   cached - ConfigMgr::loadFromFile of the same file with its snapshot
+// usage: bench_config [scale] [rounds]
+
+static std::vector<Server::ConfigArgBase::ptr> s_args;
+
+static std::string Key(const char* prefix, int i) {
+    std::string key(prefix);
+    key += std::to_string(i);
+    return key;
+};
+
+// scale * 1000 scalars, scale * 2000 map entries of vectors, a nested map
+// of scale * 100 * 20 vectors and a list of scale * 2000 strings.
+// round changes every value so each load really sets them
+static std::string Generate(int scale, int round) {
+    YAML::Node root;
+    YAML::Node bench = root["bench"];
+    for (int i = 0; i < scale * 1000; ++i) {
+        bench["scalar"][Key("k", i)] = i + round;
+    }
+    for (int i = 0; i < scale * 2000; ++i) {
+        YAML::Node vec(YAML::NodeType::Sequence);
+        for (int j = 0; j < 8; ++j) {
+            vec.push_back(i * 8 + j + round);
+        }
+        bench["table"][Key("row", i)] = vec;
+    }
+    for (int i = 0; i < scale * 100; ++i) {
+        for (int j = 0; j < 20; ++j) {
+            YAML::Node vec(YAML::NodeType::Sequence);
+            for (int k = 0; k < 4; ++k) {
+                vec.push_back(k + round);
+            }
+            bench["nested"][Key("g", i)][Key("s", j)] = vec;
+        }
+    }
+    for (int i = 0; i < scale * 2000; ++i) {
+        bench["names"].push_back(Key("name_", i + round));
+    }
+
+    std::stringstream ss;
+    ss << root;
+    return ss.str();
+};
+
+static void Register(int scale) {
+    for (int i = 0; i < scale * 1000; ++i) {
+        s_args.push_back(Server::ConfigMgr::lookUp(Key("bench.scalar.k", i), 0));
+    }
+    s_args.push_back(Server::ConfigMgr::lookUp("bench.table",
+                        std::map<std::string, std::vector<int>>()));
+    s_args.push_back(Server::ConfigMgr::lookUp("bench.nested",
+                        std::unordered_map<std::string, std::map<std::string, std::vector<int>>>()));
+    s_args.push_back(Server::ConfigMgr::lookUp("bench.names", std::list<std::string>()));
+};
+
+// the old loadFromYaml: every registered value goes through its string form
+static void LoadByString(const YAML::Node& root) {
+    for (auto& arg : s_args) {
+        // "bench.scalar.k1" -> root["bench"]["scalar"]["k1"]
+        YAML::Node node = root;
+        const std::string& name = arg->getName();
+        for (size_t begin = 0, end; begin < name.size(); begin = end + 1) {
+            end = name.find('.', begin);
+            end = end == std::string::npos ? name.size() : end;
+            // const lookup, reset() rebinds instead of assigning the value
+            node.reset(((const YAML::Node&)node)[name.substr(begin, end - begin)]);
+        }
+        if (node.IsScalar()) {
+            arg->fromString(node.Scalar());
+        } else {
+            std::stringstream ss;
+            ss << node;
+            arg->fromString(ss.str());
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    int scale = argc > 1 ? atoi(argv[1]) : 2;
+    int rounds = argc > 2 ? atoi(argv[2]) : 3;
+    // no "Lookup name exists" lines while registering
+    SERVER_LOG_ROOT()->setLevel(Server::LogLevel::Level::ERROR);
+    Register(scale);
+
+    std::vector<std::string> texts;
+    for (int r = 0; r < rounds * 2; ++r) {
+        texts.push_back(Generate(scale, r));
+    }
+    std::cout << "config of " << texts[0].size() / 1024 << " KB, " << s_args.size()
+              << " keys" << std::endl;
+
+    uint64_t parse = 0, load = 0, string = 0, diff = 0;
+    for (int r = 0; r < rounds; ++r) {
+        uint64_t start = Server::GetCurrentNS();
+        YAML::Node root = YAML::Load(texts[r * 2]);
+        parse += Server::GetCurrentNS() - start;
+
+        start = Server::GetCurrentNS();
+        Server::ConfigMgr::loadFromYaml(root);
+        load += Server::GetCurrentNS() - start;
+
+        // a different round, the values change again
+        YAML::Node next = YAML::Load(texts[r * 2 + 1]);
+        start = Server::GetCurrentNS();
+        LoadByString(next);
+        string += Server::GetCurrentNS() - start;
+
+        YAML::Node changed = YAML::Load(texts[r * 2 + 1]);
+        changed["bench"]["scalar"]["k0"] = -r;
+        start = Server::GetCurrentNS();
+        Server::ConfigMgr::applyYamlDiff(next, changed);
+        diff += Server::GetCurrentNS() - start;
+    }
+
+    // a restart: the same file loaded without and with its snapshot
+    uint64_t file = 0, cached = 0;
+    std::string path = "/tmp/bench_config.yml", cache = path + ".cache";
+    std::ofstream(path) << texts[0];
+    Server::ConfigMgr::loadFromFile(path, cache);       // writes the snapshot
+    for (int r = 0; r < rounds; ++r) {
+        Server::ConfigMgr::loadFromYaml(YAML::Load(texts[1]));
+        uint64_t start = Server::GetCurrentNS();
+        Server::ConfigMgr::loadFromFile(path);
+        file += Server::GetCurrentNS() - start;
+
+        Server::ConfigMgr::loadFromYaml(YAML::Load(texts[1]));
+        start = Server::GetCurrentNS();
+        Server::ConfigMgr::loadFromFile(path, cache);
+        cached += Server::GetCurrentNS() - start;
+    }
+    unlink(path.c_str());
+    unlink(cache.c_str());
+
+    std::cout << "mode,ms per load" << std::endl;
+    std::cout << "parse," << parse / rounds / 1000000.0 << std::endl;
+    std::cout << "load," << load / rounds / 1000000.0 << std::endl;
+    std::cout << "string," << string / rounds / 1000000.0 << std::endl;
+    std::cout << "diff," << diff / rounds / 1000000.0 << std::endl;
+    std::cout << "file," << file / rounds / 1000000.0 << std::endl;
+    std::cout << "cached," << cached / rounds / 1000000.0 << std::endl;
+    return 0;
+}
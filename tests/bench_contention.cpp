@@ -0,0 +1,122 @@
+#include "../source/log.hpp"
+#include "../source/util.hpp"
+#include "../source/thread.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+
+// Several threads log through one logger whose appender does real I/O.
+//   snapshot - appenders are read from the lock-free snapshot
+//   locked   - every appender call holds one shared lock, as Logger::log did
+//              when it kept m_mutex for the whole fan-out
+// usage: bench_contention [max threads] [events per thread]
+
+static int s_null = -1;
+
+// format the event and write it to /dev/null, a syscall per line
+class WriteAppender : public Server::LogAppender {
+public:
+    void log(Server::Logger::ptr logger, Server::LogLevel::Level level,
+             Server::LogEvent::ptr event) override {
+        static thread_local std::string t_buf;
+        t_buf.clear();
+        m_formatter->format(t_buf, logger, level, event);
+        if (write(s_null, t_buf.data(), t_buf.size()) < 0) {
+            perror("write");
+        }
+    }
+
+    std::string toYamlString() override { return ""; }
+};
+
+class LockedAppender : public Server::LogAppender {
+public:
+    LockedAppender(Server::LogAppender::ptr inner): m_inner{ inner } {}
+
+    void log(Server::Logger::ptr logger, Server::LogLevel::Level level,
+             Server::LogEvent::ptr event) override {
+        MutexType::Lock lock(m_lock);
+        m_inner->log(logger, level, event);
+    }
+
+    std::string toYamlString() override { return ""; }
+
+private:
+    Server::Spinlock m_lock;
+    Server::LogAppender::ptr m_inner;
+};
+
+class NopAppender : public Server::LogAppender {
+public:
+    void log(Server::Logger::ptr, Server::LogLevel::Level, Server::LogEvent::ptr) override {}
+    std::string toYamlString() override { return ""; }
+};
+
+static void run(const std::string& mode, Server::Logger::ptr logger, int threads, int events) {
+    std::atomic<bool> done{ false };
+    std::atomic<uint64_t> swaps{ 0 };
+
+    // keep swapping the appender list while the workers log
+    Server::Thread::ptr churn(new Server::Thread([&]() {
+        Server::LogAppender::ptr nop(new NopAppender);
+        while (!done) {
+            logger->addAppender(nop);
+            logger->delAppender(nop);
+            swaps += 2;
+            usleep(1000);
+        }
+    }, "churn"));
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<Server::Thread::ptr> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.push_back(Server::Thread::ptr(new Server::Thread([&]() {
+            for (int n = 0; n < events; ++n) {
+                SERVER_LOG_INFO(logger) << "contention bench line " << n;
+            }
+        }, "worker_" + std::to_string(i))));
+    }
+    for (auto& t : workers) {
+        t->join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    done = true;
+    churn->join();
+
+    double sec = std::chrono::duration<double>(end - begin).count();
+    uint64_t total = (uint64_t)threads * events;
+    std::cout << mode << "\tthreads = " << threads << "\t" << (uint64_t)(total / sec) << " lines/s\t"
+              << (uint64_t)(sec * 1e9 / total * threads) << " ns/line/thread\tswaps = " << swaps
+              << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 8;
+    int events = argc > 2 ? atoi(argv[2]) : 200000;
+
+    s_null = open("/dev/null", O_WRONLY);
+    if (s_null < 0) {
+        perror("open /dev/null");
+        return 1;
+    }
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        Server::Logger::ptr snapshot(new Server::Logger("snapshot"));
+        snapshot->setFormatter("%d%T%t%T%N%T[%p]%T%f:%l%T%m%n");
+        snapshot->addAppender(Server::LogAppender::ptr(new WriteAppender));
+        run("snapshot", snapshot, threads, events);
+
+        Server::Logger::ptr locked(new Server::Logger("locked"));
+        locked->setFormatter("%d%T%t%T%N%T[%p]%T%f:%l%T%m%n");
+        Server::LogAppender::ptr inner(new WriteAppender);
+        inner->setFormatter(locked->getFormatter());
+        locked->addAppender(Server::LogAppender::ptr(new LockedAppender(inner)));
+        run("locked", locked, threads, events);
+    }
+
+    close(s_null);
+    return 0;
+}
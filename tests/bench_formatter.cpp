@@ -0,0 +1,68 @@
+#include "../source/log.hpp"
+#include "../source/util.hpp"
+
+#include <chrono>
+#include <iostream>
+
+// stream which throws everything away, measures formatting only
+class NullBuf : public std::streambuf {
+protected:
+    int_type overflow(int_type ch) override { return traits_type::not_eof(ch); }
+    std::streamsize xsputn(const char* s, std::streamsize n) override { return n; }
+};
+
+static const size_t N = 1000000;
+
+template<typename F>
+static void run(const std::string& name, const std::string& pattern, F f) {
+    auto begin = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (size_t i = 0; i < N; ++i) {
+        bytes += f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - begin).count();
+
+    std::cout << name << "\t" << (uint64_t)(N / sec) << " lines/s\t" 
+              << bytes / N << " bytes/line\t" << pattern << std::endl;
+}
+
+int main(int argc, char** argv) {
+    Server::Logger::ptr logger(new Server::Logger("bench"));
+    Server::LogEvent::ptr event(new Server::LogEvent(logger, Server::LogLevel::Level::INFO,
+                                __FILE__, __LINE__, 0, Server::getThreadId(),
+                                Server::getFiberId(), time(0), "bench_thread"));
+    event->getSS() << "user login ok, uid = " << 10086 << " cost = " << 1.25 << "ms";
+
+    NullBuf nb;
+    std::ostream null_os(&nb);
+
+    const std::vector<std::string> patterns = {
+        "%m%n",
+        "%d%T%m%n",
+        "%d{%Y-%m-%d %H:%M:%S.%6f}%T%r%T%m%n",
+        "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
+    };
+
+    for (auto& p : patterns) {
+        Server::LogFormatter::ptr fmt(new Server::LogFormatter(p));
+
+        run("string", p, [&]() {
+            return fmt->format(logger, Server::LogLevel::Level::INFO, event).size();
+        });
+
+        std::string buf;
+        run("buffer", p, [&]() {
+            buf.clear();
+            fmt->format(buf, logger, Server::LogLevel::Level::INFO, event);
+            return buf.size();
+        });
+
+        run("ostream", p, [&]() {
+            fmt->format(null_os, logger, Server::LogLevel::Level::INFO, event);
+            return (size_t)0;
+        });
+    }
+
+    return 0;
+}
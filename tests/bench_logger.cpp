@@ -0,0 +1,194 @@
+#include "../source/log.hpp"
+#include "../source/logfile.hpp"
+#include "../source/util.hpp"
+#include "../source/thread.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <algorithm>
+#include <iostream>
+
+// Throughput and per-call latency of the logging path, one result line per
+// (appender, pattern, macro, threads) so runs of two commits can be diffed.
+//   bench_logger [-t max threads] [-n messages per thread] [-f csv|json]
+// Log output goes to /dev/null (stdout), ./bench_logger.log and ./bench_rolling.log,
+// "fanout" writes to both stdout and ./bench_logger.log
+
+// format every event but throw the text away
+class NullAppender : public Server::LogAppender {
+public:
+    void log(Server::Logger::ptr logger, Server::LogLevel::Level level,
+             Server::LogEvent::ptr event) override {
+        MutexType::Lock lock(m_mutex);
+        m_formatter->render(logger, level, event);
+    }
+
+    std::string toYamlString() override { return ""; }
+};
+
+struct Result {
+    std::string appender;
+    std::string pattern;
+    std::string macro;
+    int threads;
+    uint64_t messages;
+    double seconds;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+static const std::vector<std::pair<std::string, std::string>> s_patterns = {
+    { "short", "%m%n" },
+    { "long",  "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n" }
+};
+
+static Server::LogAppender::ptr CreateAppender(const std::string& name) {
+    if (name == "null") {
+        return Server::LogAppender::ptr(new NullAppender);
+    } else if (name == "stdout") {
+        return Server::LogAppender::ptr(new Server::StdoutLogAppender);
+    } else if (name == "file") {
+        unlink("./bench_logger.log");
+        return Server::LogAppender::ptr(new Server::FileLogAppender("./bench_logger.log"));
+    } else if (name == "file_batched") {
+        // lines go out in 64KB writev batches, errors right away
+        unlink("./bench_logger.log");
+        Server::FileLogAppender::ptr file(new Server::FileLogAppender("./bench_logger.log"));
+        Server::LogFlushPolicy policy;
+        policy.line = false;
+        policy.interval = 100;
+        policy.level = Server::LogLevel::Level::ERROR;
+        file->setFlushPolicy(policy);
+        return file;
+    } else if (name == "rolling") {
+        system("rm -f ./bench_rolling.log*");
+        return Server::LogAppender::ptr(new Server::RollingFileLogAppender("./bench_rolling.log"));
+    }
+    return nullptr;
+}
+
+// stream: SERVER_LOG_*, format: SERVER_LOG_FMT_* (printf), typed: SERVER_LOG_FORMAT_* ("{}")
+static const char* s_macros[] = { "stream", "format", "typed" };
+
+static Result Run(const std::string& appenderName, const std::pair<std::string, std::string>& pattern,
+                  int macro, int threads, uint64_t messages) {
+    Server::Logger::ptr logger(new Server::Logger("bench"));
+    logger->setFormatter(pattern.second);
+    if (appenderName == "fanout") {
+        // two sinks of the same pattern, the event is formatted once
+        logger->addAppender(CreateAppender("stdout"));
+        logger->addAppender(CreateAppender("file"));
+    } else {
+        logger->addAppender(CreateAppender(appenderName));
+    }
+
+    std::vector<std::vector<uint32_t>> samples(threads);
+    std::vector<Server::Thread::ptr> workers;
+
+    uint64_t begin = Server::GetCurrentNS();
+    for (int t = 0; t < threads; ++t) {
+        workers.push_back(std::make_shared<Server::Thread>([&, t]() {
+            auto& lat = samples[t];
+            lat.resize(messages);
+            for (uint64_t i = 0; i < messages; ++i) {
+                uint64_t start = Server::GetCurrentNS();
+                if (macro == 1) {
+                    SERVER_LOG_FMT_INFO(logger, "bench message %lu value %.3f user %s", i, 3.25, "alice");
+                } else if (macro == 2) {
+                    SERVER_LOG_FORMAT_INFO(logger, "bench message {} value {:.3f} user {}", i, 3.25, "alice");
+                } else {
+                    SERVER_LOG_INFO(logger) << "bench message " << i << " value " << 3.25 << " user " << "alice";
+                }
+                lat[i] = Server::GetCurrentNS() - start;
+            }
+        }, "bench_" + std::to_string(t)));
+    }
+    for (auto& w : workers) {
+        w->join();
+    }
+    uint64_t end = Server::GetCurrentNS();
+    std::cout.flush();
+
+    std::vector<uint32_t> all;
+    all.reserve(messages * threads);
+    for (auto& s : samples) {
+        all.insert(all.end(), s.begin(), s.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    auto pct = [&](double p) -> uint64_t {
+        return all.empty() ? 0 : all[std::min(all.size() - 1, (size_t)(all.size() * p))];
+    };
+
+    return Result{ appenderName, pattern.first, s_macros[macro], threads,
+                   messages * threads, (end - begin) / 1e9,
+                   pct(0.5), pct(0.99), pct(0.999), all.empty() ? 0 : all.back() };
+}
+
+static void Print(FILE* out, const Result& r, bool json) {
+    uint64_t rate = r.seconds > 0 ? r.messages / r.seconds : 0;
+    if (json) {
+        fprintf(out, "{\"appender\":\"%s\",\"pattern\":\"%s\",\"macro\":\"%s\",\"threads\":%d,"
+                     "\"messages\":%lu,\"msgs_per_sec\":%lu,\"p50_ns\":%lu,\"p99_ns\":%lu,"
+                     "\"p999_ns\":%lu,\"max_ns\":%lu}\n",
+                r.appender.c_str(), r.pattern.c_str(), r.macro.c_str(), r.threads,
+                r.messages, rate, r.p50, r.p99, r.p999, r.max);
+    } else {
+        fprintf(out, "%s,%s,%s,%d,%lu,%lu,%lu,%lu,%lu,%lu\n",
+                r.appender.c_str(), r.pattern.c_str(), r.macro.c_str(), r.threads,
+                r.messages, rate, r.p50, r.p99, r.p999, r.max);
+    }
+    fflush(out);
+}
+
+int main(int argc, char** argv) {
+    int maxThreads = 4;
+    uint64_t messages = 100000;
+    bool json = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:f:")) != -1) {
+        switch (opt) {
+            case 't':
+                maxThreads = std::max(1, atoi(optarg));
+                break;
+            case 'n':
+                messages = std::max(1L, atol(optarg));
+                break;
+            case 'f':
+                json = std::string(optarg) == "json";
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t max threads] [-n messages per thread] [-f csv|json]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    // results go to the real stdout, StdoutLogAppender writes to /dev/null
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    if (!json) {
+        fprintf(out, "appender,pattern,macro,threads,messages,msgs_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+    }
+
+    for (auto& appender : { "null", "stdout", "file", "file_batched", "rolling", "fanout" }) {
+        for (auto& pattern : s_patterns) {
+            for (int macro = 0; macro < 3; ++macro) {
+                for (int threads = 1; threads <= maxThreads; threads *= 2) {
+                    Print(out, Run(appender, pattern, macro, threads, messages), json);
+                }
+            }
+        }
+    }
+
+    unlink("./bench_logger.log");
+    system("rm -f ./bench_rolling.log*");
+    fclose(out);
+    return 0;
+}
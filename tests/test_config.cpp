@@ -1,7 +1,14 @@
 #include "../source/config.hpp"
 #include "../source/log.hpp"
+#include "../source/configwatcher.hpp"
+#include "../source/configcache.hpp"
+#include "../source/configtxn.hpp"
 
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <unistd.h>
 #include <yaml-cpp/yaml.h>
 
 // store two args into Mgr
@@ -233,11 +240,263 @@ void test_log() {
     SERVER_LOG_INFO(systemLog) << "hello system" << std::endl;
 }
 
+// readers keep a thread local handle while another thread changes the value
+void test_handle() {
+    auto arg = Server::ConfigMgr::lookUp("test.handle", (int)1, "handle test");
+    int calls = 0;
+    arg->addListener([&calls](const int& oldValue, const int& newValue) { ++calls; });
+
+    std::atomic<bool> stop{ false };
+    std::atomic<uint64_t> reads{ 0 }, stale{ 0 };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&]() {
+            static thread_local Server::ConfigArg<int>::Handle handle(arg);
+            int last = 0;
+            while (!stop) {
+                int v = handle.get();
+                // a reader never sees the value go back
+                stale += v < last;
+                last = v;
+                ++reads;
+            }
+        });
+    }
+
+    for (int v = 2; v <= 1000; ++v) {
+        arg->setValue(v);
+    }
+    arg->setValue(1000);    // same value, no listener call
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+
+    Server::ConfigArg<int>::Handle handle(arg);
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "handle: value = " << handle.get()
+                                       << " version = " << arg->getVersion()
+                                       << " listener calls = " << calls
+                                       << " reads = " << reads << " stale = " << stale;
+}
+
+// nested containers decoded from the parsed yaml, and printed back
+void test_node() {
+    auto nested = Server::ConfigMgr::lookUp("test.nested",
+                    std::map<std::string, std::vector<std::string>>(), "nested containers");
+    YAML::Node root = YAML::Load("test:\n"
+                                 "  nested:\n"
+                                 "    a: [x, 'y: z']\n"
+                                 "    b: []\n");
+    Server::ConfigMgr::loadFromYaml(root);
+
+    auto value = nested->getValue();
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "node: a = " << value["a"].size() << " items, a[1] = "
+                                       << value["a"][1] << ", b = " << value["b"].size() << " items";
+
+    // the string form decodes to the same value
+    auto copy = Server::LexicalCast<std::string, decltype(value)>()(nested->toString());
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "node: round trip equal = " << (copy == value);
+}
+
+// the watcher applies only what changed in the file
+void test_watcher() {
+    const char* path = "./watch_test.yaml";
+    auto write = [path](const std::string& text) {
+        // written next to it and renamed into place, as deploy tools do
+        std::string tmp = std::string(path) + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "w");
+        fwrite(text.data(), 1, text.size(), f);
+        fclose(f);
+        rename(tmp.c_str(), path);
+    };
+    write("watch:\n  port: 1\n  hosts: [a, b]\n  limits: {x: 1, y: 2}\n");
+
+    auto port = Server::ConfigMgr::lookUp("watch.port", 0, "watched port");
+    auto hosts = Server::ConfigMgr::lookUp("watch.hosts", std::vector<std::string>(), "watched hosts");
+    auto limits = Server::ConfigMgr::lookUp("watch.limits", std::map<std::string, int>(), "watched limits");
+    std::atomic<int> portCalls{ 0 }, hostsCalls{ 0 }, limitsCalls{ 0 };
+    port->addListener([&](const int&, const int&) { ++portCalls; });
+    hosts->addListener([&](const std::vector<std::string>&, const std::vector<std::string>&) { ++hostsCalls; });
+    limits->addListener([&](const std::map<std::string, int>&, const std::map<std::string, int>&) { ++limitsCalls; });
+
+    Server::IOManager iom(1, false, "watch");
+    Server::ConfigWatcher watcher(path, &iom);
+    watcher.start();
+    portCalls = hostsCalls = limitsCalls = 0;
+
+    // only limits.y changes, port and hosts are not touched
+    write("watch:\n  port: 1\n  hosts: [a, b]\n  limits: {x: 1, y: 3}\n");
+    // listeners run as tasks of the IOManager after the reload
+    for (int i = 0; i < 100 && (watcher.getReloads() == 0 || limitsCalls == 0); ++i) {
+        usleep(10 * 1000);
+    }
+    watcher.stop();
+
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "watcher: reloads = " << watcher.getReloads()
+                                       << " applied = " << watcher.getLastApplied()
+                                       << " calls port/hosts/limits = " << portCalls << "/"
+                                       << hostsCalls << "/" << limitsCalls
+                                       << " limits.y = " << limits->getValue().at("y");
+
+    // stopped from the only thread of its IOManager, which must run onEvent
+    Server::ConfigWatcher inside(path, &iom);
+    inside.start();
+    std::atomic<bool> stopped{ false };
+    iom.schedule([&]() {
+        inside.stop();
+        stopped = true;
+    });
+    for (int i = 0; i < 100 && !stopped; ++i) {
+        usleep(10 * 1000);
+    }
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "watcher: stopped from its IOManager = " << stopped;
+    unlink(path);
+}
+
+// many threads register the same names at once, each name is stored once
+void test_key() {
+    static Server::ConfigHandle<int> s_port{ CONFIG_KEY("test.key.port") };
+    // CONFIG_KEY("test.Key") would not compile
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "key: before lookUp " << (s_port.get() ? "found" : "null");
+
+    SERVER_LOG_ROOT()->setLevel(Server::LogLevel::Level::ERROR);
+    std::atomic<int> distinct{ 0 };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&distinct]() {
+            static Server::ConfigArg<int>::ptr s_first;
+            static Server::Mutex s_mutex;
+            for (int j = 0; j < 1000; ++j) {
+                auto arg = Server::ConfigMgr::lookUp("test.key.n" + std::to_string(j % 100), j);
+                if (j == 0) {
+                    Server::Mutex::Lock lock(s_mutex);
+                    if (s_first != arg) {
+                        s_first = arg;
+                        ++distinct;
+                    }
+                }
+            }
+            Server::ConfigMgr::lookUp("test.key.port", 8080);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    SERVER_LOG_ROOT()->setLevel(Server::LogLevel::Level::DEBUG);
+
+    size_t count = 0;
+    Server::ConfigMgr::Visit([&count](Server::ConfigArgBase::ptr arg) {
+        count += arg->getName().rfind("test.key.", 0) == 0;
+    });
+    bool conflict = Server::ConfigMgr::lookUp<float>(CONFIG_KEY("test.key.port")) == nullptr;
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "key: port = " << s_port->getValue()
+                                       << " args = " << count << " first arg stored " << distinct
+                                       << " time(s), float conflict = " << conflict;
+}
+
+// a second load of the same file is served from the binary snapshot
+void test_cache() {
+    const std::string yaml = "/tmp/test_cache.yml", cache = "/tmp/test_cache.yml.cache";
+    const std::string text = "cache:\n  port: 9090\n  ratio: 0.25\n  host: example.org\n"
+                             "  ids: [3, 1, 2]\n  later: 7\n";
+    std::ofstream(yaml) << text;
+    unlink(cache.c_str());
+
+    auto port = Server::ConfigMgr::lookUp("cache.port", 80);
+    auto ratio = Server::ConfigMgr::lookUp("cache.ratio", 1.0);
+    auto host = Server::ConfigMgr::lookUp("cache.host", std::string("localhost"));
+    auto ids = Server::ConfigMgr::lookUp("cache.ids", std::vector<int>());
+    Server::ConfigMgr::loadFromFile(yaml, cache);
+
+    port->setValue(80);
+    host->setValue("localhost");
+    ids->setValue({});
+    bool hit = Server::ConfigCache::Load(cache, Server::ConfigHash(text));
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "cache: hit = " << hit << " port = " << port->getValue()
+                                       << " ratio = " << ratio->getValue() << " host = " << host->getValue()
+                                       << " ids = " << ids->toString().size() << " bytes";
+
+    // a key without an arg when the snapshot was written has one now
+    auto later = Server::ConfigMgr::lookUp("cache.later", 0);
+    bool stale = !Server::ConfigMgr::loadFromFile(yaml, cache) || later->getValue() != 7;
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "cache: later = " << later->getValue() << " stale = " << stale;
+    unlink(yaml.c_str());
+    unlink(cache.c_str());
+}
+
+// a pool size and its queue limit change together, readers never see
+// one without the other, listeners run on a scheduler once per commit
+void test_txn() {
+    auto size = Server::ConfigMgr::lookUp("txn.pool.size", 1, "pool size");
+    auto queue = Server::ConfigMgr::lookUp("txn.pool.queue", 10, "queue limit, size * 10");
+    std::atomic<int> sizeCalls{ 0 }, queueCalls{ 0 };
+    std::atomic<bool> ordered{ true };
+    size->addListener([&](const int& oldValue, const int& newValue) {
+        ordered = ordered && newValue > oldValue;
+        ++sizeCalls;
+    });
+    queue->addListener([&](const int&, const int&) { ++queueCalls; });
+
+    std::atomic<bool> stop{ false };
+    std::atomic<uint64_t> reads{ 0 }, torn{ 0 };
+    std::thread reader([&]() {
+        while (!stop) {
+            int s, q;
+            Server::ConfigTransaction::Read([&]() {
+                s = size->getValue();
+                q = queue->getValue();
+            });
+            torn += q != s * 10;
+            ++reads;
+        }
+    });
+
+    Server::Scheduler sc(2, false, "txn");
+    sc.start();
+    const int commits = 10000;
+    for (int i = 2; i <= commits; ++i) {
+        Server::ConfigTransaction txn;
+        txn.set(size, i - 1);
+        txn.set(size, i);           // replaces the staged value
+        txn.set<int>("txn.pool.queue", i * 10);
+        txn.commit(&sc);
+    }
+    stop = true;
+    reader.join();
+    sc.stop();
+
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "txn: size = " << size->getValue() << " queue = " << queue->getValue()
+                                       << " reads = " << reads << " torn = " << torn
+                                       << " listener calls " << sizeCalls << "/" << queueCalls
+                                       << " for " << commits - 1 << " commits, ordered = " << ordered;
+
+    // a setValue while a commit is still to be reported reports both once
+    auto level = Server::ConfigMgr::lookUp("txn.level", std::string("a"));
+    std::string seen;
+    level->addListener([&seen](const std::string& oldValue, const std::string& newValue) {
+        seen += oldValue + "->" + newValue + " ";
+    });
+    Server::Scheduler later(1, false, "txn_later");
+    Server::ConfigTransaction txn;
+    txn.set(level, "b");
+    txn.commit(&later);             // queued, the scheduler is not started
+    level->setValue("c");
+    later.start();
+    later.stop();
+    SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "txn: pending then setValue, listener saw " << seen;
+}
+
 int main() {
     // SERVER_LOG_INFO(SERVER_LOG_ROOT()) << "main start" << std::endl;
     // test_yaml();
     // test_config();
     // test_class();
+    test_handle();
+    test_node();
+    test_watcher();
+    test_key();
+    test_cache();
+    test_txn();
     
     test_log();
 
@@ -0,0 +1,257 @@
+#include "../source/headers.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+Server::Logger::ptr g_logger = SERVER_LOG_ROOT();
+
+// a fiber waits for READ on a socket without blocking its thread
+void test_event() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+
+    std::atomic<bool> done{ false };
+    {
+        Server::IOManager iom(1, false, "iom");
+        iom.schedule([&]() {
+            Server::IOManager::getThis()->addEvent(fds[0], Server::IOManager::READ);
+            Server::Fiber::yieldToHold();
+
+            char buf[16] = { 0 };
+            ssize_t n = read(fds[0], buf, sizeof(buf) - 1);
+            SERVER_LOG_INFO(g_logger) << "fiber read " << n << " bytes: " << buf;
+            done = true;
+        });
+
+        usleep(100 * 1000);
+        write(fds[1], "hello", 5);
+    }
+    SERVER_LOG_INFO(g_logger) << "test_event done = " << done;
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// stand-in for a log collector: a listening socket whose accepted
+// connections are read into one string on a plain thread
+class Collector {
+public:
+    // unix stream socket at path, or a loopback tcp/udp port picked by the kernel
+    Collector(const std::string& path, bool dgram = false): m_path{ path }, m_dgram{ dgram } {
+        if (!m_path.empty()) {
+            unlink(m_path.c_str());
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, m_path.c_str());
+            m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            bind(m_fd, (sockaddr*)&addr, sizeof(addr));
+            listen(m_fd, 16);
+        } else {
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            m_fd = socket(AF_INET, m_dgram ? SOCK_DGRAM : SOCK_STREAM, 0);
+            bind(m_fd, (sockaddr*)&addr, sizeof(addr));
+            socklen_t len = sizeof(addr);
+            getsockname(m_fd, (sockaddr*)&addr, &len);
+            m_port = ntohs(addr.sin_port);
+            if (!m_dgram) {
+                listen(m_fd, 16);
+            }
+        }
+        m_thread = std::thread(&Collector::run, this);
+    }
+
+    ~Collector() { stop(); }
+
+    void stop() {
+        if (m_fd < 0) {
+            return;
+        }
+        m_stopping = true;
+        shutdown(m_fd, SHUT_RDWR);
+        int conn = m_conn.exchange(-1);
+        if (conn >= 0) {
+            shutdown(conn, SHUT_RDWR);
+        }
+        m_thread.join();
+        close(m_fd);
+        m_fd = -1;
+        if (!m_path.empty()) {
+            unlink(m_path.c_str());
+        }
+    }
+
+    // drop the current connection, the appender has to reconnect
+    void kick() {
+        int conn = m_conn.exchange(-1);
+        if (conn >= 0) {
+            shutdown(conn, SHUT_RDWR);
+        }
+    }
+
+    size_t lines() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t n = 0;
+        for (char c : m_data) {
+            n += c == '\n';
+        }
+        return n;
+    }
+
+    bool waitLines(size_t n, int ms = 3000) {
+        for (int i = 0; i < ms / 10 && lines() < n; ++i) {
+            usleep(10 * 1000);
+        }
+        return lines() >= n;
+    }
+
+    int getPort() const { return m_port; }
+
+private:
+    void run() {
+        char buf[4096];
+        if (m_dgram) {
+            ssize_t n;
+            while ((n = recv(m_fd, buf, sizeof(buf), 0)) > 0) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_data.append(buf, n);
+            }
+            return;
+        }
+
+        while (!m_stopping) {
+            int conn = accept(m_fd, nullptr, nullptr);
+            if (conn < 0) {
+                break;
+            }
+            m_conn = conn;
+            ssize_t n;
+            while ((n = read(conn, buf, sizeof(buf))) > 0) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_data.append(buf, n);
+            }
+            m_conn = -1;
+            close(conn);
+        }
+    }
+
+private:
+    std::string m_path;
+    bool m_dgram;
+    int m_fd = -1;
+    int m_port = 0;
+    std::atomic<int> m_conn{ -1 };
+    std::atomic<bool> m_stopping{ false };
+    std::mutex m_mutex;
+    std::string m_data;
+    std::thread m_thread;
+};
+
+void test_socket_appender() {
+    Server::Logger::ptr logger(new Server::Logger("socket"));
+    logger->setFormatter("%p%T%m%n");
+
+    // lines logged before the collector exists wait in the spool
+    Server::SocketLogOptions options;
+    options.retryMin = 20;
+    options.retryMax = 100;
+    Server::SocketLogAppender::ptr appender(
+        new Server::SocketLogAppender("unix://./socket_log.sock", options));
+    logger->addAppender(appender);
+    for (int i = 0; i < 10; ++i) {
+        SERVER_LOG_INFO(logger) << "spooled " << i;
+    }
+    usleep(50 * 1000);
+
+    Collector collector("./socket_log.sock");
+    bool ok = collector.waitLines(10);
+    SERVER_LOG_INFO(g_logger) << "spooled lines arrived = " << ok
+                              << " connected = " << appender->isConnected();
+
+    // the collector goes away and comes back, the appender reconnects
+    collector.kick();
+    for (int i = 0; i < 1000; ++i) {
+        SERVER_LOG_INFO(logger) << "after reconnect " << i;
+    }
+    ok = collector.waitLines(1010);
+    SERVER_LOG_INFO(g_logger) << "lines after reconnect = " << collector.lines()
+                              << " sent = " << appender->getSent()
+                              << " dropped = " << appender->getDropped();
+    std::cout << appender->toYamlString() << std::endl;
+}
+
+// the collector stops reading, logging threads neither block nor grow
+// memory, the oldest lines are dropped once the spool is full
+void test_socket_backpressure() {
+    Server::Logger::ptr logger(new Server::Logger("socket"));
+    logger->setFormatter("%m%n");
+
+    // listener which never reads
+    unlink("./socket_stall.sock");
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, "./socket_stall.sock");
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bind(lfd, (sockaddr*)&addr, sizeof(addr));
+    listen(lfd, 16);
+
+    Server::SocketLogOptions options;
+    options.spoolSize = 64 * 1024;
+    Server::SocketLogAppender::ptr appender(
+        new Server::SocketLogAppender("unix://./socket_stall.sock", options));
+    logger->addAppender(appender);
+
+    uint64_t start = Server::GetCurrentNS();
+    std::string payload(200, 'x');
+    for (int i = 0; i < 20000; ++i) {
+        SERVER_LOG_INFO(logger) << i << " " << payload;
+    }
+    SERVER_LOG_INFO(g_logger) << "20000 lines in " << (Server::GetCurrentNS() - start) / 1000000
+                              << " ms, sent = " << appender->getSent()
+                              << " dropped = " << appender->getDropped();
+
+    // dropped while the drain fiber waits for WRITE, the fiber lets it go
+    // once the collector goes away
+    std::weak_ptr<Server::SocketLogAppender> weak = appender;
+    logger->clearAppenders();
+    appender.reset();
+    close(lfd);
+    unlink("./socket_stall.sock");
+    for (int i = 0; i < 100 && !weak.expired(); ++i) {
+        usleep(10 * 1000);
+    }
+    SERVER_LOG_INFO(g_logger) << "appender released = " << weak.expired();
+}
+
+void test_udp_appender() {
+    Collector collector("", true);
+    Server::Logger::ptr logger(new Server::Logger("udp"));
+    logger->setFormatter("%m%n");
+    Server::SocketLogAppender::ptr appender(new Server::SocketLogAppender(
+        "udp://127.0.0.1:" + std::to_string(collector.getPort())));
+    logger->addAppender(appender);
+
+    for (int i = 0; i < 100; ++i) {
+        SERVER_LOG_INFO(logger) << "datagram " << i;
+    }
+    bool ok = collector.waitLines(100);
+    SERVER_LOG_INFO(g_logger) << "udp lines arrived = " << ok << " (" << collector.lines() << ")";
+}
+
+int main() {
+    test_event();
+    test_socket_appender();
+    test_socket_backpressure();
+    test_udp_appender();
+    return 0;
+}
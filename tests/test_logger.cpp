@@ -1,7 +1,469 @@
 #include "../source/log.hpp"
+#include "../source/binlog.hpp"
+#include "../source/logfile.hpp"
+#include "../source/recorder.hpp"
 #include "../source/util.hpp"
+#include "../source/config.hpp"
 #include <iostream>
 #include <thread>
+#include <atomic>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// events are handed to a background thread and written by the wrapped appender
+void test_async() {
+    Server::Logger::ptr logger(new Server::Logger("async"));
+    Server::AsyncLogAppender::ptr appender(new Server::AsyncLogAppender(
+        Server::LogAppender::ptr(new Server::StdoutLogAppender), 16,
+        Server::AsyncLogAppender::OverflowPolicy::DROP_DEBUG_FIRST));
+    logger->addAppender(appender);
+
+    for (int i = 0; i < 64; ++i) {
+        SERVER_LOG_DEBUG(logger) << "async debug " << i;
+        SERVER_LOG_INFO(logger) << "async info " << i;
+    }
+
+    appender->flush();
+    std::cout << appender->toYamlString() << std::endl;
+    std::cout << "dropped = " << appender->getDropped() << std::endl;
+}
+
+// pooled events are reused, oversize messages move to the heap and
+// manipulators do not leak into the next event
+void test_pool() {
+    Server::Logger::ptr logger(new Server::Logger("pool"));
+    logger->addAppender(Server::LogAppender::ptr(new Server::StdoutLogAppender));
+
+    SERVER_LOG_INFO(logger) << "hex " << std::hex << 255;
+    SERVER_LOG_INFO(logger) << "dec " << 255;
+    SERVER_LOG_INFO(logger) << "long " << std::string(2 * Server::LogStreamBuf::INLINE_SIZE, 'x').size()
+                            << " " << std::string(2 * Server::LogStreamBuf::INLINE_SIZE, 'x');
+    SERVER_LOG_INFO(logger) << "short again";
+}
+
+// sub-second timestamps and elapsed milliseconds since process start
+void test_time() {
+    Server::Logger::ptr logger(new Server::Logger("time"));
+    logger->setFormatter("%d{%Y-%m-%d %H:%M:%S.%3f}%T%d{%6f}%T%r ms%T%m%n");
+    logger->addAppender(Server::LogAppender::ptr(new Server::StdoutLogAppender));
+
+    for (int i = 0; i < 3; ++i) {
+        SERVER_LOG_INFO(logger) << "tick " << i;
+        usleep(1500);
+    }
+
+    // across re-anchors no thread sees the time go back, all stay near the real clock
+    std::atomic<int> back{ 0 };
+    std::atomic<uint64_t> drift{ 0 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            uint64_t last = 0;
+            uint64_t end = Server::GetCurrentNS() + 1500ull * 1000 * 1000;
+            while (last < end) {
+                struct timespec a, b;
+                clock_gettime(CLOCK_REALTIME, &a);
+                uint64_t now = Server::GetCurrentNS();
+                clock_gettime(CLOCK_REALTIME, &b);
+                back += now < last;
+                last = now;
+
+                // drift against the real clock read around it, unless preempted meanwhile
+                uint64_t before = a.tv_sec * 1000000000ull + a.tv_nsec;
+                uint64_t after = b.tv_sec * 1000000000ull + b.tv_nsec;
+                if (after - before > 100000) {
+                    continue;
+                }
+                uint64_t d = now < before ? before - now : (now > after ? now - after : 0);
+                uint64_t max = drift;
+                while (d > max && !drift.compare_exchange_weak(max, d));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    std::cout << "time went back " << back << " times, drift under 1ms = "
+              << (drift < 1000000) << std::endl;
+}
+
+void test_binlog() {
+    Server::Logger::ptr logger(new Server::Logger("binlog"));
+    logger->addAppender(Server::LogAppender::ptr(new Server::StdoutLogAppender));    // formatted on the spot
+
+    unlink("./binlog.bin");
+    Server::BinaryFileLogAppender::ptr bin(new Server::BinaryFileLogAppender("./binlog.bin"));
+    logger->addAppender(bin);
+
+    std::string name = "binary";
+    for (int i = 0; i < 3; ++i) {
+        SERVER_LOG_BIN_INFO(logger, "%s log %d of %u, ratio %.2f", name, i, 3u, i / 3.0);
+    }
+    SERVER_LOG_BIN_WARN(logger, "no arguments");
+    SERVER_LOG_BIN_INFO(logger, "[%*d] [%-*s] [%.*f] [%.*s]", 5, 42, 4, "ab", 2, 3.14159, -1, "all");
+    SERVER_LOG_INFO(logger) << "stream event in binary file";
+    bin->flush();
+
+    // a quiet stream reaches the file within the flush interval
+    struct stat before, after;
+    stat("./binlog.bin", &before);
+    SERVER_LOG_BIN_DEBUG(logger, "quiet %d", 1);
+    usleep(1500 * 1000);
+    stat("./binlog.bin", &after);
+    std::cout << "binlog written by the flusher = " << (after.st_size > before.st_size) << std::endl;
+}
+
+void test_sites() {
+    Server::Logger::ptr logger(new Server::Logger("sites"));
+    logger->setLevel(Server::LogLevel::Level::INFO);
+    logger->addAppender(Server::LogAppender::ptr(new Server::StdoutLogAppender));
+
+    auto noisy = [&](int round) {
+        SERVER_LOG_DEBUG(logger) << "noisy call site, round " << round;
+        SERVER_LOG_DEBUG(logger) << "other call site, round " << round;
+    };
+
+    noisy(0);   // nothing, logger level is INFO
+
+    // switch on the first statement of noisy only
+    int line = __LINE__ - 7;
+    YAML::Node root = YAML::Load("log_sites: [test_logger.cpp:" + std::to_string(line) + "]");
+    Server::ConfigMgr::loadFromYaml(root);
+    noisy(1);
+
+    for (auto& i : Server::LogCallSiteMgr::getInstance()->getEnabled()) {
+        std::cout << "enabled site " << i << std::endl;
+    }
+
+    Server::ConfigMgr::loadFromYaml(YAML::Load("log_sites: []"));
+    noisy(2);
+}
+
+void test_rolling() {
+    // siblings which are not archives survive retention
+    system("rm -rf ./rolling && mkdir -p ./rolling && touch ./rolling/test.log.idx ./rolling/test.log.bak");
+
+    Server::RollingFileOptions options;
+    options.maxSize = 4096;
+    options.maxFiles = 2;
+    options.compress = true;
+
+    Server::Logger::ptr logger(new Server::Logger("rolling"));
+    {
+        Server::RollingFileLogAppender::ptr appender(
+            new Server::RollingFileLogAppender("./rolling/test.log", options));
+        logger->addAppender(appender);
+
+        // 4 segments, the background thread needs a moment to prepare each next one
+        for (int i = 0; i < 4; ++i) {
+            for (int n = 0; n < 40; ++n) {
+                SERVER_LOG_INFO(logger) << "rolling segment " << i << " line " << n;
+            }
+            usleep(20 * 1000);
+        }
+        logger->clearAppenders();
+    }
+
+    // test.log plus the 2 newest compressed segments, .bak and .idx
+    system("ls ./rolling | sort; wc -c ./rolling/test.log");
+}
+
+void test_limit() {
+    Server::Logger::ptr logger(new Server::Logger("limit"));
+    logger->addAppender(Server::LogAppender::ptr(new Server::StdoutLogAppender));
+
+    // 5 of 50, with one summary when the next second starts
+    for (int i = 0; i < 50; ++i) {
+        SERVER_LOG_EVERY_N(logger, Server::LogLevel::Level::INFO, 10) << "sampled " << i;
+        if (i == 39) {
+            usleep(1100 * 1000);
+        }
+    }
+
+    // a burst of 3, then roughly 3 per second
+    uint64_t end = Server::GetCurrentNS() + 1500ull * 1000 * 1000;
+    int n = 0;
+    while (Server::GetCurrentNS() < end) {
+        SERVER_LOG_RATE_LIMITED(logger, Server::LogLevel::Level::ERROR, 3) << "downstream failed " << n;
+        ++n;
+    }
+    std::cout << "rate limited loop ran " << n << " times" << std::endl;
+
+    // nothing gets through anymore, the flusher reports what is left of both sites
+    usleep(2100 * 1000);
+}
+
+static Server::LoggerHandle g_handle("handle");
+
+void test_registry() {
+    auto mgr = Server::LoggerMgr::getInstance();
+
+    // concurrent creation and lookup of the same names
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([mgr]() {
+            for (int i = 0; i < 200; ++i) {
+                mgr->getLogger("registry_" + std::to_string(i));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (int i = 0; i < 200; ++i) {
+        std::string name = "registry_" + std::to_string(i);
+        if (mgr->getLogger(name)->getName() != name || !mgr->findLogger(name)) {
+            std::cout << "registry lookup failed " << name << std::endl;
+        }
+    }
+    std::cout << "unknown logger found: " << (mgr->findLogger("registry_none") != nullptr) << std::endl;
+
+    // the handle is the same logger the manager returns
+    std::cout << "handle resolved: " << (g_handle.get() == mgr->getLogger("handle")) << std::endl;
+    g_handle->setLevel(Server::LogLevel::Level::WARN);
+    SERVER_LOG_INFO(g_handle) << "filtered by handle level";
+    SERVER_LOG_WARN(g_handle) << "logged through handle";
+}
+
+// DEBUG lines below the logger level are kept by the recorder and dumped on request
+void test_recorder() {
+    Server::Logger::ptr logger(new Server::Logger("recorder"));
+    logger->addAppender(Server::LogAppender::ptr(new Server::StdoutLogAppender));
+    logger->setLevel(Server::LogLevel::Level::INFO);
+    logger->setRecorder(true, Server::LogLevel::Level::DEBUG);
+
+    std::thread t([logger]() {
+        for (int i = 0; i < 3; ++i) {
+            SERVER_LOG_DEBUG(logger) << "worker step " << i;
+        }
+    });
+    t.join();
+
+    for (int i = 0; i < 3; ++i) {
+        SERVER_LOG_DEBUG(logger) << "recorded only " << i;
+        SERVER_LOG_BIN_DEBUG(logger, "binary recorded %d", i);
+    }
+    SERVER_LOG_INFO(logger) << "recorded and logged";
+
+    Server::FlightRecorder::Dump(STDOUT_FILENO);
+}
+
+struct Point {
+    int x;
+    int y;
+};
+
+std::ostream& operator<<(std::ostream& os, const Point& p) {
+    return os << "(" << p.x << ", " << p.y << ")";
+}
+
+// "{}" format, a wrong argument count or type does not compile
+void test_format() {
+    Server::Logger::ptr logger(new Server::Logger("format"));
+    logger->addAppender(Server::LogAppender::ptr(new Server::StdoutLogAppender));
+    logger->setFormatter("%m%n");
+
+    std::string user = "alice";
+    SERVER_LOG_FORMAT_INFO(logger, "user {} took {:.3f} ms, {} retries", user, 12.34567, 3);
+    SERVER_LOG_FORMAT_INFO(logger, "hex {:x} [{:<4}] {:08X} bin {:b} oct {:o}", 255, 7, -3054, 5u, 8);
+    SERVER_LOG_FORMAT_INFO(logger, "[{:>8}] [{:<8}] [{:.3}] {}", "right", "left", "truncate", std::string_view("view"));
+    SERVER_LOG_FORMAT_INFO(logger, "{} {:d} {} {:d} {} {:e} {}", true, false, 'c', 'A', 0.1, 1234.5, -2.0f);
+    SERVER_LOG_FORMAT_INFO(logger, "point {} null {} {{escaped}}", Point{ 1, 2 }, (const char*)nullptr);
+    SERVER_LOG_FORMAT_INFO(logger, "no arguments");
+    SERVER_LOG_FMT_INFO(logger, "printf %s %d %.2f", "still", 42, 2.5);
+
+    std::string big(1000, 'x');
+    SERVER_LOG_FORMAT_INFO(logger, "big {} end", big);
+    SERVER_LOG_FMT_INFO(logger, "big %s end", big.c_str());
+}
+
+// appenders of the same pattern share one rendered buffer of an event
+void test_fanout() {
+    Server::Logger::ptr logger(new Server::Logger("fanout"));
+    Server::LogFormatter::ptr a(new Server::LogFormatter("%p %m%n"));
+    Server::LogFormatter::ptr b(new Server::LogFormatter("%p %m%n"));
+    Server::LogFormatter::ptr c(new Server::LogFormatter("%m%n"));
+
+    auto event = Server::LogEventPool::Acquire(logger, Server::LogLevel::Level::INFO, __FILE__, __LINE__);
+    event->getSS() << "shared";
+    auto& ta = a->render(logger, Server::LogLevel::Level::INFO, event);
+    auto& tb = b->render(logger, Server::LogLevel::Level::INFO, event);
+    auto& tc = c->render(logger, Server::LogLevel::Level::INFO, event);
+    std::cout << "same pattern shared: " << (ta == tb) << " other pattern shared: " << (ta == tc)
+              << " text: " << *ta;
+}
+
+static size_t FileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+// lines stay buffered until the policy flushes them
+void test_flush() {
+    const char* path = "./flush.log";
+    unlink(path);
+
+    Server::Logger::ptr logger(new Server::Logger("flush"));
+    Server::FileLogAppender::ptr file(new Server::FileLogAppender(path));
+    Server::LogFlushPolicy policy;
+    policy.line = false;
+    policy.interval = 50;
+    policy.level = Server::LogLevel::Level::ERROR;
+    file->setFlushPolicy(policy);
+    logger->addAppender(file);
+
+    for (int i = 0; i < 10; ++i) {
+        SERVER_LOG_INFO(logger) << "buffered " << i;
+    }
+    std::cout << "flush: after info " << FileSize(path);
+    SERVER_LOG_ERROR(logger) << "error flushes";
+    size_t afterError = FileSize(path);
+    std::cout << ", after error " << (afterError > 0);
+
+    SERVER_LOG_INFO(logger) << "written by the flusher thread";
+    usleep(200 * 1000);
+    std::cout << ", after interval " << (FileSize(path) > afterError) << std::endl;
+    unlink(path);
+}
+
+// a slow appender counting what reaches it per level
+class CountingAppender : public Server::LogAppender {
+public:
+    void log(Server::Logger::ptr, Server::LogLevel::Level level, Server::LogEvent::ptr) override {
+        usleep(10);
+        ++counts[(int)level];
+    }
+    std::string toYamlString() override { return "type: CountingAppender"; }
+    std::string getTypeName() const override { return "CountingAppender"; }
+
+    std::atomic<int> counts[6] = {};
+};
+
+// a DEBUG flood fills its own lane, ERROR lines are neither dropped nor
+// queued behind it
+void test_lanes() {
+    Server::Logger::ptr logger(new Server::Logger("lanes"));
+    std::shared_ptr<CountingAppender> counter(new CountingAppender);
+    auto lanes = Server::AsyncLogAppender::DefaultLanes(64,
+                    Server::AsyncLogAppender::OverflowPolicy::DROP_OLDEST);
+    Server::AsyncLogAppender::ptr async(new Server::AsyncLogAppender(counter, lanes));
+    logger->addAppender(async);
+
+    for (int i = 0; i < 10000; ++i) {
+        if (i % 100 == 0) {
+            SERVER_LOG_ERROR(logger) << "error " << i;
+        } else {
+            SERVER_LOG_DEBUG(logger) << "debug " << i;
+        }
+    }
+    async->flush();
+
+    std::cout << "lanes: error " << counter->counts[(int)Server::LogLevel::Level::ERROR] << "/100"
+              << " debug " << counter->counts[(int)Server::LogLevel::Level::DEBUG] << "/9900"
+              << " dropped error " << async->getDropped(Server::AsyncLogAppender::LANE_ERROR)
+              << " debug " << async->getDropped(Server::AsyncLogAppender::LANE_DEBUG) << std::endl;
+    std::cout << async->toYamlString() << std::endl;
+}
+
+// counters of a managed logger, read back through the manager snapshot
+void test_stats() {
+    const char* path = "./stats.log";
+    unlink(path);
+
+    auto& logger = Server::LoggerMgr::getInstance()->getLogger("stats");
+    Server::FileLogAppender::ptr file(new Server::FileLogAppender(path));
+    file->setLevel(Server::LogLevel::Level::WARN);
+    std::shared_ptr<CountingAppender> counter(new CountingAppender);
+    Server::AsyncLogAppender::ptr async(new Server::AsyncLogAppender(counter));
+    logger->addAppender(file);
+    logger->addAppender(async);
+
+    for (int i = 0; i < 100; ++i) {
+        if (i % 10 == 0) {
+            SERVER_LOG_WARN(logger) << "warn " << i;
+        } else {
+            SERVER_LOG_INFO(logger) << "info " << i;
+        }
+    }
+    file->flush();
+    async->flush();
+
+    for (auto& stats : Server::LoggerMgr::getInstance()->stats()) {
+        if (stats.name != "stats") {
+            continue;
+        }
+        std::cout << "stats: logger accepted " << stats.counters[Server::LogStats::ACCEPTED] << "/100";
+        for (auto& a : stats.appenders) {
+            std::cout << ", " << a.type << " accepted " << a.counters[Server::LogStats::ACCEPTED]
+                      << " filtered " << a.counters[Server::LogStats::FILTERED]
+                      << " bytes " << a.counters[Server::LogStats::BYTES];
+        }
+        std::cout << std::endl;
+    }
+    std::cout << Server::LoggerMgr::getInstance()->statsToJsonString() << std::endl;
+    logger->clearAppenders();
+    unlink(path);
+
+    // format and write are both timed, each formatted event also flushes
+    Server::Logger::ptr timed(new Server::Logger("stats_time"));
+    Server::FileLogAppender::ptr timedFile(new Server::FileLogAppender(path));
+    timed->addAppender(timedFile);
+    for (int i = 0; i < 1000; ++i) {
+        SERVER_LOG_INFO(timed) << "timed " << i;
+    }
+    auto counters = timedFile->getStats().snapshot();
+    std::cout << "stats: format timed " << (counters[Server::LogStats::FORMAT_NS] > 0)
+              << " io timed " << (counters[Server::LogStats::IO_NS] > 0) << std::endl;
+    timed->clearAppenders();
+    unlink(path);
+}
+
+// FileLogAppender keeps a time index next to the file, the index finds
+// the byte range of a time range
+void test_index() {
+    const char* path = "./index.log";
+    unlink(path);
+    unlink(Server::LogIndex::PathOf(path).c_str());
+    {
+        Server::Logger::ptr logger(new Server::Logger("index"));
+        Server::FileLogAppender::ptr file(new Server::FileLogAppender(path));
+        file->setIndex(1);
+        logger->addAppender(file);
+        for (int i = 0; i < 1000; ++i) {
+            SERVER_LOG_INFO(logger) << "indexed " << i;
+        }
+        logger->clearAppenders();
+    }
+
+    Server::LogIndexReader reader;
+    bool ok = reader.open(Server::LogIndex::PathOf(path));
+    uint64_t lines = 0, bytes = 0;
+    for (auto& e : reader.getEntries()) {
+        lines += e.lines;
+        bytes += e.length;
+    }
+    std::cout << "index: open " << ok << " lines " << lines << "/1000"
+              << " bytes " << bytes << "/" << FileSize(path);
+
+    // buckets of 10 seconds written with made up times
+    const char* idx = "./index.test.idx";
+    Server::LogIndexWriter writer;
+    writer.open(idx, 10, 0);
+    for (uint64_t t = 1000; t < 1100; ++t) {
+        writer.add(t, (t - 1000) * 100, 100, (int)Server::LogLevel::Level::INFO, "index");
+    }
+    writer.close();
+    reader.open(idx);
+    auto range = reader.find(1035, 1052);
+    auto& e = reader.getEntries();
+    std::cout << ", entries " << e.size() << " find [" << e[range.first].offset << ", "
+              << e[range.second - 1].offset + e[range.second - 1].length << ")" << std::endl;
+    unlink(idx);
+    unlink(path);
+    unlink(Server::LogIndex::PathOf(path).c_str());
+}
 
 int main(){
     // Server::Logger::ptr logger(new Server::Logger); 
@@ -32,5 +494,21 @@ int main(){
     
     SERVER_LOG_INFO(l) << "xxx";
 
+    test_pool();
+    test_time();
+    test_async();
+    test_binlog();
+    test_sites();
+    test_rolling();
+    test_limit();
+    test_registry();
+    test_recorder();
+    test_format();
+    test_fanout();
+    test_flush();
+    test_lanes();
+    test_stats();
+    test_index();
+
     return 0;
 }
\ No newline at end of file
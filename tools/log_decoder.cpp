@@ -0,0 +1,198 @@
+#include "../source/binlog.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <unordered_map>
+
+// Decode a file written by BinaryFileLogAppender into text lines
+//   log_decoder <file> [pattern]
+// pattern uses LogFormatter syntax, %c is always "binlog"
+
+struct SiteInfo {
+    Server::LogLevel::Level level;
+    int32_t line;
+    std::string file;
+    std::string format;
+    std::string signature;
+};
+
+class Reader {
+public:
+    Reader(const char* begin, const char* end): m_p{ begin }, m_end{ end } {}
+
+    template<typename T>
+    bool get(T& v) {
+        if (m_end - m_p < (ptrdiff_t)sizeof(T)) {
+            return false;
+        }
+        memcpy(&v, m_p, sizeof(T));
+        m_p += sizeof(T);
+        return true;
+    }
+
+    bool get(std::string& v, size_t len) {
+        if (m_end - m_p < (ptrdiff_t)len) {
+            return false;
+        }
+        v.assign(m_p, len);
+        m_p += len;
+        return true;
+    }
+
+    bool skip(size_t len, const char*& data) {
+        if (m_end - m_p < (ptrdiff_t)len) {
+            return false;
+        }
+        data = m_p;
+        m_p += len;
+        return true;
+    }
+
+    bool eof() const { return m_p >= m_end; }
+
+private:
+    const char* m_p;
+    const char* m_end;
+};
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <file> [pattern]" << std::endl;
+        return 1;
+    }
+
+    std::string pattern = argc > 2 ? argv[2]
+                        : "%d{%Y-%m-%d %H:%M:%S.%6f}%T%t%T%F%T[%p]%T%f:%l%T%m%n";
+    Server::LogFormatter::ptr formatter(new Server::LogFormatter(pattern));
+    if (formatter->isError()) {
+        std::cerr << "invalid pattern: " << pattern << std::endl;
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "open " << argv[1] << " failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size < (off_t)sizeof(Server::BinLog::MAGIC)) {
+        std::cerr << "file too short" << std::endl;
+        return 1;
+    }
+
+    const char* data = (const char*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cerr << "mmap failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    if (memcmp(data, Server::BinLog::MAGIC, sizeof(Server::BinLog::MAGIC))) {
+        std::cerr << "not a binary log file" << std::endl;
+        return 1;
+    }
+
+    Server::Logger::ptr logger(new Server::Logger("binlog"));
+    Server::LogEvent::ptr event(new Server::LogEvent);
+    std::string threadName;
+    std::unordered_map<uint32_t, SiteInfo> sites;
+    std::string msg;
+    std::string out;
+    uint64_t events = 0;
+
+    Reader r(data + sizeof(Server::BinLog::MAGIC), data + st.st_size);
+    bool ok = true;
+    while (ok && !r.eof()) {
+        uint8_t type = 0;
+        ok = r.get(type);
+        if (!ok) {
+            break;
+        }
+
+        if (type == Server::BinLog::SITE) {
+            uint32_t id;
+            uint8_t level = 0, sigLen = 0;
+            uint16_t fileLen, fmtLen;
+            SiteInfo site;
+            ok = r.get(id) && r.get(level) && r.get(site.line)
+                && r.get(fileLen) && r.get(site.file, fileLen)
+                && r.get(fmtLen) && r.get(site.format, fmtLen)
+                && r.get(sigLen) && r.get(site.signature, sigLen);
+            site.level = (Server::LogLevel::Level)level;
+            if (ok) {
+                sites[id] = std::move(site);
+            }
+            continue;
+        }
+
+        uint8_t level = 0;
+        uint64_t timeNs = 0;
+        uint32_t threadId = 0, fiberId = 0;
+        const char* file = "";
+        int32_t line = 0;
+        msg.clear();
+
+        if (type == Server::BinLog::EVENT) {
+            uint32_t id, size;
+            const char* payload;
+            ok = r.get(id) && r.get(level) && r.get(timeNs) && r.get(threadId)
+                && r.get(fiberId) && r.get(size) && r.skip(size, payload);
+            if (!ok) {
+                break;
+            }
+
+            auto it = sites.find(id);
+            if (it == sites.end()) {
+                msg = "<<unknown call site " + std::to_string(id) + ">>";
+            } else {
+                file = it->second.file.c_str();
+                line = it->second.line;
+                if (!Server::BinLog::Format(msg, it->second.format.c_str(), it->second.signature.c_str(),
+                                            payload, size)) {
+                    msg += "<<truncated arguments>>";
+                }
+            }
+        } else if (type == Server::BinLog::TEXT) {
+            uint16_t fileLen;
+            uint32_t msgLen;
+            const char* fileData;
+            const char* msgData;
+            ok = r.get(level) && r.get(timeNs) && r.get(threadId) && r.get(fiberId)
+                && r.get(line) && r.get(fileLen) && r.skip(fileLen, fileData)
+                && r.get(msgLen) && r.skip(msgLen, msgData);
+            if (!ok) {
+                break;
+            }
+
+            static std::string s_file;
+            s_file.assign(fileData, fileLen);
+            file = s_file.c_str();
+            msg.assign(msgData, msgLen);
+        } else {
+            std::cerr << "corrupted record type " << (int)type << std::endl;
+            ok = false;
+            break;
+        }
+
+        event->reset(logger.get(), (Server::LogLevel::Level)level, file, line,
+                    threadId, fiberId, timeNs, &threadName);
+        event->getSS().write(msg.data(), msg.size());
+
+        out.clear();
+        formatter->format(out, logger, (Server::LogLevel::Level)level, event);
+        std::cout.write(out.data(), out.size());
+        ++events;
+    }
+
+    if (!ok) {
+        std::cerr << "file ends in the middle of a record after " << events << " events" << std::endl;
+    }
+
+    munmap((void*)data, st.st_size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,350 @@
+#include "../source/log.hpp"
+#include "../source/logindex.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <string.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// Print the lines of a text log file within a time range, using the time
+// index written by FileLogAppender ("index: <seconds>") to skip to the
+// right offsets. The selected bytes are filtered in chunks on parallel threads.
+//   log_seek <file> [-f from] [-t to] [-l level] [-c logger] [-j threads] [-d date format]
+//            [-p pattern]
+// from / to: "YYYY-mm-dd HH:MM:SS" in local time, or seconds since epoch.
+// Lines are timed by the date at their start (-d, "%Y-%m-%d %H:%M:%S" by
+// default), a line without one belongs to the line before. The level is
+// read from the tab separated field holding %p in the LogFormatter pattern
+// of the file (-p, the default pattern of a logger by default).
+
+// bytes filtered by one thread at a time
+static const size_t CHUNK_SIZE = 8 * 1024 * 1024;
+
+struct Range {
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct Filter {
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    int level = 0;                  // lowest level printed, 0 for all
+    std::string logger;
+    std::string dateFormat = "%Y-%m-%d %H:%M:%S";
+    int levelField = 4;             // tab separated field of the level
+};
+
+static bool ParseTime(const char* str, uint64_t& time) {
+    char* end;
+    unsigned long long v = strtoull(str, &end, 10);
+    if (*str && !*end) {
+        time = v;
+        return true;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char* rest = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+    if (!rest || *rest) {
+        return false;
+    }
+    tm.tm_isdst = -1;
+    time = mktime(&tm);
+    return true;
+};
+
+// tab separated field of pattern holding %p, -1 if there is none
+static int LevelField(const std::string& pattern) {
+    int field = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] == '\t') {
+            ++field;
+            continue;
+        }
+        if (pattern[i] != '%' || i + 1 == pattern.size()) {
+            continue;
+        }
+        char c = pattern[++i];
+        if (c == 'T') {
+            ++field;
+        } else if (c == 'p') {
+            return field;
+        } else if (i + 1 < pattern.size() && pattern[i + 1] == '{') {
+            // "%d{...}", the date format has no fields
+            i = pattern.find('}', i);
+            if (i == std::string::npos) {
+                return -1;
+            }
+        }
+    }
+    return -1;
+};
+
+static bool IsWordChar(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+};
+
+// word occurs in [begin, end) not inside a longer word
+static bool HasWord(const char* begin, const char* end, std::string_view word) {
+    for (const char* p = begin; end - p >= (ptrdiff_t)word.size(); ++p) {
+        p = (const char*)memchr(p, word[0], end - p);
+        if (!p || end - p < (ptrdiff_t)word.size()) {
+            return false;
+        }
+        if (memcmp(p, word.data(), word.size()) == 0
+            && (p == begin || !IsWordChar(p[-1]))
+            && (p + word.size() == end || !IsWordChar(p[word.size()]))) {
+            return true;
+        }
+    }
+    return false;
+};
+
+class ChunkFilter {
+public:
+    ChunkFilter(const Filter& filter): m_filter{ filter } {}
+
+    void run(const char* begin, const char* end, std::string& out) {
+        bool keep = true;
+        for (const char* line = begin; line < end; ) {
+            const char* next = (const char*)memchr(line, '\n', end - line);
+            next = next ? next + 1 : end;
+
+            uint64_t time;
+            if (lineTime(line, next, time)) {
+                keep = time >= m_filter.from && time <= m_filter.to
+                    && matchLevel(line, next)
+                    && (m_filter.logger.empty() || HasWord(line, next, m_filter.logger));
+            }
+            if (keep) {
+                out.append(line, next - line);
+            }
+            line = next;
+        }
+    }
+
+private:
+    bool lineTime(const char* line, const char* end, uint64_t& time) {
+        char buf[64];
+        size_t len = std::min<size_t>(end - line, sizeof(buf) - 1);
+        memcpy(buf, line, len);
+        buf[len] = 0;
+
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (!strptime(buf, m_filter.dateFormat.c_str(), &tm)) {
+            return false;
+        }
+
+        // mktime is slow, only call it once per day
+        if (tm.tm_year != m_day.tm_year || tm.tm_yday != m_day.tm_yday
+            || tm.tm_mon != m_day.tm_mon || tm.tm_mday != m_day.tm_mday) {
+            m_day = tm;
+            struct tm midnight = tm;
+            midnight.tm_hour = midnight.tm_min = midnight.tm_sec = 0;
+            midnight.tm_isdst = -1;
+            m_midnight = mktime(&midnight);
+        }
+        time = m_midnight + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+        return true;
+    }
+
+    bool matchLevel(const char* line, const char* end) const {
+        if (!m_filter.level) {
+            return true;
+        }
+
+        // only the level field, the message may name any level
+        const char* field = line;
+        for (int i = 0; i < m_filter.levelField; ++i) {
+            field = (const char*)memchr(field, '\t', end - field);
+            if (!field) {
+                return false;
+            }
+            ++field;
+        }
+        const char* fieldEnd = (const char*)memchr(field, '\t', end - field);
+        fieldEnd = fieldEnd ? fieldEnd : end;
+
+        for (int l = m_filter.level; l <= (int)Server::LogLevel::Level::FATAL; ++l) {
+            if (HasWord(field, fieldEnd, Server::LogLevel::ToString((Server::LogLevel::Level)l))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    const Filter& m_filter;
+    struct tm m_day = {};
+    time_t m_midnight = 0;
+};
+
+// byte ranges of the file which may hold matching lines
+static std::vector<Range> SelectRanges(const std::string& file, uint64_t size, const Filter& filter) {
+    std::vector<Range> ranges;
+    Server::LogIndexReader index;
+    if (!index.open(Server::LogIndex::PathOf(file))) {
+        std::cerr << "no time index " << Server::LogIndex::PathOf(file)
+                  << ", scanning the whole file" << std::endl;
+        ranges.push_back({ 0, size });
+        return ranges;
+    }
+
+    uint32_t levels = 0;
+    for (int l = filter.level; filter.level && l <= (int)Server::LogLevel::Level::FATAL; ++l) {
+        levels |= 1u << l;
+    }
+    uint64_t logger = filter.logger.empty() ? 0 : Server::LogIndex::LoggerBit(filter.logger);
+
+    auto& entries = index.getEntries();
+    auto found = index.find(filter.from, filter.to);
+    for (size_t i = found.first; i < found.second; ++i) {
+        auto& e = entries[i];
+        if ((levels && !(e.levels & levels)) || (logger && !(e.loggers & logger))) {
+            continue;
+        }
+        uint64_t begin = std::min(e.offset, size);
+        uint64_t end = std::min(e.offset + e.length, size);
+        if (!ranges.empty() && ranges.back().end == begin) {
+            ranges.back().end = end;
+        } else if (begin < end) {
+            ranges.push_back({ begin, end });
+        }
+    }
+
+    // lines of the open bucket are not indexed yet
+    uint64_t indexed = entries.empty() ? 0 : entries.back().offset + entries.back().length;
+    if (indexed < size && (entries.empty() || filter.to >= entries.back().time)) {
+        if (!ranges.empty() && ranges.back().end == indexed) {
+            ranges.back().end = size;
+        } else {
+            ranges.push_back({ indexed, size });
+        }
+    }
+    return ranges;
+};
+
+// split the ranges at line ends into chunks of about CHUNK_SIZE
+static std::vector<Range> SplitChunks(const char* data, const std::vector<Range>& ranges) {
+    std::vector<Range> chunks;
+    for (auto& r : ranges) {
+        uint64_t begin = r.begin;
+        while (begin < r.end) {
+            uint64_t end = std::min(begin + CHUNK_SIZE, r.end);
+            if (end < r.end) {
+                const char* nl = (const char*)memchr(data + end, '\n', r.end - end);
+                end = nl ? nl - data + 1 : r.end;
+            }
+            chunks.push_back({ begin, end });
+            begin = end;
+        }
+    }
+    return chunks;
+};
+
+int main(int argc, char** argv) {
+    Filter filter;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:l:c:j:d:p:")) != -1) {
+        switch (opt) {
+            case 'f':
+            case 't':
+                if (!ParseTime(optarg, opt == 'f' ? filter.from : filter.to)) {
+                    std::cerr << "invalid time: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'l':
+                filter.level = (int)Server::LogLevel::FromString(optarg);
+                break;
+            case 'c':
+                filter.logger = optarg;
+                break;
+            case 'j':
+                threads = std::max(1, atoi(optarg));
+                break;
+            case 'd':
+                filter.dateFormat = optarg;
+                break;
+            case 'p':
+                filter.levelField = LevelField(optarg);
+                if (filter.levelField < 0) {
+                    std::cerr << "pattern has no %p: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            default:
+                optind = argc + 1;
+        }
+    }
+    if (optind != argc - 1) {
+        std::cerr << "usage: " << argv[0] << " <file> [-f from] [-t to] [-l level] [-c logger]"
+                  << " [-j threads] [-d date format] [-p pattern]" << std::endl;
+        return 1;
+    }
+    std::string file = argv[optind];
+
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "open " << file << " failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const char* data = (const char*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cerr << "mmap failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::vector<Range> chunks = SplitChunks(data, SelectRanges(file, st.st_size, filter));
+
+    // a window of chunks at a time, printed in file order
+    size_t window = threads * 4;
+    for (size_t base = 0; base < chunks.size(); base += window) {
+        size_t count = std::min(window, chunks.size() - base);
+        std::vector<std::string> out(count);
+        std::atomic<size_t> next{ 0 };
+        auto work = [&]() {
+            ChunkFilter chunkFilter(filter);
+            for (size_t i; (i = next++) < count; ) {
+                const Range& c = chunks[base + i];
+                // read ahead the chunk, the pages between chunks are never touched
+                uint64_t page = c.begin & ~(uint64_t)(getpagesize() - 1);
+                madvise((void*)(data + page), c.end - page, MADV_WILLNEED);
+                chunkFilter.run(data + c.begin, data + c.end, out[i]);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < std::min<size_t>(threads, count); ++i) {
+            workers.emplace_back(work);
+        }
+        work();
+        for (auto& t : workers) {
+            t.join();
+        }
+
+        for (auto& o : out) {
+            std::cout.write(o.data(), o.size());
+        }
+    }
+
+    munmap((void*)data, st.st_size);
+    close(fd);
+    return 0;
+}